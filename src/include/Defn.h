@@ -712,8 +712,14 @@ SEXP R_compact_intrange(R_xlen_t n1, R_xlen_t n2);
 SEXP R_deferred_coerceToString(SEXP v, SEXP info);
 SEXP R_virtrep_vec(SEXP, SEXP);
 SEXP R_tryWrap(SEXP);
+SEXP R_tryWrapSorted(SEXP, int, int);
 SEXP R_tryUnwrap(SEXP);
 
+/* hash indices for match() and duplicated() */
+SEXP R_MakeHashIndex(SEXP);
+SEXP R_HashIndexOf(SEXP);
+SEXP R_HashIndexData(SEXP);
+
 Rboolean Rf_pmatch(SEXP, SEXP, Rboolean);
 Rboolean Rf_psmatch(const char *, const char *, Rboolean);
 void Rf_printwhere(void);
@@ -1070,7 +1076,7 @@ extern int putenv(char *string);
 #endif
 #endif
 
-#define HSIZE	  49157	/* The size of the hash table for symbols */
+#define HSIZE	  49157	/* The initial size of the hash table for symbols */
 #define MAXIDSIZE 10000	/* Largest symbol size,
 			   in bytes excluding terminator.
 			   Was 256 prior to 2.13.0, now just a sanity check.
@@ -1485,6 +1491,7 @@ void R_ReleaseMSet(SEXP mset, int keepSize);
 extern0 SEXP	R_CurrentExpr;	    /* Currently evaluating expression */
 extern0 SEXP	R_ReturnedValue;    /* Slot for return-ing values */
 extern0 SEXP*	R_SymbolTable;	    /* The symbol table */
+extern0 int	R_SymbolTableSize INI_as(HSIZE); /* and its size, see names.c */
 #ifdef R_USE_SIGNALS
 extern0 RCNTXT R_Toplevel;	      /* Storage for the toplevel context */
 extern0 RCNTXT* R_ToplevelContext;  /* The toplevel context */
@@ -1501,6 +1508,10 @@ extern0 int	R_Expressions_keep INI_as(5000);/* options(expressions) */
 extern0 Rboolean R_KeepSource	INI_as(FALSE);	/* options(keep.source) */
 extern0 Rboolean R_CBoundsCheck	INI_as(FALSE);	/* options(CBoundsCheck) */
 extern0 MATPROD_TYPE R_Matprod	INI_as(MATPROD_DEFAULT);  /* options(matprod) */
+extern0 int	R_ArithThreads	INI_as(1);	/* options(arith.threads) */
+extern0 int	R_SummaryThreads INI_as(1);	/* options(summary.threads) */
+extern0 int	R_HashThreads	INI_as(1);	/* options(hash.threads) */
+extern0 int	R_SortThreads	INI_as(1);	/* options(sort.threads) */
 extern0 int	R_WarnLength	INI_as(1000);	/* Error/warning max length */
 extern0 int	R_nwarnings	INI_as(50);
 
@@ -1607,6 +1618,7 @@ extern0 int R_jit_enabled INI_as(0); /* has to be 0 during R startup */
 extern0 int R_compile_pkgs INI_as(0);
 extern0 int R_check_constants INI_as(0);
 extern0 int R_disable_bytecode INI_as(0);
+extern0 R_size_t R_BindingEpoch INI_as(1); /* see envir.c */
 extern SEXP R_cmpfun1(SEXP); /* unconditional fresh compilation */
 extern void R_init_jit_enabled(void);
 extern void R_initEvalSymbols(void);
@@ -1725,6 +1737,8 @@ int R_NaN_is_R_NA(double);
 
 /* Environment and Binding Features */
 void R_RestoreHashCount(SEXP rho);
+Rboolean R_IsOpenFrame(SEXP rho);
+void R_OpenFrameToCells(SEXP rho);
 
 # define allocCharsxp		Rf_allocCharsxp
 # define asVecSize		Rf_asVecSize
@@ -1776,6 +1790,7 @@ void R_RestoreHashCount(SEXP rho);
 # define getVar			Rf_getVar
 # define getVarInFrame		Rf_getVarInFrame
 # define InitArithmetic		Rf_InitArithmetic
+# define InitAttribIndex	Rf_InitAttribIndex
 # define InitConnections	Rf_InitConnections
 # define InitEd			Rf_InitEd
 # define InitFunctionHashing	Rf_InitFunctionHashing
@@ -1918,6 +1933,8 @@ typedef struct { SEXP cell; } R_varloc_t; /* use struct to prevent casting */
 #define R_VARLOC_IS_NULL(loc) ((loc).cell == NULL)
 R_varloc_t R_findVarLocInFrame(SEXP, SEXP);
 R_varloc_t R_findVarLoc(SEXP, SEXP);
+SEXP R_findVarLocForCache(SEXP, SEXP, Rboolean);
+SEXP R_findVarLocInFrameForCache(SEXP, SEXP);
 SEXP R_GetVarLocValue(R_varloc_t);
 SEXP R_GetVarLocSymbol(R_varloc_t);
 Rboolean R_GetVarLocMISSING(R_varloc_t);
@@ -1952,6 +1969,7 @@ SEXP Rf_StringFromLogical(int, int*);
 SEXP Rf_StringFromInteger(int, int*);
 SEXP Rf_StringFromReal(double, int*);
 SEXP Rf_StringFromComplex(Rcomplex, int*);
+int R_StringBufFromReal(double, const char *, char *, int);
 SEXP Rf_EnsureString(SEXP);
 
 /* ../../main/print.c : */
@@ -2064,6 +2082,7 @@ void R_reInitTempDir(int);
 void InitTypeTables(void);
 void initStack(void);
 void InitS3DefaultTypes(void);
+void InitAttribIndex(void);
 void internalTypeCheck(SEXP, SEXP, SEXPTYPE);
 Rboolean isMethodsDispatchOn(void);
 int isValidName(const char *);
@@ -2119,6 +2138,7 @@ SEXP R_data_class2(SEXP);
 char *R_LibraryFileName(const char *, char *, size_t);
 SEXP R_LoadFromFile(FILE*, int);
 SEXP R_NewHashedEnv(SEXP, int);
+SEXP R_NewOpenHashedEnv(SEXP, int);
 extern int R_Newhashpjw(const char *);
 FILE* R_OpenLibraryFile(const char *);
 SEXP R_Primitive(const char *);
@@ -112,6 +112,7 @@ SEXP do_commentgets(SEXP, SEXP, SEXP, SEXP);
 SEXP do_compareNumericVersion(SEXP, SEXP, SEXP, SEXP);
 SEXP do_compilerVersion(SEXP, SEXP, SEXP, SEXP);
 SEXP do_complex(SEXP, SEXP, SEXP, SEXP);
+SEXP do_compressVector(SEXP, SEXP, SEXP, SEXP);
 SEXP do_contourLines(SEXP, SEXP, SEXP, SEXP);
 SEXP do_copyDFattr(SEXP, SEXP, SEXP, SEXP);
 SEXP do_crc64(SEXP, SEXP, SEXP, SEXP);
@@ -137,6 +138,7 @@ SEXP do_dimnamesgets(SEXP, SEXP, SEXP, SEXP);
 SEXP do_dircreate(SEXP, SEXP, SEXP, SEXP);
 SEXP do_direxists(SEXP, SEXP, SEXP, SEXP);
 SEXP do_dirname(SEXP, SEXP, SEXP, SEXP);
+SEXP do_dispatchcachestats(SEXP, SEXP, SEXP, SEXP);
 SEXP do_docall(SEXP, SEXP, SEXP, SEXP);
 SEXP do_dotcall(SEXP, SEXP, SEXP, SEXP);
 SEXP do_dotsElt(SEXP, SEXP, SEXP, SEXP);
@@ -190,7 +192,9 @@ SEXP do_formatPOSIXlt(SEXP, SEXP, SEXP, SEXP);
 SEXP do_formals(SEXP, SEXP, SEXP, SEXP);
 SEXP do_function(SEXP, SEXP, SEXP, SEXP);
 SEXP do_gc(SEXP, SEXP, SEXP, SEXP);
+SEXP do_gcincremental(SEXP, SEXP, SEXP, SEXP);
 SEXP do_gcinfo(SEXP, SEXP, SEXP, SEXP);
+SEXP do_gcstats(SEXP, SEXP, SEXP, SEXP);
 SEXP do_gctime(SEXP, SEXP, SEXP, SEXP);
 SEXP do_gctorture(SEXP, SEXP, SEXP, SEXP);
 SEXP do_gctorture2(SEXP, SEXP, SEXP, SEXP);
@@ -214,6 +218,7 @@ SEXP do_globalenv(SEXP, SEXP, SEXP, SEXP);
 SEXP do_grep(SEXP, SEXP, SEXP, SEXP);
 SEXP do_grepraw(SEXP, SEXP, SEXP, SEXP);
 SEXP do_gsub(SEXP, SEXP, SEXP, SEXP);
+SEXP do_hashIndex(SEXP, SEXP, SEXP, SEXP);
 SEXP do_iconv(SEXP, SEXP, SEXP, SEXP);
 SEXP do_ICUget(SEXP, SEXP, SEXP, SEXP);
 SEXP do_ICUset(SEXP, SEXP, SEXP, SEXP);
@@ -284,6 +289,7 @@ SEXP do_memoryprofile(SEXP, SEXP, SEXP, SEXP);
 SEXP do_merge(SEXP, SEXP, SEXP, SEXP);
 SEXP do_mget(SEXP, SEXP, SEXP, SEXP);
 SEXP do_missing(SEXP, SEXP, SEXP, SEXP);
+SEXP do_mmap_columns(SEXP, SEXP, SEXP, SEXP);
 SEXP do_mmap_file(SEXP, SEXP, SEXP, SEXP);
 SEXP do_munmap_file(SEXP, SEXP, SEXP, SEXP);
 SEXP do_named(SEXP, SEXP, SEXP, SEXP);
@@ -311,6 +317,7 @@ SEXP do_pcre_config(SEXP, SEXP, SEXP, SEXP);
 SEXP do_pmatch(SEXP, SEXP, SEXP, SEXP);
 SEXP do_pmin(SEXP, SEXP, SEXP, SEXP);
 SEXP do_polyroot(SEXP, SEXP, SEXP, SEXP);
+SEXP do_porder(SEXP, SEXP, SEXP, SEXP);
 SEXP do_pos2env(SEXP, SEXP, SEXP, SEXP);
 SEXP do_POSIXlt2D(SEXP, SEXP, SEXP, SEXP);
 SEXP do_pretty(SEXP, SEXP, SEXP, SEXP);
@@ -400,6 +407,7 @@ SEXP do_standardGeneric(SEXP, SEXP, SEXP, SEXP);
 SEXP do_startsWith(SEXP, SEXP, SEXP, SEXP);
 NORET SEXP do_stop(SEXP, SEXP, SEXP, SEXP);
 SEXP do_storage_mode(SEXP, SEXP, SEXP, SEXP);
+SEXP do_stringcachestats(SEXP, SEXP, SEXP, SEXP);
 SEXP do_strrep(SEXP, SEXP, SEXP, SEXP);
 SEXP do_strsplit(SEXP,SEXP,SEXP,SEXP);
 SEXP do_strptime(SEXP,SEXP,SEXP,SEXP);
@@ -485,6 +493,8 @@ SEXP do_putconst(SEXP, SEXP, SEXP, SEXP);
 SEXP do_getconst(SEXP, SEXP, SEXP, SEXP);
 SEXP do_enablejit(SEXP, SEXP, SEXP, SEXP);
 SEXP do_compilepkgs(SEXP, SEXP, SEXP, SEXP);
+SEXP do_lookupcachestats(SEXP, SEXP, SEXP, SEXP);
+SEXP do_jitprofile(SEXP, SEXP, SEXP, SEXP);
 
 /* Connections */
 SEXP do_stdin(SEXP, SEXP, SEXP, SEXP);
@@ -80,8 +80,8 @@ static const R_ExternalMethodDef ExtEntries[] = {
     EXTDEF(download, 6),
 #endif
     EXTDEF(unzip, 7),
-    EXTDEF(Rprof, 10),
-    EXTDEF(Rprofmem, 3),
+    EXTDEF(Rprof, 11),
+    EXTDEF(Rprofmem, 4),
 
     EXTDEF(countfields, 6),
     EXTDEF(readtablehead, 7),
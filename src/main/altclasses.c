@@ -586,6 +586,566 @@ attribute_hidden SEXP R_compact_intrange(R_xlen_t n1, R_xlen_t n2)
 }
 
 
+/**
+ ** Compressed Integer and Real Vectors
+ **/
+
+/* Compressed vectors hold their data in blocks of CMPVEC_BLOCK
+   elements.  A block of whole numbers without NAs is stored as its
+   first value and the differences between consecutive values, less
+   the smallest difference, packed in as few bits as needed, so runs
+   and arithmetic sequences take no space at all and slowly increasing
+   ids or time stamps a few bits per element.  Other blocks are stored
+   as they are.  Each block records its minimum, maximum, sum and
+   number of NAs, from which the vector's summaries are computed when
+   it is created, so these and the sortedness are available without
+   decompressing.
+
+   The compressed data are held in a RAWSXP in data1: a header, the
+   table of blocks, and the data of the blocks.  Blocks are
+   decompressed by Elt and Get_region as needed, the last one being
+   kept in a cache; the full vector is only created, in data2, when
+   the data pointer is requested.  Like compact sequences, compressed
+   vectors are marked as not mutable, so they still match the
+   compressed data once expanded. */
+
+#define CMPVEC_BLOCK 1024
+
+typedef struct {
+    int64_t first;	/* first value of a packed block */
+    int64_t mindelta;	/* smallest difference between values */
+    int64_t sum;	/* of the non-NA values, if whole numbers */
+    double min, max;	/* of the non-NA values */
+    size_t offset;	/* of the data from the start of the data area */
+    int width;		/* bits per difference, or -1 if not packed */
+    int nna;		/* number of NAs */
+} cmpvec_block_t;
+
+typedef struct {
+    R_xlen_t length;
+    R_xlen_t nblocks;
+    R_xlen_t nna;
+    R_xlen_t npacked;
+    int64_t sum;	/* of the non-NA values, if 'exact' */
+    double min, max;	/* of the non-NA values, if there are any */
+    int exact;		/* is 'sum' the exact sum? */
+    int sorted;
+    unsigned int serial; /* identifies the vector in the block cache */
+    int type;
+} cmpvec_header_t;
+
+#define CMPVEC_DATA(x) R_altrep_data1(x)
+#define CMPVEC_EXPANDED(x) R_altrep_data2(x)
+#define SET_CMPVEC_EXPANDED(x, v) R_set_altrep_data2(x, v)
+
+#define CMPVEC_ALIGN(n) (((n) + 7) & ~((size_t) 7))
+#define CMPVEC_HEADER(data) ((cmpvec_header_t *) RAW0(data))
+#define CMPVEC_BLOCKS(data)						\
+    ((cmpvec_block_t *) (RAW0(data) + CMPVEC_ALIGN(sizeof(cmpvec_header_t))))
+#define CMPVEC_DATA_START(nblocks)					\
+    (CMPVEC_ALIGN(sizeof(cmpvec_header_t)) +				\
+     CMPVEC_ALIGN((nblocks) * sizeof(cmpvec_block_t)))
+#define CMPVEC_BLOCK_LENGTH(hdr, b)					\
+    ((b) < (hdr)->nblocks - 1 ? CMPVEC_BLOCK :				\
+     (int) ((hdr)->length - (b) * CMPVEC_BLOCK))
+
+static R_altrep_class_t cmpvec_integer_class;
+static R_altrep_class_t cmpvec_real_class;
+
+static R_INLINE void cmpvec_put_bits(uint64_t *words, size_t pos, int width,
+				     uint64_t v)
+{
+    size_t w = pos / 64;
+    int shift = pos % 64;
+    words[w] |= v << shift;
+    if (shift + width > 64)
+	words[w + 1] |= v >> (64 - shift);
+}
+
+/* Decompress block 'b' into 'buf', of the vector's type. */
+static void cmpvec_decode_block(SEXP data, R_xlen_t b, void *buf)
+{
+    cmpvec_header_t *hdr = CMPVEC_HEADER(data);
+    cmpvec_block_t *blk = CMPVEC_BLOCKS(data) + b;
+    int m = CMPVEC_BLOCK_LENGTH(hdr, b);
+    const void *src = RAW0(data) + CMPVEC_DATA_START(hdr->nblocks) +
+	blk->offset;
+
+    if (blk->width < 0) {
+	memcpy(buf, src, m * (hdr->type == INTSXP ? sizeof(int) :
+			      sizeof(double)));
+	return;
+    }
+
+    /* the differences are decoded first, then summed in place */
+    int64_t v[CMPVEC_BLOCK];
+    const uint64_t *words = src;
+    int width = blk->width;
+    int64_t mind = blk->mindelta;
+    v[0] = blk->first;
+    if (width == 0)
+	for (int k = 1; k < m; k++) v[k] = mind;
+    else {
+	uint64_t mask = width == 64 ? ~(uint64_t) 0 :
+	    ((uint64_t) 1 << width) - 1;
+	size_t pos = 0;
+	for (int k = 1; k < m; k++, pos += width) {
+	    size_t w = pos / 64;
+	    int shift = pos % 64;
+	    uint64_t u = words[w] >> shift;
+	    if (shift + width > 64)
+		u |= words[w + 1] << (64 - shift);
+	    v[k] = mind + (int64_t) (u & mask);
+	}
+    }
+    for (int k = 1; k < m; k++) v[k] += v[k - 1];
+    if (hdr->type == INTSXP) {
+	int *ibuf = buf;
+	for (int k = 0; k < m; k++) ibuf[k] = (int) v[k];
+    }
+    else {
+	double *dbuf = buf;
+	for (int k = 0; k < m; k++) dbuf[k] = (double) v[k];
+    }
+}
+
+/* The last decompressed block, identified by the serial number of its
+   vector, as addresses of vectors may be reused. */
+static struct {
+    unsigned int serial;
+    R_xlen_t block;
+    union { int i[CMPVEC_BLOCK]; double d[CMPVEC_BLOCK]; } values;
+} cmpvec_cache = { 0, -1 };
+
+static R_INLINE const void *cmpvec_cached_block(SEXP data, R_xlen_t b)
+{
+    unsigned int serial = CMPVEC_HEADER(data)->serial;
+    if (cmpvec_cache.serial != serial || cmpvec_cache.block != b) {
+	cmpvec_decode_block(data, b, &cmpvec_cache.values);
+	cmpvec_cache.serial = serial;
+	cmpvec_cache.block = b;
+    }
+    return &cmpvec_cache.values;
+}
+
+static R_xlen_t cmpvec_get_region(SEXP x, R_xlen_t i, R_xlen_t n, void *buf,
+				  size_t eltsize)
+{
+    SEXP data = CMPVEC_DATA(x);
+    R_xlen_t size = CMPVEC_HEADER(data)->length;
+    R_xlen_t ncopy = size - i > n ? n : size - i;
+    char *cbuf = buf;
+    SEXP val = CMPVEC_EXPANDED(x);
+    if (val != R_NilValue) {
+	memcpy(buf, (const char *) DATAPTR_RO(val) + i * eltsize,
+	       ncopy * eltsize);
+	return ncopy;
+    }
+    for (R_xlen_t k = 0; k < ncopy; ) {
+	R_xlen_t b = (i + k) / CMPVEC_BLOCK, start = (i + k) % CMPVEC_BLOCK;
+	R_xlen_t m = CMPVEC_BLOCK - start;
+	if (m > ncopy - k) m = ncopy - k;
+	if (start == 0 && m == CMPVEC_BLOCK)
+	    cmpvec_decode_block(data, b, cbuf + k * eltsize);
+	else
+	    memcpy(cbuf + k * eltsize,
+		   (const char *) cmpvec_cached_block(data, b) + start * eltsize,
+		   m * eltsize);
+	k += m;
+    }
+    return ncopy;
+}
+
+
+/*
+ * ALTREP Methods
+ */
+
+static SEXP cmpvec_Duplicate(SEXP x, Rboolean deep)
+{
+    /* a duplicate is usually made for modifying, so expand it */
+    R_xlen_t n = XLENGTH(x);
+    SEXP val = allocVector(TYPEOF(x), n);
+    if (TYPEOF(x) == INTSXP)
+	INTEGER_GET_REGION(x, 0, n, INTEGER0(val));
+    else
+	REAL_GET_REGION(x, 0, n, REAL0(val));
+    return val;
+}
+
+static Rboolean cmpvec_Inspect(SEXP x, int pre, int deep, int pvec,
+			       void (*inspect_subtree)(SEXP, int, int, int))
+{
+    SEXP data = CMPVEC_DATA(x);
+    cmpvec_header_t *hdr = CMPVEC_HEADER(data);
+    Rprintf(" compressed %s [blocks=%lld,packed=%lld,bytes=%lld]%s\n",
+	    R_typeToChar(x), (long long) hdr->nblocks,
+	    (long long) hdr->npacked, (long long) XLENGTH(data),
+	    CMPVEC_EXPANDED(x) == R_NilValue ? "" : " (expanded)");
+    return TRUE;
+}
+
+static R_xlen_t cmpvec_Length(SEXP x)
+{
+    return CMPVEC_HEADER(CMPVEC_DATA(x))->length;
+}
+
+
+/*
+ * ALTVEC Methods
+ */
+
+static void *cmpvec_Dataptr(SEXP x, Rboolean writeable)
+{
+    SEXP val = CMPVEC_EXPANDED(x);
+    if (val == R_NilValue) {
+	PROTECT(x);
+	val = cmpvec_Duplicate(x, FALSE);
+	SET_CMPVEC_EXPANDED(x, val);
+	UNPROTECT(1);
+    }
+    return DATAPTR(val);
+}
+
+static const void *cmpvec_Dataptr_or_null(SEXP x)
+{
+    SEXP val = CMPVEC_EXPANDED(x);
+    return val == R_NilValue ? NULL : DATAPTR_RO(val);
+}
+
+static int cmpvec_Is_sorted(SEXP x)
+{
+    return CMPVEC_HEADER(CMPVEC_DATA(x))->sorted;
+}
+
+static int cmpvec_No_NA(SEXP x)
+{
+    return CMPVEC_HEADER(CMPVEC_DATA(x))->nna == 0;
+}
+
+
+/*
+ * ALTINTEGER Methods
+ */
+
+static int cmpvec_integer_Elt(SEXP x, R_xlen_t i)
+{
+    SEXP val = CMPVEC_EXPANDED(x);
+    if (val != R_NilValue)
+	return INTEGER0(val)[i];
+    const int *block = cmpvec_cached_block(CMPVEC_DATA(x), i / CMPVEC_BLOCK);
+    return block[i % CMPVEC_BLOCK];
+}
+
+static
+R_xlen_t cmpvec_integer_Get_region(SEXP x, R_xlen_t i, R_xlen_t n, int *buf)
+{
+    return cmpvec_get_region(x, i, n, buf, sizeof(int));
+}
+
+/* These give the same results as isum(), imin() and imax() in
+   summary.c, or NULL to leave the computation to them. */
+static SEXP cmpvec_integer_Sum(SEXP x, Rboolean narm)
+{
+    cmpvec_header_t *hdr = CMPVEC_HEADER(CMPVEC_DATA(x));
+    if (hdr->nna > 0 && ! narm)
+	return ScalarInteger(NA_INTEGER);
+    if (hdr->sum > INT_MAX || hdr->sum < R_INT_MIN)
+	return NULL; /* overflow */
+    return ScalarInteger((int) hdr->sum);
+}
+
+static SEXP cmpvec_integer_Min(SEXP x, Rboolean narm)
+{
+    cmpvec_header_t *hdr = CMPVEC_HEADER(CMPVEC_DATA(x));
+    if (hdr->nna > 0 && ! narm)
+	return ScalarInteger(NA_INTEGER);
+    return hdr->nna < hdr->length ? ScalarInteger((int) hdr->min) : NULL;
+}
+
+static SEXP cmpvec_integer_Max(SEXP x, Rboolean narm)
+{
+    cmpvec_header_t *hdr = CMPVEC_HEADER(CMPVEC_DATA(x));
+    if (hdr->nna > 0 && ! narm)
+	return ScalarInteger(NA_INTEGER);
+    return hdr->nna < hdr->length ? ScalarInteger((int) hdr->max) : NULL;
+}
+
+
+/*
+ * ALTREAL Methods
+ */
+
+static double cmpvec_real_Elt(SEXP x, R_xlen_t i)
+{
+    SEXP val = CMPVEC_EXPANDED(x);
+    if (val != R_NilValue)
+	return REAL0(val)[i];
+    const double *block =
+	cmpvec_cached_block(CMPVEC_DATA(x), i / CMPVEC_BLOCK);
+    return block[i % CMPVEC_BLOCK];
+}
+
+static
+R_xlen_t cmpvec_real_Get_region(SEXP x, R_xlen_t i, R_xlen_t n, double *buf)
+{
+    return cmpvec_get_region(x, i, n, buf, sizeof(double));
+}
+
+/* For doubles the sum is only known exactly when all blocks are
+   packed whole numbers, and the sum of their absolute values is below
+   2^53, so rsum() would compute it exactly too.  With NAs rsum() and
+   rmin() distinguish NA and NaN, so these are left to them. */
+static SEXP cmpvec_real_Sum(SEXP x, Rboolean narm)
+{
+    cmpvec_header_t *hdr = CMPVEC_HEADER(CMPVEC_DATA(x));
+    return hdr->nna == 0 && hdr->exact ? ScalarReal((double) hdr->sum) : NULL;
+}
+
+static SEXP cmpvec_real_Min(SEXP x, Rboolean narm)
+{
+    cmpvec_header_t *hdr = CMPVEC_HEADER(CMPVEC_DATA(x));
+    return hdr->nna == 0 && hdr->length > 0 ? ScalarReal(hdr->min) : NULL;
+}
+
+static SEXP cmpvec_real_Max(SEXP x, Rboolean narm)
+{
+    cmpvec_header_t *hdr = CMPVEC_HEADER(CMPVEC_DATA(x));
+    return hdr->nna == 0 && hdr->length > 0 ? ScalarReal(hdr->max) : NULL;
+}
+
+
+/*
+ * Class Objects and Method Tables
+ */
+
+static void InitCompressedVectorClasses(void)
+{
+    R_altrep_class_t cls;
+
+    cls = R_make_altinteger_class("compressed_integer", "base", NULL);
+    cmpvec_integer_class = cls;
+    R_set_altrep_Duplicate_method(cls, cmpvec_Duplicate);
+    R_set_altrep_Inspect_method(cls, cmpvec_Inspect);
+    R_set_altrep_Length_method(cls, cmpvec_Length);
+    R_set_altvec_Dataptr_method(cls, cmpvec_Dataptr);
+    R_set_altvec_Dataptr_or_null_method(cls, cmpvec_Dataptr_or_null);
+    R_set_altinteger_Elt_method(cls, cmpvec_integer_Elt);
+    R_set_altinteger_Get_region_method(cls, cmpvec_integer_Get_region);
+    R_set_altinteger_Is_sorted_method(cls, cmpvec_Is_sorted);
+    R_set_altinteger_No_NA_method(cls, cmpvec_No_NA);
+    R_set_altinteger_Sum_method(cls, cmpvec_integer_Sum);
+    R_set_altinteger_Min_method(cls, cmpvec_integer_Min);
+    R_set_altinteger_Max_method(cls, cmpvec_integer_Max);
+
+    cls = R_make_altreal_class("compressed_real", "base", NULL);
+    cmpvec_real_class = cls;
+    R_set_altrep_Duplicate_method(cls, cmpvec_Duplicate);
+    R_set_altrep_Inspect_method(cls, cmpvec_Inspect);
+    R_set_altrep_Length_method(cls, cmpvec_Length);
+    R_set_altvec_Dataptr_method(cls, cmpvec_Dataptr);
+    R_set_altvec_Dataptr_or_null_method(cls, cmpvec_Dataptr_or_null);
+    R_set_altreal_Elt_method(cls, cmpvec_real_Elt);
+    R_set_altreal_Get_region_method(cls, cmpvec_real_Get_region);
+    R_set_altreal_Is_sorted_method(cls, cmpvec_Is_sorted);
+    R_set_altreal_No_NA_method(cls, cmpvec_No_NA);
+    R_set_altreal_Sum_method(cls, cmpvec_real_Sum);
+    R_set_altreal_Min_method(cls, cmpvec_real_Min);
+    R_set_altreal_Max_method(cls, cmpvec_real_Max);
+}
+
+
+/*
+ * Constructor
+ */
+
+/* Read block 'b' of 'x' as 64-bit integers if it can be packed,
+   filling in its meta data; returns the number of values. */
+static int cmpvec_scan_block(SEXP x, R_xlen_t b, int64_t *v, void *buf,
+			     cmpvec_block_t *blk)
+{
+    int type = TYPEOF(x);
+    R_xlen_t n = XLENGTH(x);
+    int m = (int) (n - b * CMPVEC_BLOCK < CMPVEC_BLOCK ?
+		   n - b * CMPVEC_BLOCK : CMPVEC_BLOCK);
+    Rboolean packable = TRUE, first = TRUE;
+
+    blk->nna = 0;
+    blk->sum = 0;
+    blk->min = blk->max = 0;
+    if (type == INTSXP) {
+	int *ibuf = buf;
+	INTEGER_GET_REGION(x, b * CMPVEC_BLOCK, m, ibuf);
+	for (int k = 0; k < m; k++) {
+	    if (ibuf[k] == NA_INTEGER) {
+		blk->nna++;
+		packable = FALSE;
+		continue;
+	    }
+	    v[k] = ibuf[k];
+	    blk->sum += ibuf[k];
+	    if (first || ibuf[k] < blk->min) blk->min = ibuf[k];
+	    if (first || ibuf[k] > blk->max) blk->max = ibuf[k];
+	    first = FALSE;
+	}
+    }
+    else {
+	double *dbuf = buf;
+	REAL_GET_REGION(x, b * CMPVEC_BLOCK, m, dbuf);
+	for (int k = 0; k < m; k++) {
+	    double d = dbuf[k];
+	    if (ISNAN(d)) {
+		blk->nna++;
+		packable = FALSE;
+		continue;
+	    }
+	    /* as in rmin() and rmax(), the first of equal values is kept */
+	    if (first || d < blk->min) blk->min = d;
+	    if (first || d > blk->max) blk->max = d;
+	    first = FALSE;
+	    if (packable &&
+		(d != trunc(d) || fabs(d) > 9007199254740992.0 /* 2^53 */ ||
+		 (d == 0 && signbit(d))))
+		packable = FALSE;
+	    if (packable) {
+		v[k] = (int64_t) d;
+		blk->sum += v[k];
+	    }
+	}
+    }
+
+    blk->width = -1;
+    if (packable) {
+	int64_t mind = 0, maxd = 0;
+	for (int k = 1; k < m; k++) {
+	    int64_t d = v[k] - v[k - 1];
+	    if (k == 1 || d < mind) mind = d;
+	    if (k == 1 || d > maxd) maxd = d;
+	}
+	uint64_t range = (uint64_t) maxd - (uint64_t) mind;
+	int width = 0;
+	while (width < 64 && (range >> width) != 0) width++;
+	blk->first = v[0];
+	blk->mindelta = mind;
+	blk->width = width;
+    }
+    return m;
+}
+
+static size_t cmpvec_block_size(cmpvec_block_t *blk, int m, int type)
+{
+    if (blk->width < 0)
+	return CMPVEC_ALIGN(m * (type == INTSXP ? sizeof(int) : sizeof(double)));
+    else
+	return ((size_t) (m - 1) * blk->width + 63) / 64 * sizeof(uint64_t);
+}
+
+static unsigned int cmpvec_serial = 0;
+
+static SEXP compress_vector(SEXP x)
+{
+    int type = TYPEOF(x);
+    R_xlen_t n = XLENGTH(x);
+    size_t eltsize = type == INTSXP ? sizeof(int) : sizeof(double);
+    R_xlen_t nblocks = (n + CMPVEC_BLOCK - 1) / CMPVEC_BLOCK;
+    int64_t v[CMPVEC_BLOCK];
+    double buf[CMPVEC_BLOCK];
+    cmpvec_block_t blk;
+
+    /* first pass: find the size */
+    size_t size = CMPVEC_DATA_START(nblocks);
+    for (R_xlen_t b = 0; b < nblocks; b++) {
+	int m = cmpvec_scan_block(x, b, v, buf, &blk);
+	size += cmpvec_block_size(&blk, m, type);
+	if (size > 0.75 * eltsize * n)
+	    return x; /* not worth it */
+    }
+
+    /* second pass: fill in the blocks and the summaries */
+    SEXP data = PROTECT(allocVector(RAWSXP, size));
+    memset(RAW0(data), 0, size);
+    cmpvec_header_t *hdr = CMPVEC_HEADER(data);
+    cmpvec_block_t *blocks = CMPVEC_BLOCKS(data);
+    char *start = (char *) RAW0(data) + CMPVEC_DATA_START(nblocks);
+    Rboolean incr = TRUE, decr = TRUE, any = FALSE;
+    double last = 0, abssum = 0;
+    size_t offset = 0;
+    hdr->length = n;
+    hdr->nblocks = nblocks;
+    hdr->exact = TRUE;
+    hdr->type = type;
+    hdr->serial = ++cmpvec_serial;
+    for (R_xlen_t b = 0; b < nblocks; b++) {
+	cmpvec_block_t *bp = blocks + b;
+	int m = cmpvec_scan_block(x, b, v, buf, bp);
+	bp->offset = offset;
+	if (bp->width < 0) {
+	    memcpy(start + offset, buf, m * eltsize);
+	    if (type == REALSXP)
+		hdr->exact = FALSE;
+	}
+	else {
+	    hdr->npacked++;
+	    uint64_t *words = (uint64_t *) (start + offset);
+	    if (bp->width > 0)
+		for (int k = 1; k < m; k++)
+		    cmpvec_put_bits(words, (size_t) (k - 1) * bp->width,
+				    bp->width, (uint64_t) (v[k] - v[k - 1]) -
+				    (uint64_t) bp->mindelta);
+	    if (type == REALSXP)
+		for (int k = 0; k < m; k++)
+		    abssum += fabs((double) v[k]);
+	}
+	offset += cmpvec_block_size(bp, m, type);
+
+	hdr->nna += bp->nna;
+	hdr->sum += bp->sum;
+	if (bp->nna < m) {
+	    if (! any || bp->min < hdr->min) hdr->min = bp->min;
+	    if (! any || bp->max > hdr->max) hdr->max = bp->max;
+	    any = TRUE;
+	}
+	if (bp->nna == 0 && (incr || decr)) {
+	    /* only the values are compared, so the buffer is enough */
+	    for (int k = 0; k < m; k++) {
+		double d = type == INTSXP ? ((int *) buf)[k] : buf[k];
+		if (b > 0 || k > 0) {
+		    if (d < last) incr = FALSE;
+		    if (d > last) decr = FALSE;
+		}
+		last = d;
+	    }
+	}
+    }
+    if (abssum >= 9007199254740992.0) /* 2^53 */
+	hdr->exact = FALSE;
+    hdr->sorted = hdr->nna > 0 ? UNKNOWN_SORTEDNESS :
+	incr ? SORTED_INCR : decr ? SORTED_DECR : KNOWN_UNSORTED;
+
+    SEXP ans = R_new_altrep(type == INTSXP ? cmpvec_integer_class :
+			    cmpvec_real_class, data, R_NilValue);
+    PROTECT(ans);
+    DUPLICATE_ATTRIB(ans, x);
+    MARK_NOT_MUTABLE(ans);
+    UNPROTECT(2); /* data, ans */
+    return ans;
+}
+
+attribute_hidden SEXP do_compressVector(SEXP call, SEXP op, SEXP args,
+					SEXP env)
+{
+    checkArity(op, args);
+    SEXP x = CAR(args);
+    if (TYPEOF(x) != INTSXP && TYPEOF(x) != REALSXP)
+	error(_("'%s' must be an integer or double vector"), "x");
+    if (R_altrep_inherits(x, cmpvec_integer_class) ||
+	R_altrep_inherits(x, cmpvec_real_class) ||
+	XLENGTH(x) < CMPVEC_BLOCK)
+	return x;
+    return compress_vector(x);
+}
+
+
 /**
  ** Deferred String Coercions
  **/
@@ -682,6 +1242,10 @@ static R_INLINE R_xlen_t deferred_string_Length(SEXP x)
 	XLENGTH(DEFERRED_STRING_STATE_ARG(state));
 }
 
+/* Numbers are formatted into buffers of DEFERRED_STRING_SLOT chars,
+   using StringFromReal only for strings that do not fit, and NA. */
+#define DEFERRED_STRING_SLOT 32
+
 static R_INLINE SEXP ExpandDeferredStringElt(SEXP x, R_xlen_t i)
 {
     /* make sure the STRSXP for the expanded string is allocated */
@@ -710,7 +1274,12 @@ static R_INLINE SEXP ExpandDeferredStringElt(SEXP x, R_xlen_t i)
 	    R_print.digits = DBL_DIG;/* MAX precision */
 	    R_print.scipen = DEFERRED_STRING_SCIPEN(x);
 	    const char *myoutdec = DEFERRED_STRING_OUTDEC(x);
-	    if (strcmp(OutDec, myoutdec)) {
+	    char sbuf[DEFERRED_STRING_SLOT];
+	    int slen = R_StringBufFromReal(REAL_ELT(data, i), myoutdec,
+					   sbuf, DEFERRED_STRING_SLOT);
+	    if (slen >= 0)
+		elt = mkCharLenCE(sbuf, slen, CE_NATIVE);
+	    else if (strcmp(OutDec, myoutdec)) {
 		/* The current and saved OutDec values differ. The
 		   value to use is put in a static buffer and OutDec
 		   temporarily points to this buffer while
@@ -739,18 +1308,88 @@ static R_INLINE SEXP ExpandDeferredStringElt(SEXP x, R_xlen_t i)
     return elt;
 }
 
+/* A full expansion formats the numbers a chunk at a time into fixed
+   size slots, in parallel when R_num_math_threads allows, and then
+   creates the CHARSXPs on the main thread.  NAs, elements already
+   expanded and strings too long for a slot are done as single
+   elements. */
+
+#define DEFERRED_STRING_CHUNK 8192
+
+static void ExpandDeferredStrings(SEXP x, R_xlen_t n)
+{
+    SEXP data = DEFERRED_STRING_ARG(x);
+    SEXPTYPE type = TYPEOF(data);
+    if (type != INTSXP && type != REALSXP)
+	error("unsupported type for deferred string coercion");
+
+    ExpandDeferredStringElt(x, 0); /* allocates the expanded vector */
+    SEXP val = DEFERRED_STRING_EXPANDED(x);
+
+    const void *vmax = vmaxget();
+    char *buf = R_alloc(DEFERRED_STRING_CHUNK, DEFERRED_STRING_SLOT);
+    int *len = (int *) R_alloc(DEFERRED_STRING_CHUNK, sizeof(int));
+    void *region = R_alloc(DEFERRED_STRING_CHUNK,
+			   type == REALSXP ? sizeof(double) : sizeof(int));
+    const char *dec = DEFERRED_STRING_OUTDEC(x);
+    int savedigits = R_print.digits, savescipen = R_print.scipen;
+    R_print.digits = DBL_DIG;/* MAX precision */
+    R_print.scipen = DEFERRED_STRING_SCIPEN(x);
+#ifdef _OPENMP
+    int nthreads = R_num_math_threads > 0 ? R_num_math_threads : 1;
+#endif
+
+    for (R_xlen_t i = 0; i < n; i += DEFERRED_STRING_CHUNK) {
+	int nc = (int) (n - i < DEFERRED_STRING_CHUNK ?
+			n - i : DEFERRED_STRING_CHUNK);
+	if (type == REALSXP) {
+	    double *px = region;
+	    REAL_GET_REGION(data, i, nc, px);
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nthreads) if(nc >= 1024) \
+    default(none) firstprivate(px, buf, len, dec, nc)
+#endif
+	    for (int k = 0; k < nc; k++)
+		len[k] = R_StringBufFromReal(px[k], dec,
+					     buf + k * DEFERRED_STRING_SLOT,
+					     DEFERRED_STRING_SLOT);
+	}
+	else {
+	    int *px = region;
+	    INTEGER_GET_REGION(data, i, nc, px);
+	    for (int k = 0; k < nc; k++)
+		len[k] = px[k] == NA_INTEGER ? -1 :
+		    snprintf(buf + k * DEFERRED_STRING_SLOT,
+			     DEFERRED_STRING_SLOT, "%d", px[k]);
+	}
+	for (int k = 0; k < nc; k++) {
+	    if (STRING_ELT(val, i + k) != NULL)
+		continue;
+	    if (len[k] < 0)
+		ExpandDeferredStringElt(x, i + k);
+	    else
+		SET_STRING_ELT(val, i + k,
+			       mkCharLenCE(buf + k * DEFERRED_STRING_SLOT,
+					   len[k], CE_NATIVE));
+	}
+    }
+
+    R_print.digits = savedigits;
+    R_print.scipen = savescipen;
+    vmaxset(vmax);
+}
+
 static R_INLINE void expand_deferred_string(SEXP x)
 {
     SEXP state = DEFERRED_STRING_STATE(x);
     if (state != R_NilValue) {
 	/* expanded data may be incomplete until original data is removed */
 	PROTECT(x);
-	R_xlen_t n = XLENGTH(x), i;
+	R_xlen_t n = XLENGTH(x);
 	if (n == 0)
 	    SET_DEFERRED_STRING_EXPANDED(x, allocVector(STRSXP, 0));
 	else
-	    for (i = 0; i < n; i++)
-		ExpandDeferredStringElt(x, i);
+	    ExpandDeferredStrings(x, n);
 	CLEAR_DEFERRED_STRING_STATE(x); /* allow arg to be reclaimed */
 	UNPROTECT(1);
     }
@@ -1404,84 +2043,853 @@ attribute_hidden SEXP do_munmap_file(SEXP call, SEXP op, SEXP args, SEXP env)
 
 
 /**
- ** Attribute and Meta Data Wrappers
+ ** Memory Mapped Column Files
  **/
 
+/* Column files, written by writeColumnFile(), hold a number of
+   columns stored one after the other, followed by a serialized
+   schema describing them.  mapColumnFile() maps the whole file once
+   and creates an ALTREP vector for each column, so opening a file
+   only reads the schema and pages of the data are only read from
+   disk when they are used.  The meta data in the schema are used to
+   answer Is_sorted, No_NA, Sum, Min and Max without touching the
+   data.  Character columns are stored as integer codes into a
+   dictionary held in the schema.
+
+   The mapping is read-only.  The columns are marked as not mutable so
+   R-level modifications work on a copy, and a request for a writable
+   data pointer copies the column into memory and drops the meta
+   data, which a write through the pointer could make stale. */
+
 /*
- * Wrapper Classes and Objects
+ * Column File Classes and Objects
  */
 
-#define NMETA 2
+static R_altrep_class_t colfile_integer_class;
+static R_altrep_class_t colfile_logical_class;
+static R_altrep_class_t colfile_real_class;
+static R_altrep_class_t colfile_raw_class;
+static R_altrep_class_t colfile_string_class;
+
+/* Column objects are ALTREP objects with data fields
+
+       data1: an external pointer to the mapped file, shared by all
+              columns of the file and unmapped by its finalizer
+       data2: the column state, a VECSXP holding the offset of the
+              data in the file and the length in a REALSXP, the
+              sortedness and the no NA flag in an INTSXP, the sum,
+              minimum and maximum (or NULL if not known), the
+              dictionary for character columns, and the expanded
+              vector once the column has been materialized.
+*/
 
-static R_altrep_class_t wrap_integer_class;
-static R_altrep_class_t wrap_logical_class;
-static R_altrep_class_t wrap_real_class;
-static R_altrep_class_t wrap_complex_class;
-static R_altrep_class_t wrap_raw_class;
-static R_altrep_class_t wrap_string_class;
-static R_altrep_class_t wrap_list_class;
+#define COLFILE_EPTR(x) R_altrep_data1(x)
+#define COLFILE_STATE(x) R_altrep_data2(x)
+#define COLFILE_OFFSET(x) ((size_t) REAL0(VECTOR_ELT(COLFILE_STATE(x), 0))[0])
+#define COLFILE_LENGTH(x) ((R_xlen_t) REAL0(VECTOR_ELT(COLFILE_STATE(x), 0))[1])
+#define COLFILE_SORTED(x) INTEGER0(VECTOR_ELT(COLFILE_STATE(x), 1))[0]
+#define COLFILE_NO_NA(x) INTEGER0(VECTOR_ELT(COLFILE_STATE(x), 1))[1]
+#define COLFILE_SUM(x) VECTOR_ELT(COLFILE_STATE(x), 2)
+#define COLFILE_MIN(x) VECTOR_ELT(COLFILE_STATE(x), 3)
+#define COLFILE_MAX(x) VECTOR_ELT(COLFILE_STATE(x), 4)
+#define COLFILE_DICT(x) VECTOR_ELT(COLFILE_STATE(x), 5)
+#define COLFILE_EXPANDED(x) VECTOR_ELT(COLFILE_STATE(x), 6)
+#define COLFILE_SET_EXPANDED(x, v) SET_VECTOR_ELT(COLFILE_STATE(x), 6, v)
+#define COLFILE_STATE_SIZE 7
+
+static R_INLINE void *COLFILE_ADDR(SEXP x)
+{
+    char *addr = R_ExternalPtrAddr(COLFILE_EPTR(x));
+    if (addr == NULL)
+	error("column file has been unmapped");
+    return addr + COLFILE_OFFSET(x);
+}
 
-/* Wrapper objects are ALTREP objects designed to hold the attributes
-   of a potentially large object and/or meta data for the object. */
+/* the data of the materialized copy if there is one, or the mapping */
+static R_INLINE const void *COLFILE_DATA(SEXP x)
+{
+    SEXP expanded = COLFILE_EXPANDED(x);
+    return expanded == R_NilValue ? COLFILE_ADDR(x) : DATAPTR_RO(expanded);
+}
 
-#define WRAPPER_WRAPPED(x) R_altrep_data1(x)
-#define WRAPPER_SET_WRAPPED(x, v) R_set_altrep_data1(x, v)
-#define WRAPPER_METADATA(x) R_altrep_data2(x)
-#define WRAPPER_SET_METADATA(x, v) R_set_altrep_data2(x, v)
 
-#define WRAPPER_SORTED(x) INTEGER(WRAPPER_METADATA(x))[0]
-#define WRAPPER_NO_NA(x) INTEGER(WRAPPER_METADATA(x))[1]
+/*
+ * ALTREP Methods
+ */
 
-static R_INLINE SEXP WRAPPER_WRAPPED_RW(SEXP x)
+static Rboolean colfile_Inspect(SEXP x, int pre, int deep, int pvec,
+				void (*inspect_subtree)(SEXP, int, int, int))
 {
-    /* If the data might be shared and is accessed for possible
-       modification, then it needs to be duplicated now. */
-    SEXP data = WRAPPER_WRAPPED(x);
-    if (MAYBE_SHARED(data)) {
-	PROTECT(x);
-	WRAPPER_SET_WRAPPED(x, shallow_duplicate(data));
-	UNPROTECT(1);
-    }
+    Rprintf(" mapped column %s [offset=%.0f,sorted=%d,noNA=%d]\n",
+	    R_typeToChar(x), (double) COLFILE_OFFSET(x),
+	    COLFILE_SORTED(x), COLFILE_NO_NA(x));
+    return TRUE;
+}
 
-    /* The meta data also needs to be cleared as it may no longer be
-       valid after a write. */
-    SEXP meta = WRAPPER_METADATA(x);
-    INTEGER(meta)[0] = UNKNOWN_SORTEDNESS;
-    for (int i = 1; i < NMETA; i++)
-	INTEGER(meta)[i] = 0;
+/* No Serialized_state method: columns are serialized as standard
+   vectors, as the file may not be available when unserializing. */
 
-    return WRAPPER_WRAPPED(x);
+static R_xlen_t colfile_Length(SEXP x)
+{
+    return COLFILE_LENGTH(x);
 }
 
 
 /*
- * ALTREP Methods
+ * ALTVEC Methods
  */
 
-static SEXP wrapper_Serialized_state(SEXP x)
+/* Copy a numeric, logical or raw column into memory for writing. */
+static SEXP colfile_Materialize(SEXP x)
 {
-    /* If the wrapped value is not an ALTREP and there is no useful
-       metadata then return NULL to allow this to be serialized as a
-       standard object. This avoids serializing potentially large
-       attributes on the wrapped value (PR18142). */
-    if (! ALTREP(WRAPPER_WRAPPED(x)) &&
-	WRAPPER_SORTED(x) == UNKNOWN_SORTEDNESS &&
-	! WRAPPER_NO_NA(x))
-	return NULL;
-
-    return CONS(WRAPPER_WRAPPED(x), WRAPPER_METADATA(x));
+    SEXP expanded = COLFILE_EXPANDED(x);
+    if (expanded == R_NilValue) {
+	R_xlen_t n = XLENGTH(x);
+	PROTECT(x);
+	expanded = PROTECT(allocVector(TYPEOF(x), n));
+	memcpy(DATAPTR(expanded), COLFILE_ADDR(x),
+	       n * (TYPEOF(x) == RAWSXP ? 1 :
+		    TYPEOF(x) == REALSXP ? sizeof(double) : sizeof(int)));
+	COLFILE_SET_EXPANDED(x, expanded);
+	SEXP state = COLFILE_STATE(x);
+	INTEGER0(VECTOR_ELT(state, 1))[0] = UNKNOWN_SORTEDNESS;
+	INTEGER0(VECTOR_ELT(state, 1))[1] = FALSE; /* no NA */
+	for (int k = 2; k < 5; k++)
+	    SET_VECTOR_ELT(state, k, R_NilValue); /* sum, min, max */
+	UNPROTECT(2); /* expanded, x */
+    }
+    return expanded;
 }
 
-static SEXP make_wrapper(SEXP, SEXP);
+static void *colfile_Dataptr(SEXP x, Rboolean writeable)
+{
+    if (writeable)
+	return DATAPTR(colfile_Materialize(x));
+    return (void *) COLFILE_DATA(x);
+}
 
-static SEXP wrapper_Unserialize(SEXP class, SEXP state)
+static const void *colfile_Dataptr_or_null(SEXP x)
 {
-    return make_wrapper(CAR(state), CDR(state));
+    return COLFILE_DATA(x);
 }
 
-static SEXP wrapper_Duplicate(SEXP x, Rboolean deep)
+static int colfile_Is_sorted(SEXP x)
 {
-    SEXP data = WRAPPER_WRAPPED(x);
+    return COLFILE_SORTED(x);
+}
+
+static int colfile_No_NA(SEXP x)
+{
+    return COLFILE_NO_NA(x);
+}
+
+/* The summaries are recorded only for columns without NAs, so they
+   do not depend on 'narm'. */
+static SEXP colfile_Sum(SEXP x, Rboolean narm)
+{
+    SEXP val = COLFILE_SUM(x);
+    return val == R_NilValue ? NULL : val;
+}
+
+static SEXP colfile_Min(SEXP x, Rboolean narm)
+{
+    SEXP val = COLFILE_MIN(x);
+    return val == R_NilValue ? NULL : val;
+}
+
+static SEXP colfile_Max(SEXP x, Rboolean narm)
+{
+    SEXP val = COLFILE_MAX(x);
+    return val == R_NilValue ? NULL : val;
+}
+
+
+/*
+ * ALTINTEGER, ALTLOGICAL, ALTREAL and ALTRAW Methods
+ */
+
+static int colfile_integer_Elt(SEXP x, R_xlen_t i)
+{
+    return ((const int *) COLFILE_DATA(x))[i];
+}
+
+static
+R_xlen_t colfile_integer_Get_region(SEXP x, R_xlen_t i, R_xlen_t n, int *buf)
+{
+    R_xlen_t size = XLENGTH(x);
+    R_xlen_t ncopy = size - i > n ? n : size - i;
+    memcpy(buf, (const int *) COLFILE_DATA(x) + i, ncopy * sizeof(int));
+    return ncopy;
+}
+
+static double colfile_real_Elt(SEXP x, R_xlen_t i)
+{
+    return ((const double *) COLFILE_DATA(x))[i];
+}
+
+static
+R_xlen_t colfile_real_Get_region(SEXP x, R_xlen_t i, R_xlen_t n, double *buf)
+{
+    R_xlen_t size = XLENGTH(x);
+    R_xlen_t ncopy = size - i > n ? n : size - i;
+    memcpy(buf, (const double *) COLFILE_DATA(x) + i,
+	   ncopy * sizeof(double));
+    return ncopy;
+}
+
+static Rbyte colfile_raw_Elt(SEXP x, R_xlen_t i)
+{
+    return ((const Rbyte *) COLFILE_DATA(x))[i];
+}
+
+static
+R_xlen_t colfile_raw_Get_region(SEXP x, R_xlen_t i, R_xlen_t n, Rbyte *buf)
+{
+    R_xlen_t size = XLENGTH(x);
+    R_xlen_t ncopy = size - i > n ? n : size - i;
+    memcpy(buf, (const Rbyte *) COLFILE_DATA(x) + i, ncopy);
+    return ncopy;
+}
+
+
+/*
+ * ALTSTRING Methods
+ */
+
+/* The codes are checked when they are used, not when the file is
+   mapped, as that would read the whole column. */
+static R_INLINE SEXP colfile_string_code(SEXP dict, int code)
+{
+    if (code == NA_INTEGER)
+	return NA_STRING;
+    if (code < 1 || code > XLENGTH(dict))
+	error(_("invalid code in column file"));
+    return STRING_ELT(dict, code - 1);
+}
+
+static SEXP colfile_string_Elt(SEXP x, R_xlen_t i)
+{
+    SEXP expanded = COLFILE_EXPANDED(x);
+    if (expanded != R_NilValue)
+	return STRING_ELT(expanded, i);
+    return colfile_string_code(COLFILE_DICT(x), ((int *) COLFILE_ADDR(x))[i]);
+}
+
+static SEXP colfile_string_Expand(SEXP x)
+{
+    SEXP expanded = COLFILE_EXPANDED(x);
+    if (expanded == R_NilValue) {
+	R_xlen_t n = XLENGTH(x);
+	int *codes = COLFILE_ADDR(x);
+	SEXP dict = COLFILE_DICT(x);
+	PROTECT(x);
+	expanded = PROTECT(allocVector(STRSXP, n));
+	for (R_xlen_t i = 0; i < n; i++)
+	    SET_STRING_ELT(expanded, i, colfile_string_code(dict, codes[i]));
+	COLFILE_SET_EXPANDED(x, expanded);
+	UNPROTECT(2); /* expanded, x */
+    }
+    return expanded;
+}
+
+static void *colfile_string_Dataptr(SEXP x, Rboolean writeable)
+{
+    return DATAPTR(colfile_string_Expand(x)); /* no NA is then FALSE */
+}
+
+static const void *colfile_string_Dataptr_or_null(SEXP x)
+{
+    SEXP expanded = COLFILE_EXPANDED(x);
+    return expanded == R_NilValue ? NULL : DATAPTR_RO(expanded);
+}
+
+static void colfile_string_Set_elt(SEXP x, R_xlen_t i, SEXP v)
+{
+    SEXP expanded = colfile_string_Expand(x);
+    INTEGER0(VECTOR_ELT(COLFILE_STATE(x), 1))[1] = FALSE; /* no NA */
+    SET_STRING_ELT(expanded, i, v);
+}
+
+static int colfile_string_No_NA(SEXP x)
+{
+    return COLFILE_EXPANDED(x) == R_NilValue ? COLFILE_NO_NA(x) : FALSE;
+}
+
+
+/*
+ * Class Objects and Method Tables
+ */
+
+static void InitColfileCommonMethods(R_altrep_class_t cls)
+{
+    /* override ALTREP methods */
+    R_set_altrep_Inspect_method(cls, colfile_Inspect);
+    R_set_altrep_Length_method(cls, colfile_Length);
+
+    /* override ALTVEC methods */
+    R_set_altvec_Dataptr_method(cls, colfile_Dataptr);
+    R_set_altvec_Dataptr_or_null_method(cls, colfile_Dataptr_or_null);
+}
+
+static void InitColfileClasses(DllInfo *dll)
+{
+    R_altrep_class_t cls;
+
+    cls = R_make_altinteger_class("colfile_integer", "base", dll);
+    colfile_integer_class = cls;
+    InitColfileCommonMethods(cls);
+    R_set_altinteger_Elt_method(cls, colfile_integer_Elt);
+    R_set_altinteger_Get_region_method(cls, colfile_integer_Get_region);
+    R_set_altinteger_Is_sorted_method(cls, colfile_Is_sorted);
+    R_set_altinteger_No_NA_method(cls, colfile_No_NA);
+    R_set_altinteger_Sum_method(cls, colfile_Sum);
+    R_set_altinteger_Min_method(cls, colfile_Min);
+    R_set_altinteger_Max_method(cls, colfile_Max);
+
+    cls = R_make_altlogical_class("colfile_logical", "base", dll);
+    colfile_logical_class = cls;
+    InitColfileCommonMethods(cls);
+    R_set_altlogical_Elt_method(cls, colfile_integer_Elt);
+    R_set_altlogical_Get_region_method(cls, colfile_integer_Get_region);
+    R_set_altlogical_Is_sorted_method(cls, colfile_Is_sorted);
+    R_set_altlogical_No_NA_method(cls, colfile_No_NA);
+    R_set_altlogical_Sum_method(cls, colfile_Sum);
+
+    cls = R_make_altreal_class("colfile_real", "base", dll);
+    colfile_real_class = cls;
+    InitColfileCommonMethods(cls);
+    R_set_altreal_Elt_method(cls, colfile_real_Elt);
+    R_set_altreal_Get_region_method(cls, colfile_real_Get_region);
+    R_set_altreal_Is_sorted_method(cls, colfile_Is_sorted);
+    R_set_altreal_No_NA_method(cls, colfile_No_NA);
+    R_set_altreal_Sum_method(cls, colfile_Sum);
+    R_set_altreal_Min_method(cls, colfile_Min);
+    R_set_altreal_Max_method(cls, colfile_Max);
+
+    cls = R_make_altraw_class("colfile_raw", "base", dll);
+    colfile_raw_class = cls;
+    InitColfileCommonMethods(cls);
+    R_set_altraw_Elt_method(cls, colfile_raw_Elt);
+    R_set_altraw_Get_region_method(cls, colfile_raw_Get_region);
+
+    cls = R_make_altstring_class("colfile_string", "base", dll);
+    colfile_string_class = cls;
+    R_set_altrep_Inspect_method(cls, colfile_Inspect);
+    R_set_altrep_Length_method(cls, colfile_Length);
+    R_set_altvec_Dataptr_method(cls, colfile_string_Dataptr);
+    R_set_altvec_Dataptr_or_null_method(cls,
+					colfile_string_Dataptr_or_null);
+    R_set_altstring_Elt_method(cls, colfile_string_Elt);
+    R_set_altstring_Set_elt_method(cls, colfile_string_Set_elt);
+    R_set_altstring_No_NA_method(cls, colfile_string_No_NA);
+}
+
+
+/*
+ * Constructor
+ */
+
+/* The columns are described by lists with elements type, offset,
+   length, sorted, noNA, sum, min, max, dict and attributes, in this
+   order, as created by writeColumnFile(). */
+
+#define COLSPEC_TYPE 0
+#define COLSPEC_OFFSET 1
+#define COLSPEC_LENGTH 2
+#define COLSPEC_SORTED 3
+#define COLSPEC_NO_NA 4
+#define COLSPEC_SUM 5
+#define COLSPEC_MIN 6
+#define COLSPEC_MAX 7
+#define COLSPEC_DICT 8
+#define COLSPEC_ATTRIBUTES 9
+#define COLSPEC_SIZE 10
+
+#ifndef Win32
+static void colfile_finalize(SEXP eptr)
+{
+    void *p = R_ExternalPtrAddr(eptr);
+    if (p != NULL) {
+	munmap(p, (size_t) REAL0(R_ExternalPtrProtected(eptr))[0]);
+	R_ClearExternalPtr(eptr);
+    }
+}
+
+static SEXP make_colfile_column(SEXP eptr, size_t filesize, SEXP spec)
+{
+    if (TYPEOF(spec) != VECSXP || XLENGTH(spec) != COLSPEC_SIZE)
+	error(_("invalid column file schema"));
+    const char *type = CHAR(asChar(VECTOR_ELT(spec, COLSPEC_TYPE)));
+    double offset = asReal(VECTOR_ELT(spec, COLSPEC_OFFSET));
+    double length = asReal(VECTOR_ELT(spec, COLSPEC_LENGTH));
+
+    R_altrep_class_t class;
+    size_t eltsize;
+    if (strcmp(type, "integer") == 0) {
+	class = colfile_integer_class; eltsize = sizeof(int);
+    } else if (strcmp(type, "logical") == 0) {
+	class = colfile_logical_class; eltsize = sizeof(int);
+    } else if (strcmp(type, "double") == 0) {
+	class = colfile_real_class; eltsize = sizeof(double);
+    } else if (strcmp(type, "raw") == 0) {
+	class = colfile_raw_class; eltsize = 1;
+    } else if (strcmp(type, "string") == 0) {
+	class = colfile_string_class; eltsize = sizeof(int);
+    } else
+	error(_("column type '%s' is not supported"), type);
+
+    if (!R_FINITE(offset) || !R_FINITE(length) || offset < 0 || length < 0 ||
+	length > R_XLEN_T_MAX || offset + length * eltsize > filesize ||
+	fmod(offset, (double) eltsize) != 0)
+	error(_("invalid column file schema"));
+
+    SEXP state = PROTECT(allocVector(VECSXP, COLFILE_STATE_SIZE));
+    SEXP info = allocVector(REALSXP, 2);
+    SET_VECTOR_ELT(state, 0, info);
+    REAL0(info)[0] = offset;
+    REAL0(info)[1] = length;
+    SEXP meta = allocVector(INTSXP, 2);
+    SET_VECTOR_ELT(state, 1, meta);
+    INTEGER0(meta)[0] = asInteger(VECTOR_ELT(spec, COLSPEC_SORTED));
+    INTEGER0(meta)[1] = asLogicalNA(VECTOR_ELT(spec, COLSPEC_NO_NA), FALSE);
+    for (int k = 0; k < 3; k++) {
+	SEXP s = VECTOR_ELT(spec, COLSPEC_SUM + k);
+	if ((TYPEOF(s) == INTSXP || TYPEOF(s) == REALSXP) &&
+	    XLENGTH(s) == 1 && ATTRIB(s) == R_NilValue)
+	    SET_VECTOR_ELT(state, 2 + k, s);
+    }
+    if (class.ptr == colfile_string_class.ptr) {
+	SEXP dict = VECTOR_ELT(spec, COLSPEC_DICT);
+	if (TYPEOF(dict) != STRSXP)
+	    error(_("invalid column file schema"));
+	SET_VECTOR_ELT(state, 5, dict);
+    }
+
+    SEXP ans = PROTECT(R_new_altrep(class, eptr, state));
+    MARK_NOT_MUTABLE(ans);
+    SEXP attrs = VECTOR_ELT(spec, COLSPEC_ATTRIBUTES);
+    if (TYPEOF(attrs) == VECSXP) {
+	SEXP nms = getAttrib(attrs, R_NamesSymbol);
+	for (R_xlen_t i = 0; i < XLENGTH(attrs); i++)
+	    setAttrib(ans, installTrChar(STRING_ELT(nms, i)),
+		      VECTOR_ELT(attrs, i));
+    }
+    UNPROTECT(2); /* state, ans */
+    return ans;
+}
+#endif
+
+attribute_hidden SEXP do_mmap_columns(SEXP call, SEXP op, SEXP args, SEXP env)
+{
+    checkArity(op, args);
+    SEXP file = CAR(args);
+    SEXP specs = CADR(args);
+
+    if (TYPEOF(file) != STRSXP || LENGTH(file) != 1 ||
+	STRING_ELT(file, 0) == NA_STRING)
+	error(_("invalid '%s' argument"), "file");
+    if (TYPEOF(specs) != VECSXP)
+	error(_("invalid column file schema"));
+
+#ifdef Win32
+    error("mmap objects not supported on Windows yet");
+    return R_NilValue;
+#else
+    const char *efn = R_ExpandFileName(translateCharFP(STRING_ELT(file, 0)));
+    struct stat sb;
+
+    if (stat(efn, &sb) != 0)
+	error("stat: %s", strerror(errno));
+    if (! S_ISREG(sb.st_mode))
+	error("%s is not a regular file", efn);
+    SEXP size = PROTECT(ScalarReal((double) sb.st_size));
+
+    int fd = open(efn, O_RDONLY);
+    if (fd == -1)
+	error("open: %s", strerror(errno));
+    void *p = mmap(0, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); /* don't care if this fails */
+    if (p == MAP_FAILED)
+	error("mmap: %s", strerror(errno));
+
+    SEXP eptr = PROTECT(R_MakeExternalPtr(p, R_NilValue, size));
+    R_RegisterCFinalizerEx(eptr, colfile_finalize, TRUE);
+
+    R_xlen_t n = XLENGTH(specs);
+    SEXP ans = PROTECT(allocVector(VECSXP, n));
+    for (R_xlen_t i = 0; i < n; i++)
+	SET_VECTOR_ELT(ans, i, make_colfile_column(eptr, sb.st_size,
+						   VECTOR_ELT(specs, i)));
+    UNPROTECT(3); /* size, eptr, ans */
+    return ans;
+#endif
+}
+
+
+/**
+ ** Hash Indexed Vectors
+ **/
+
+/* hashIndex() attaches the hash table that match() and duplicated()
+   build for a vector to (a reference to) the vector, so that repeated
+   lookups in the same table do not have to hash it again.  The hash
+   table is made and used in unique.c; it is dropped as soon as the
+   data are accessed for possible modification. */
+
+static R_altrep_class_t hashidx_integer_class;
+static R_altrep_class_t hashidx_real_class;
+static R_altrep_class_t hashidx_string_class;
+
+/* Hash indexed vectors are ALTREP objects with data fields
+
+       data1: the vector
+       data2: the hash index made by R_MakeHashIndex(), or NULL
+              once it is no longer valid
+*/
+
+#define HASHIDX_DATA(x) R_altrep_data1(x)
+#define HASHIDX_SET_DATA(x, v) R_set_altrep_data1(x, v)
+#define HASHIDX_INDEX(x) R_altrep_data2(x)
+#define HASHIDX_SET_INDEX(x, v) R_set_altrep_data2(x, v)
+
+static R_INLINE SEXP HASHIDX_DATA_RW(SEXP x)
+{
+    /* as for wrappers: duplicate shared data, and drop the index as it
+       may no longer be valid after a write */
+    SEXP data = HASHIDX_DATA(x);
+    if (MAYBE_SHARED(data)) {
+	PROTECT(x);
+	HASHIDX_SET_DATA(x, shallow_duplicate(data));
+	UNPROTECT(1);
+    }
+    HASHIDX_SET_INDEX(x, R_NilValue);
+    return HASHIDX_DATA(x);
+}
+
+static SEXP make_hashidx(SEXP, SEXP, SEXP);
+
+
+/*
+ * ALTREP Methods
+ */
+
+/* No Serialized_state method: the index holds pointer hashes for
+   strings, so these are serialized as standard vectors. */
+
+static SEXP hashidx_Duplicate(SEXP x, Rboolean deep)
+{
+    SEXP data = HASHIDX_DATA(x);
+    if (deep)
+	return duplicate(data);
+
+    /* a shallow copy shares the data and the index */
+#ifndef SWITCH_TO_REFCNT
+    MARK_NOT_MUTABLE(data);
+#endif
+    return make_hashidx(data, HASHIDX_INDEX(x), x);
+}
+
+static Rboolean hashidx_Inspect(SEXP x, int pre, int deep, int pvec,
+				void (*inspect_subtree)(SEXP, int, int, int))
+{
+    Rprintf(" hash indexed [indexed=%d]\n",
+	    HASHIDX_INDEX(x) != R_NilValue);
+    inspect_subtree(HASHIDX_DATA(x), pre, deep, pvec);
+    return TRUE;
+}
+
+static R_xlen_t hashidx_Length(SEXP x)
+{
+    return XLENGTH(HASHIDX_DATA(x));
+}
+
+
+/*
+ * ALTVEC Methods
+ */
+
+static void *hashidx_Dataptr(SEXP x, Rboolean writeable)
+{
+    if (writeable)
+	return DATAPTR(HASHIDX_DATA_RW(x));
+    else
+	return (void *) DATAPTR_RO(HASHIDX_DATA(x));
+}
+
+static const void *hashidx_Dataptr_or_null(SEXP x)
+{
+    return DATAPTR_OR_NULL(HASHIDX_DATA(x));
+}
+
+static SEXP hashidx_Extract_subset(SEXP x, SEXP indx, SEXP call)
+{
+    return ExtractSubset(HASHIDX_DATA(x), indx, call);
+}
+
+
+/*
+ * ALTINTEGER, ALTREAL and ALTSTRING Methods
+ */
+
+static int hashidx_integer_Elt(SEXP x, R_xlen_t i)
+{
+    return INTEGER_ELT(HASHIDX_DATA(x), i);
+}
+
+static
+R_xlen_t hashidx_integer_Get_region(SEXP x, R_xlen_t i, R_xlen_t n, int *buf)
+{
+    return INTEGER_GET_REGION(HASHIDX_DATA(x), i, n, buf);
+}
+
+static int hashidx_integer_Is_sorted(SEXP x)
+{
+    return INTEGER_IS_SORTED(HASHIDX_DATA(x));
+}
+
+static int hashidx_integer_No_NA(SEXP x)
+{
+    return INTEGER_NO_NA(HASHIDX_DATA(x));
+}
+
+static double hashidx_real_Elt(SEXP x, R_xlen_t i)
+{
+    return REAL_ELT(HASHIDX_DATA(x), i);
+}
+
+static
+R_xlen_t hashidx_real_Get_region(SEXP x, R_xlen_t i, R_xlen_t n, double *buf)
+{
+    return REAL_GET_REGION(HASHIDX_DATA(x), i, n, buf);
+}
+
+static int hashidx_real_Is_sorted(SEXP x)
+{
+    return REAL_IS_SORTED(HASHIDX_DATA(x));
+}
+
+static int hashidx_real_No_NA(SEXP x)
+{
+    return REAL_NO_NA(HASHIDX_DATA(x));
+}
+
+static SEXP hashidx_string_Elt(SEXP x, R_xlen_t i)
+{
+    return STRING_ELT(HASHIDX_DATA(x), i);
+}
+
+static void hashidx_string_Set_elt(SEXP x, R_xlen_t i, SEXP v)
+{
+    SET_STRING_ELT(HASHIDX_DATA_RW(x), i, v);
+}
+
+static int hashidx_string_Is_sorted(SEXP x)
+{
+    return STRING_IS_SORTED(HASHIDX_DATA(x));
+}
+
+static int hashidx_string_No_NA(SEXP x)
+{
+    return STRING_NO_NA(HASHIDX_DATA(x));
+}
+
+
+/*
+ * Class Objects and Method Tables
+ */
+
+static void InitHashidxCommonMethods(R_altrep_class_t cls)
+{
+    /* override ALTREP methods */
+    R_set_altrep_Duplicate_method(cls, hashidx_Duplicate);
+    R_set_altrep_Inspect_method(cls, hashidx_Inspect);
+    R_set_altrep_Length_method(cls, hashidx_Length);
+
+    /* override ALTVEC methods */
+    R_set_altvec_Dataptr_method(cls, hashidx_Dataptr);
+    R_set_altvec_Dataptr_or_null_method(cls, hashidx_Dataptr_or_null);
+    R_set_altvec_Extract_subset_method(cls, hashidx_Extract_subset);
+}
+
+static void InitHashidxClasses(DllInfo *dll)
+{
+    R_altrep_class_t cls;
+
+    cls = R_make_altinteger_class("hashidx_integer", "base", dll);
+    hashidx_integer_class = cls;
+    InitHashidxCommonMethods(cls);
+    R_set_altinteger_Elt_method(cls, hashidx_integer_Elt);
+    R_set_altinteger_Get_region_method(cls, hashidx_integer_Get_region);
+    R_set_altinteger_Is_sorted_method(cls, hashidx_integer_Is_sorted);
+    R_set_altinteger_No_NA_method(cls, hashidx_integer_No_NA);
+
+    cls = R_make_altreal_class("hashidx_real", "base", dll);
+    hashidx_real_class = cls;
+    InitHashidxCommonMethods(cls);
+    R_set_altreal_Elt_method(cls, hashidx_real_Elt);
+    R_set_altreal_Get_region_method(cls, hashidx_real_Get_region);
+    R_set_altreal_Is_sorted_method(cls, hashidx_real_Is_sorted);
+    R_set_altreal_No_NA_method(cls, hashidx_real_No_NA);
+
+    cls = R_make_altstring_class("hashidx_string", "base", dll);
+    hashidx_string_class = cls;
+    InitHashidxCommonMethods(cls);
+    R_set_altstring_Elt_method(cls, hashidx_string_Elt);
+    R_set_altstring_Set_elt_method(cls, hashidx_string_Set_elt);
+    R_set_altstring_Is_sorted_method(cls, hashidx_string_Is_sorted);
+    R_set_altstring_No_NA_method(cls, hashidx_string_No_NA);
+}
+
+
+/*
+ * Constructor and Accessors
+ */
+
+/* The result has the attributes of x, which is data or a hash indexed
+   vector holding it. */
+static SEXP make_hashidx(SEXP data, SEXP index, SEXP x)
+{
+    R_altrep_class_t cls;
+    switch(TYPEOF(data)) {
+    case INTSXP: cls = hashidx_integer_class; break;
+    case REALSXP: cls = hashidx_real_class; break;
+    case STRSXP: cls = hashidx_string_class; break;
+    default: error("unsupported type");
+    }
+
+    SEXP ans = PROTECT(R_new_altrep(cls, data, index));
+    if (ATTRIB(x) != R_NilValue) {
+	SET_ATTRIB(ans, shallow_duplicate(ATTRIB(x)));
+	SET_OBJECT(ans, OBJECT(x));
+	IS_S4_OBJECT(x) ? SET_S4_OBJECT(ans) : UNSET_S4_OBJECT(ans);
+    }
+#ifndef SWITCH_TO_REFCNT
+    if (MAYBE_REFERENCED(data))
+	MARK_NOT_MUTABLE(data);
+#endif
+    UNPROTECT(1); /* ans */
+    return ans;
+}
+
+static R_INLINE int is_hashidx(SEXP x)
+{
+    if (ALTREP(x))
+	switch(TYPEOF(x)) {
+	case INTSXP: return R_altrep_inherits(x, hashidx_integer_class);
+	case REALSXP: return R_altrep_inherits(x, hashidx_real_class);
+	case STRSXP: return R_altrep_inherits(x, hashidx_string_class);
+	default: return FALSE;
+	}
+    else return FALSE;
+}
+
+/* The hash index of x, or R_NilValue if it has none. */
+attribute_hidden SEXP R_HashIndexOf(SEXP x)
+{
+    return is_hashidx(x) ? HASHIDX_INDEX(x) : R_NilValue;
+}
+
+/* The data of x, which has a hash index. */
+attribute_hidden SEXP R_HashIndexData(SEXP x)
+{
+    return HASHIDX_DATA(x);
+}
+
+attribute_hidden SEXP do_hashIndex(SEXP call, SEXP op, SEXP args, SEXP env)
+{
+    checkArity(op, args);
+    SEXP x = CAR(args);
+    if (TYPEOF(x) != INTSXP && TYPEOF(x) != REALSXP && TYPEOF(x) != STRSXP)
+	error(_("'%s' must be an integer, double or character vector"), "x");
+    if (R_HashIndexOf(x) != R_NilValue)
+	return x;
+    SEXP data = is_hashidx(x) ? HASHIDX_DATA(x) : x;
+    SEXP index = PROTECT(R_MakeHashIndex(data));
+    SEXP ans = index == R_NilValue ? x : make_hashidx(data, index, x);
+    UNPROTECT(1); /* index */
+    return ans;
+}
+
+
+/**
+ ** Attribute and Meta Data Wrappers
+ **/
+
+/*
+ * Wrapper Classes and Objects
+ */
+
+#define NMETA 2
+
+static R_altrep_class_t wrap_integer_class;
+static R_altrep_class_t wrap_logical_class;
+static R_altrep_class_t wrap_real_class;
+static R_altrep_class_t wrap_complex_class;
+static R_altrep_class_t wrap_raw_class;
+static R_altrep_class_t wrap_string_class;
+static R_altrep_class_t wrap_list_class;
+
+/* Wrapper objects are ALTREP objects designed to hold the attributes
+   of a potentially large object and/or meta data for the object. */
+
+#define WRAPPER_WRAPPED(x) R_altrep_data1(x)
+#define WRAPPER_SET_WRAPPED(x, v) R_set_altrep_data1(x, v)
+#define WRAPPER_METADATA(x) R_altrep_data2(x)
+#define WRAPPER_SET_METADATA(x, v) R_set_altrep_data2(x, v)
+
+#define WRAPPER_SORTED(x) INTEGER(WRAPPER_METADATA(x))[0]
+#define WRAPPER_NO_NA(x) INTEGER(WRAPPER_METADATA(x))[1]
+
+static R_INLINE SEXP WRAPPER_WRAPPED_RW(SEXP x)
+{
+    /* If the data might be shared and is accessed for possible
+       modification, then it needs to be duplicated now. */
+    SEXP data = WRAPPER_WRAPPED(x);
+    if (MAYBE_SHARED(data)) {
+	PROTECT(x);
+	WRAPPER_SET_WRAPPED(x, shallow_duplicate(data));
+	UNPROTECT(1);
+    }
+
+    /* The meta data also needs to be cleared as it may no longer be
+       valid after a write. */
+    SEXP meta = WRAPPER_METADATA(x);
+    INTEGER(meta)[0] = UNKNOWN_SORTEDNESS;
+    for (int i = 1; i < NMETA; i++)
+	INTEGER(meta)[i] = 0;
+
+    return WRAPPER_WRAPPED(x);
+}
+
+
+/*
+ * ALTREP Methods
+ */
+
+static SEXP wrapper_Serialized_state(SEXP x)
+{
+    /* If the wrapped value is not an ALTREP and there is no useful
+       metadata then return NULL to allow this to be serialized as a
+       standard object. This avoids serializing potentially large
+       attributes on the wrapped value (PR18142). */
+    if (! ALTREP(WRAPPER_WRAPPED(x)) &&
+	WRAPPER_SORTED(x) == UNKNOWN_SORTEDNESS &&
+	! WRAPPER_NO_NA(x))
+	return NULL;
+
+    return CONS(WRAPPER_WRAPPED(x), WRAPPER_METADATA(x));
+}
+
+static SEXP make_wrapper(SEXP, SEXP);
+
+static SEXP wrapper_Unserialize(SEXP class, SEXP state)
+{
+    return make_wrapper(CAR(state), CDR(state));
+}
+
+static SEXP wrapper_Duplicate(SEXP x, Rboolean deep)
+{
+    SEXP data = WRAPPER_WRAPPED(x);
 
     /* For a deep copy, duplicate the data. */
     /* For a shallow copy, mark as immutable in the NAMED world; with
@@ -2016,6 +3424,12 @@ SEXP /*attribute_hidden*/ R_tryWrap(SEXP x)
     return wrap_meta(x, UNKNOWN_SORTEDNESS, FALSE);
 }
 
+/* a wrapper recording that x is sorted as srt, and whether it has NAs */
+attribute_hidden SEXP R_tryWrapSorted(SEXP x, int srt, int no_na)
+{
+    return wrap_meta(x, srt, no_na);
+}
+
 attribute_hidden SEXP do_tryWrap(SEXP call, SEXP op, SEXP args, SEXP env)
 {
     checkArity(op, args);
@@ -2074,9 +3488,12 @@ attribute_hidden void R_init_altrep(void)
 {
     InitCompactIntegerClass();
     InitCompactRealClass();
+    InitCompressedVectorClasses();
     InitDefferredStringClass();
     InitMmapIntegerClass(NULL);
     InitMmapRealClass(NULL);
+    InitColfileClasses(NULL);
+    InitHashidxClasses(NULL);
     InitWrapIntegerClass(NULL);
     InitWrapLogicalClass(NULL);
     InitWrapRealClass(NULL);
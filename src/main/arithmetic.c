@@ -58,6 +58,42 @@
 
 #include <errno.h>
 
+/* Elementwise loops without general recycling are run in chunks of
+   NINTERRUPT elements, checking for interrupts in between.  When the
+   result has at least ARITH_PARALLEL_MIN elements each chunk is shared
+   between the R_ArithThreads threads set by options(arith.threads).
+   The loops have unit stride (or stride 0 for a length one operand) and
+   are marked for SIMD vectorization. 'clauses' are extra OpenMP clauses
+   for the loop, such as a reduction for an overflow flag. */
+#define ARITH_PARALLEL_MIN 100000
+
+#ifdef _OPENMP
+# define R_DO_PRAGMA(x) _Pragma(#x)
+#else
+# define R_DO_PRAGMA(x)
+#endif
+
+#define R_ITERATE_PAR(n, i, clauses, loop_body) do {			\
+	int __nth__ = (n) >= ARITH_PARALLEL_MIN ? R_ArithThreads : 1;	\
+	for (R_xlen_t __ch__ = 0; __ch__ < (n); __ch__ += NINTERRUPT) {	\
+	    R_xlen_t __end__ = (n) - __ch__ > NINTERRUPT ?		\
+		__ch__ + NINTERRUPT : (n);				\
+	    if (__nth__ > 1) {						\
+		R_DO_PRAGMA(omp parallel for simd num_threads(__nth__) clauses) \
+		for (R_xlen_t i = __ch__; i < __end__; i++) { loop_body } \
+	    }								\
+	    else {							\
+		R_DO_PRAGMA(omp simd clauses)				\
+		for (R_xlen_t i = __ch__; i < __end__; i++) { loop_body } \
+	    }								\
+	    if (__end__ < (n))						\
+		R_CheckUserInterrupt();					\
+	}								\
+    } while (0)
+
+#define NO_GENERAL_RECYCLING(n, n1, n2) \
+    (((n1) == (n) || (n1) == 1) && ((n2) == (n) || (n2) == 1))
+
 /* Override for matherr removed for R 4.4.0 */
 /* Intel compilers for Linux do have matherr, but they do not have the
    defines in math.h.  So we skip this for Intel */
@@ -276,7 +312,8 @@ static SEXP logical_unary(ARITHOP_TYPE, SEXP, SEXP);
 static SEXP integer_unary(ARITHOP_TYPE, SEXP, SEXP);
 static SEXP real_unary(ARITHOP_TYPE, SEXP, SEXP);
 static SEXP real_binary(ARITHOP_TYPE, SEXP, SEXP);
-static SEXP integer_binary(ARITHOP_TYPE, SEXP, SEXP, SEXP);
+static SEXP integer_binary(ARITHOP_TYPE, SEXP, SEXP, SEXP, Rboolean *);
+static SEXP binary_by_region(ARITHOP_TYPE, SEXP, SEXP, SEXP);
 
 #if 0
 static int naflag;
@@ -302,6 +339,13 @@ static SEXP lcall;
 
 #define INTEGER_OVERFLOW_WARNING _("NAs produced by integer overflow")
 
+#define INTEGER_BINARY_OVERFLOW(call, pnaflag) do {		\
+	if (pnaflag != NULL)					\
+	    *(pnaflag) = TRUE;					\
+	else							\
+	    warningcall(call, INTEGER_OVERFLOW_WARNING);	\
+    } while(0)
+
 #define CHECK_INTEGER_OVERFLOW(call, ans, naflag) do {		\
 	if (naflag) {						\
 	    PROTECT(ans);					\
@@ -655,7 +699,9 @@ attribute_hidden SEXP R_binary(SEXP call, SEXP op, SEXP x, SEXP y)
 
     SEXP val;
     /* need to preserve object here, as *_binary copies class attributes */
-    if (TYPEOF(x) == CPLXSXP || TYPEOF(y) == CPLXSXP) {
+    if ((val = binary_by_region(oper, x, y, call)) != NULL)
+	; /* ALTREP operand(s) done a region at a time */
+    else if (TYPEOF(x) == CPLXSXP || TYPEOF(y) == CPLXSXP) {
 	COERCE_IF_NEEDED(x, CPLXSXP, xpi);
 	COERCE_IF_NEEDED(y, CPLXSXP, ypi);
 	val = complex_binary(oper, x, y);
@@ -667,7 +713,7 @@ attribute_hidden SEXP R_binary(SEXP call, SEXP op, SEXP x, SEXP y)
 	if (TYPEOF(y) != INTSXP) COERCE_IF_NEEDED(y, REALSXP, ypi);
 	val = real_binary(oper, x, y);
     }
-    else val = integer_binary(oper, x, y, call);
+    else val = integer_binary(oper, x, y, call, NULL);
 
     /* quick return if there are no attributes */
     if (! xattr && ! yattr) {
@@ -801,7 +847,34 @@ static SEXP real_unary(ARITHOP_TYPE code, SEXP s1, SEXP lcall)
     return s1;			/* never used; to keep -Wall happy */
 }
 
-static SEXP integer_binary(ARITHOP_TYPE code, SEXP s1, SEXP s2, SEXP lcall)
+/* If 'pnaflag' is not NULL integer overflow is recorded there rather
+   than signalled. */
+#define INTEGER_ARITH_LOOP(FUN) do {					\
+	int *pa = INTEGER(ans);						\
+	const int *px1 = INTEGER_RO(s1);				\
+	const int *px2 = INTEGER_RO(s2);				\
+	if (NO_GENERAL_RECYCLING(n, n1, n2)) {				\
+	    const R_xlen_t st1 = n1 > 1, st2 = n2 > 1;			\
+	    int ovf = 0;						\
+	    R_ITERATE_PAR(n, k, reduction(|:ovf), {			\
+		    Rboolean kflag = FALSE;				\
+		    pa[k] = FUN(px1[k * st1], px2[k * st2], &kflag);	\
+		    ovf |= kflag;					\
+		});							\
+	    naflag = ovf ? TRUE : FALSE;				\
+	}								\
+	else								\
+	    MOD_ITERATE2_CHECK(NINTERRUPT, n, n1, n2, i, i1, i2, {	\
+		    x1 = px1[i1];					\
+		    x2 = px2[i2];					\
+		    pa[i] = FUN(x1, x2, &naflag);			\
+		});							\
+	if (naflag)							\
+	    INTEGER_BINARY_OVERFLOW(lcall, pnaflag);			\
+    } while (0)
+
+static SEXP integer_binary(ARITHOP_TYPE code, SEXP s1, SEXP s2, SEXP lcall,
+			   Rboolean *pnaflag)
 {
     R_xlen_t i, i1, i2, n, n1, n2;
     int x1, x2;
@@ -822,46 +895,13 @@ static SEXP integer_binary(ARITHOP_TYPE code, SEXP s1, SEXP s2, SEXP lcall)
 
     switch (code) {
     case PLUSOP:
-	{
-	    int *pa = INTEGER(ans);
-	    const int *px1 = INTEGER_RO(s1);
-	    const int *px2 = INTEGER_RO(s2);
-	    MOD_ITERATE2_CHECK(NINTERRUPT, n, n1, n2, i, i1, i2, {
-		    x1 = px1[i1];
-		    x2 = px2[i2];
-		    pa[i] = R_integer_plus(x1, x2, &naflag);
-		});
-	    if (naflag)
-		warningcall(lcall, INTEGER_OVERFLOW_WARNING);
-	}
+	INTEGER_ARITH_LOOP(R_integer_plus);
 	break;
     case MINUSOP:
-	{
-	    int *pa = INTEGER(ans);
-	    const int *px1 = INTEGER_RO(s1);
-	    const int *px2 = INTEGER_RO(s2);
-	    MOD_ITERATE2_CHECK(NINTERRUPT, n, n1, n2, i, i1, i2, {
-		    x1 = px1[i1];
-		    x2 = px2[i2];
-		    pa[i] = R_integer_minus(x1, x2, &naflag);
-		});
-	    if (naflag)
-		warningcall(lcall, INTEGER_OVERFLOW_WARNING);
-	}
+	INTEGER_ARITH_LOOP(R_integer_minus);
 	break;
     case TIMESOP:
-	{
-	    int *pa = INTEGER(ans);
-	    const int *px1 = INTEGER_RO(s1);
-	    const int *px2 = INTEGER_RO(s2);
-	    MOD_ITERATE2_CHECK(NINTERRUPT, n, n1, n2, i, i1, i2, {
-		    x1 = px1[i1];
-		    x2 = px2[i2];
-		    pa[i] = R_integer_times(x1, x2, &naflag);
-		});
-	    if (naflag)
-		warningcall(lcall, INTEGER_OVERFLOW_WARNING);
-	}
+	INTEGER_ARITH_LOOP(R_integer_times);
 	break;
     case DIVOP:
 	{
@@ -944,6 +984,88 @@ static SEXP integer_binary(ARITHOP_TYPE code, SEXP s1, SEXP s2, SEXP lcall)
 
 #define R_INTEGER(x) (double) ((x) == NA_INTEGER ? NA_REAL : (x))
 
+/* ALTREP operands without a data pointer, such as compact sequences
+   and compressed or memory mapped vectors, are processed a region at a
+   time: the regions are copied into buffers with Get_region and the
+   usual code is applied to these, so the operands are never expanded.
+   The result of each region usually reuses the buffer of an operand.
+   Only operands of the same length or of length one are handled this
+   way; other recycling patterns use the usual code. */
+
+#define ARITH_REGION_SIZE 4096
+
+static R_INLINE Rboolean use_regions(SEXP x)
+{
+    return ALTREP(x) && XLENGTH(x) > ARITH_REGION_SIZE &&
+	DATAPTR_OR_NULL(x) == NULL;
+}
+
+static R_INLINE void get_region(SEXP x, R_xlen_t i, R_xlen_t n, SEXP buf)
+{
+    if (TYPEOF(x) == INTSXP)
+	INTEGER_GET_REGION(x, i, n, INTEGER0(buf));
+    else
+	REAL_GET_REGION(x, i, n, REAL0(buf));
+}
+
+static SEXP binary_by_region(ARITHOP_TYPE code, SEXP x, SEXP y, SEXP lcall)
+{
+    if (! use_regions(x) && ! use_regions(y))
+	return NULL;
+    SEXPTYPE xtype = TYPEOF(x), ytype = TYPEOF(y);
+    if ((xtype != INTSXP && xtype != REALSXP) ||
+	(ytype != INTSXP && ytype != REALSXP))
+	return NULL;
+    R_xlen_t nx = XLENGTH(x), ny = XLENGTH(y), n = nx > ny ? nx : ny;
+    if (nx != ny && nx != 1 && ny != 1)
+	return NULL;
+
+    Rboolean real = xtype == REALSXP || ytype == REALSXP;
+    SEXPTYPE type = real || code == DIVOP || code == POWOP ? REALSXP : INTSXP;
+    size_t eltsize = type == REALSXP ? sizeof(double) : sizeof(int);
+    SEXP ans = PROTECT(allocVector(type, n));
+    SEXP bx = R_NilValue, by = R_NilValue;
+    PROTECT_INDEX bxpi, bypi;
+    PROTECT_WITH_INDEX(bx, &bxpi);
+    PROTECT_WITH_INDEX(by, &bypi);
+    Rboolean naflag = FALSE;
+
+    for (R_xlen_t i = 0; i < n; i += ARITH_REGION_SIZE) {
+	R_xlen_t m = n - i < ARITH_REGION_SIZE ? n - i : ARITH_REGION_SIZE;
+	/* buffers are (re)allocated at the start and for the last region */
+	if (nx == 1) bx = x;
+	else {
+	    if (bx == R_NilValue || XLENGTH(bx) != m)
+		REPROTECT(bx = allocVector(xtype, m), bxpi);
+	    get_region(x, i, m, bx);
+	}
+	if (ny == 1) by = y;
+	else {
+	    if (by == R_NilValue || XLENGTH(by) != m)
+		REPROTECT(by = allocVector(ytype, m), bypi);
+	    get_region(y, i, m, by);
+	}
+	SEXP val = real ? real_binary(code, bx, by) :
+	    integer_binary(code, bx, by, lcall, &naflag);
+	memcpy((char *) DATAPTR(ans) + i * eltsize, DATAPTR_RO(val),
+	       m * eltsize);
+	if ((i / ARITH_REGION_SIZE + 1) % (NINTERRUPT / ARITH_REGION_SIZE) == 0)
+	    R_CheckUserInterrupt();
+    }
+    if (naflag)
+	warningcall(lcall, INTEGER_OVERFLOW_WARNING);
+
+    /* copy attributes as real_binary and integer_binary do */
+    if (n == ny && ATTRIB(y) != R_NilValue)
+	copyMostAttrib(y, ans);
+    if (n == nx && ATTRIB(x) != R_NilValue)
+	copyMostAttrib(x, ans);
+
+    UNPROTECT(3); /* ans, bx, by */
+    return ans;
+}
+
+
 static SEXP real_binary(ARITHOP_TYPE code, SEXP s1, SEXP s2)
 {
     R_xlen_t i, i1, i2, n, n1, n2;
@@ -967,14 +1089,14 @@ static SEXP real_binary(ARITHOP_TYPE code, SEXP s1, SEXP s2)
 	    const double *dy = REAL_RO(s2);
 	    if (n2 == 1) {
 		double tmp = dy[0];
-		R_ITERATE_CHECK(NINTERRUPT, n, i, da[i] = dx[i] + tmp;);
+		R_ITERATE_PAR(n, i, , da[i] = dx[i] + tmp;);
 	    }
 	    else if (n1 == 1) {
 		double tmp = dx[0];
-		R_ITERATE_CHECK(NINTERRUPT, n, i, da[i] = tmp + dy[i];);
+		R_ITERATE_PAR(n, i, , da[i] = tmp + dy[i];);
 	    }
 	    else if (n1 == n2)
-		R_ITERATE_CHECK(NINTERRUPT, n, i, da[i] = dx[i] + dy[i];);
+		R_ITERATE_PAR(n, i, , da[i] = dx[i] + dy[i];);
 	    else
 		MOD_ITERATE2_CHECK(NINTERRUPT, n, n1, n2, i, i1, i2,
 				  da[i] = dx[i1] + dy[i2];);
@@ -1001,14 +1123,14 @@ static SEXP real_binary(ARITHOP_TYPE code, SEXP s1, SEXP s2)
 	    const double *dy = REAL_RO(s2);
 	    if (n2 == 1) {
 		double tmp = dy[0];
-		R_ITERATE_CHECK(NINTERRUPT, n, i, da[i] = dx[i] - tmp;);
+		R_ITERATE_PAR(n, i, , da[i] = dx[i] - tmp;);
 	    }
 	    else if (n1 == 1) {
 		double tmp = dx[0];
-		R_ITERATE_CHECK(NINTERRUPT, n, i, da[i] = tmp - dy[i];);
+		R_ITERATE_PAR(n, i, , da[i] = tmp - dy[i];);
 	    }
 	    else if (n1 == n2)
-		R_ITERATE_CHECK(NINTERRUPT, n, i, da[i] = dx[i] - dy[i];);
+		R_ITERATE_PAR(n, i, , da[i] = dx[i] - dy[i];);
 	    else
 		MOD_ITERATE2_CHECK(NINTERRUPT, n, n1, n2, i, i1, i2,
 				  da[i] = dx[i1] - dy[i2];);
@@ -1035,14 +1157,14 @@ static SEXP real_binary(ARITHOP_TYPE code, SEXP s1, SEXP s2)
 	    const double *dy = REAL_RO(s2);
 	    if (n2 == 1) {
 		double tmp = dy[0];
-		R_ITERATE_CHECK(NINTERRUPT, n, i, da[i] = dx[i] * tmp;);
+		R_ITERATE_PAR(n, i, , da[i] = dx[i] * tmp;);
 	    }
 	    else if (n1 == 1) {
 		double tmp = dx[0];
-		R_ITERATE_CHECK(NINTERRUPT, n, i, da[i] = tmp * dy[i];);
+		R_ITERATE_PAR(n, i, , da[i] = tmp * dy[i];);
 	    }
 	    else if (n1 == n2)
-		R_ITERATE_CHECK(NINTERRUPT, n, i, da[i] = dx[i] * dy[i];);
+		R_ITERATE_PAR(n, i, , da[i] = dx[i] * dy[i];);
 	    else
 		MOD_ITERATE2_CHECK(NINTERRUPT, n, n1, n2, i, i1, i2,
 				  da[i] = dx[i1] * dy[i2];);
@@ -1069,14 +1191,14 @@ static SEXP real_binary(ARITHOP_TYPE code, SEXP s1, SEXP s2)
 	    const double *dy = REAL_RO(s2);
 	    if (n2 == 1) {
 		double tmp = dy[0];
-		R_ITERATE_CHECK(NINTERRUPT, n, i, da[i] = dx[i] / tmp;);
+		R_ITERATE_PAR(n, i, , da[i] = dx[i] / tmp;);
 	    }
 	    else if (n1 == 1) {
 		double tmp = dx[0];
-		R_ITERATE_CHECK(NINTERRUPT, n, i, da[i] = tmp / dy[i];);
+		R_ITERATE_PAR(n, i, , da[i] = tmp / dy[i];);
 	    }
 	    else if (n1 == n2)
-		R_ITERATE_CHECK(NINTERRUPT, n, i, da[i] = dx[i] / dy[i];);
+		R_ITERATE_PAR(n, i, , da[i] = dx[i] / dy[i];);
 	    else
 		MOD_ITERATE2_CHECK(NINTERRUPT, n, n1, n2, i, i1, i2,
 				  da[i] = dx[i1] / dy[i2];);
@@ -1103,14 +1225,14 @@ static SEXP real_binary(ARITHOP_TYPE code, SEXP s1, SEXP s2)
 	    const double *dy = REAL_RO(s2);
 	    if (n2 == 1) {
 		double tmp = dy[0];
-		R_ITERATE_CHECK(NINTERRUPT, n, i, da[i] = R_POW(dx[i], tmp););
+		R_ITERATE_PAR(n, i, , da[i] = R_POW(dx[i], tmp););
 	    }
 	    else if (n1 == 1) {
 		double tmp = dx[0];
-		R_ITERATE_CHECK(NINTERRUPT, n, i, da[i] = R_POW(tmp, dy[i]););
+		R_ITERATE_PAR(n, i, , da[i] = R_POW(tmp, dy[i]););
 	    }
 	    else if (n1 == n2)
-		R_ITERATE_CHECK(NINTERRUPT, n, i, da[i] = R_POW(dx[i], dy[i]););
+		R_ITERATE_PAR(n, i, , da[i] = R_POW(dx[i], dy[i]););
 	    else
 		MOD_ITERATE2_CHECK(NINTERRUPT, n, n1, n2, i, i1, i2,
 				  da[i] = R_POW(dx[i1], dy[i2]););
@@ -1196,7 +1318,10 @@ static SEXP real_binary(ARITHOP_TYPE code, SEXP s1, SEXP s2)
 
 /* Mathematical Functions of One Argument */
 
-static SEXP math1(SEXP sa, double(*f)(double), SEXP lcall)
+/* 'parallel' says if f can be called from several threads: it must not
+   signal warnings or errors. */
+static SEXP math1(SEXP sa, double(*f)(double), Rboolean parallel,
+		  SEXP lcall)
 {
     SEXP sy;
     R_xlen_t i, n;
@@ -1212,18 +1337,31 @@ static SEXP math1(SEXP sa, double(*f)(double), SEXP lcall)
     const double *a = REAL_RO(sa);
     double *y = REAL(sy);
     naflag = 0;
-    for (i = 0; i < n; i++) {
-	double x = a[i]; /* in case y == a */
-	/* This code assumes that ISNAN(x) implies ISNAN(f(x)), so we
-	   only need to check ISNAN(x) if ISNAN(f(x)) is true. */
-	y[i] = f(x);
-	if (ISNAN(y[i])) {
-	    if (ISNAN(x))
-		y[i] = x; /* make sure the incoming NaN is preserved */
-	    else
-		naflag = 1;
+    if (parallel)
+	R_ITERATE_PAR(n, k, reduction(|:naflag), {
+		double x = a[k]; /* in case y == a */
+		double fx = f(x);
+		if (ISNAN(fx)) {
+		    if (ISNAN(x))
+			fx = x; /* make sure the incoming NaN is preserved */
+		    else
+			naflag |= 1;
+		}
+		y[k] = fx;
+	    });
+    else
+	for (i = 0; i < n; i++) {
+	    double x = a[i]; /* in case y == a */
+	    /* This code assumes that ISNAN(x) implies ISNAN(f(x)), so we
+	       only need to check ISNAN(x) if ISNAN(f(x)) is true. */
+	    y[i] = f(x);
+	    if (ISNAN(y[i])) {
+		if (ISNAN(x))
+		    y[i] = x; /* make sure the incoming NaN is preserved */
+		else
+		    naflag = 1;
+	    }
 	}
-    }
     /* These are primitives, so need to use the call */
     if(naflag) warningcall(lcall, R_MSG_NA);
 
@@ -1247,7 +1385,9 @@ attribute_hidden SEXP do_math1(SEXP call, SEXP op, SEXP args, SEXP env)
     if (isComplex(CAR(args)))
 	return complex_math1(call, op, args, env);
 
-#define MATH1(x) math1(CAR(args), x, call);
+/* the C library functions and sign() can be used in parallel */
+#define MATH1(x) math1(CAR(args), x, TRUE, call);
+#define MATH1_SERIAL(x) math1(CAR(args), x, FALSE, call);
     switch (PRIMVAL(op)) {
     case 1: return MATH1(floor);
     case 2: return MATH1(ceil);
@@ -1273,11 +1413,11 @@ attribute_hidden SEXP do_math1(SEXP call, SEXP op, SEXP args, SEXP env)
     case 34: return MATH1(asinh);
     case 35: return MATH1(atanh);
 
-    case 40: return MATH1(lgammafn);
-    case 41: return MATH1(gammafn);
+    case 40: return MATH1_SERIAL(lgammafn);
+    case 41: return MATH1_SERIAL(gammafn);
 
-    case 42: return MATH1(digamma);
-    case 43: return MATH1(trigamma);
+    case 42: return MATH1_SERIAL(digamma);
+    case 43: return MATH1_SERIAL(trigamma);
 	/* case 44: return MATH1(tetragamma);
 	   case 45: return MATH1(pentagamma);
 	   removed in 2.0.0 -- rather use Math2's psigamma()
@@ -1288,9 +1428,9 @@ attribute_hidden SEXP do_math1(SEXP call, SEXP op, SEXP args, SEXP env)
     case 44: return MATH1(factorial);
 */
 
-    case 47: return MATH1(cospi);
-    case 48: return MATH1(sinpi);
-    case 49: return MATH1(Rtanpi);// our own in any case
+    case 47: return MATH1_SERIAL(cospi);
+    case 48: return MATH1_SERIAL(sinpi);
+    case 49: return MATH1_SERIAL(Rtanpi);// our own in any case
 
     default:
 	errorcall(call, _("unimplemented real function of 1 argument"));
@@ -1308,7 +1448,7 @@ attribute_hidden SEXP do_trunc(SEXP call, SEXP op, SEXP args, SEXP env)
     check1arg(args, call, "x");
     if (isComplex(CAR(args)))
 	errorcall(call, _("unimplemented complex function"));
-    return math1(CAR(args), trunc, call);
+    return math1(CAR(args), trunc, TRUE, call);
 }
 
 /*
@@ -1752,7 +1892,7 @@ attribute_hidden SEXP do_log_builtin(SEXP call, SEXP op, SEXP args, SEXP env)
 	    if (isComplex(x))
 		res = complex_math1(call, op, args, env);
 	    else
-		res = math1(x, R_log, call);
+		res = math1(x, R_log, TRUE, call);
 	    UNPROTECT(1);
 	    return res;
 	}
@@ -1790,7 +1930,7 @@ attribute_hidden SEXP do_log_builtin(SEXP call, SEXP op, SEXP args, SEXP env)
 	    if (isComplex(CAR(args)))
 		res = complex_math1(call, op, args, env);
 	    else
-		res = math1(CAR(args), R_log, call);
+		res = math1(CAR(args), R_log, TRUE, call);
 	}
 	UNPROTECT(1);
 	return res;
@@ -87,10 +87,132 @@ static SEXP row_names_gets(SEXP vec, SEXP val)
     return ans;
 }
 
+/* Index of long attribute lists.  Attributes are kept in a pairlist
+   that getAttrib and installAttrib search linearly, which is slow for
+   objects carrying many attributes.  A list of at least
+   ATTRIB_INDEX_MIN cells that has been searched through gets an
+   index: an open addressing table of its cells keyed by tag.  Indices
+   are kept in a direct mapped table indexed by the address of the
+   first cell of the list, which is allocated at startup so that using
+   an index never allocates.  The pairlist remains the representation
+   seen by the rest of R.  An index is used only while its first cell
+   is the first cell of the list searched and its last cell is still
+   the last one, so it does not survive replacing the attributes or
+   appending to them other than by installAttrib, and stripAttrib
+   drops it when removing attributes. */
+
+#define ATTRIB_INDEX_MIN 8
+#define ATTRIB_INDEX_SIZE 64  /* number of indices kept */
+#define ATTRIB_INDEX_CAP 256  /* cells per index, a power of 2 */
+#define ATTRIB_INDEX_ENTRY (ATTRIB_INDEX_CAP + 2) /* first, last, cells */
+#define ATTRIB_INDEX_OFFSET(lst)					\
+    ((R_xlen_t) ((((uintptr_t) (lst)) >> 4 ^ ((uintptr_t) (lst)) >> 12) & \
+		 (ATTRIB_INDEX_SIZE - 1)) * ATTRIB_INDEX_ENTRY)
+#define ATTRIB_INDEX_SLOT(sym)						\
+    ((int) ((((uintptr_t) (sym)) >> 4 ^ ((uintptr_t) (sym)) >> 10) &	\
+	    (ATTRIB_INDEX_CAP - 1)))
+
+static SEXP AttribIndex = NULL;
+static int attrib_index_count[ATTRIB_INDEX_SIZE];
+
+attribute_hidden void InitAttribIndex(void)
+{
+    R_PreserveObject(AttribIndex =
+		     allocVector(VECSXP,
+				 ATTRIB_INDEX_SIZE * ATTRIB_INDEX_ENTRY));
+}
+
+/* offset of the index of lst, or -1 if there is none */
+static R_INLINE R_xlen_t attribIndexFind(SEXP lst)
+{
+    if (AttribIndex == NULL || lst == R_NilValue)
+	return -1;
+    R_xlen_t k = ATTRIB_INDEX_OFFSET(lst);
+    if (VECTOR_ELT(AttribIndex, k) != lst ||
+	CDR(VECTOR_ELT(AttribIndex, k + 1)) != R_NilValue)
+	return -1;
+    return k;
+}
+
+/* the cell tagged name in the index at k, or R_NilValue */
+static R_INLINE SEXP attribIndexGet(R_xlen_t k, SEXP name)
+{
+    for (int h = ATTRIB_INDEX_SLOT(name); ;
+	 h = (h + 1) & (ATTRIB_INDEX_CAP - 1)) {
+	SEXP cell = VECTOR_ELT(AttribIndex, k + 2 + h);
+	if (cell == R_NilValue || TAG(cell) == name)
+	    return cell;
+    }
+}
+
+/* add a cell of the list indexed at k */
+static void attribIndexAdd(R_xlen_t k, SEXP cell)
+{
+    SEXP tag = TAG(cell);
+    int h = ATTRIB_INDEX_SLOT(tag);
+    SEXP old;
+    while ((old = VECTOR_ELT(AttribIndex, k + 2 + h)) != R_NilValue) {
+	if (TAG(old) == tag) /* only the first cell with a tag is found */
+	    return;
+	h = (h + 1) & (ATTRIB_INDEX_CAP - 1);
+    }
+    SET_VECTOR_ELT(AttribIndex, k + 2 + h, cell);
+    attrib_index_count[k / ATTRIB_INDEX_ENTRY]++;
+}
+
+/* Index lst, a list of n cells.  Lists with more than half as many
+   cells as an index can hold are left alone. */
+static void attribIndexBuild(SEXP lst, int n)
+{
+    if (AttribIndex == NULL || n > ATTRIB_INDEX_CAP / 2)
+	return;
+    R_xlen_t k = ATTRIB_INDEX_OFFSET(lst);
+    for (int h = 0; h < ATTRIB_INDEX_CAP; h++)
+	SET_VECTOR_ELT(AttribIndex, k + 2 + h, R_NilValue);
+    attrib_index_count[k / ATTRIB_INDEX_ENTRY] = 0;
+    SEXP last = lst;
+    for (SEXP s = lst; s != R_NilValue; s = CDR(s)) {
+	attribIndexAdd(k, s);
+	last = s;
+    }
+    SET_VECTOR_ELT(AttribIndex, k, lst);
+    SET_VECTOR_ELT(AttribIndex, k + 1, last);
+}
+
+static R_INLINE void attribIndexDrop(SEXP lst)
+{
+    if (AttribIndex != NULL && lst != R_NilValue) {
+	R_xlen_t k = ATTRIB_INDEX_OFFSET(lst);
+	if (VECTOR_ELT(AttribIndex, k) == lst)
+	    SET_VECTOR_ELT(AttribIndex, k, R_NilValue);
+    }
+}
+
+/* The cell of the attribute list lst tagged name, or R_NilValue */
+static SEXP findAttribCell(SEXP lst, SEXP name)
+{
+    R_xlen_t k = attribIndexFind(lst);
+    if (k >= 0)
+	return attribIndexGet(k, name);
+
+    int n = 0;
+    SEXP s;
+    for (s = lst; s != R_NilValue; s = CDR(s), n++)
+	if (TAG(s) == name)
+	    break;
+    if (n >= ATTRIB_INDEX_MIN) {
+	if (s != R_NilValue)
+	    n = length(lst);
+	attribIndexBuild(lst, n);
+    }
+    return s;
+}
+
 /* used in removeAttrib, commentgets and classgets */
 static SEXP stripAttrib(SEXP tag, SEXP lst)
 {
     if(lst == R_NilValue) return lst;
+    attribIndexDrop(lst);
     if(tag == TAG(lst)) return stripAttrib(tag, CDR(lst));
     SETCDR(lst, stripAttrib(tag, CDR(lst)));
     return lst;
@@ -149,17 +271,17 @@ attribute_hidden SEXP getAttrib0(SEXP vec, SEXP name)
 		return R_NilValue;
 	}
     }
-    for (s = ATTRIB(vec); s != R_NilValue; s = CDR(s))
-	if (TAG(s) == name) {
-	    if (name == R_DimNamesSymbol && TYPEOF(CAR(s)) == LISTSXP)
-		error("old list is no longer allowed for dimnames attribute");
-	    /**** this could be dropped for REFCNT or be less
-		  stringent for NAMED for attributes where the setter
-		  does not have a consistency check that could fail
-		  after mutation in a complex assignment LT */
-	    MARK_NOT_MUTABLE(CAR(s));
-	    return CAR(s);
-	}
+    s = findAttribCell(ATTRIB(vec), name);
+    if (s != R_NilValue) {
+	if (name == R_DimNamesSymbol && TYPEOF(CAR(s)) == LISTSXP)
+	    error("old list is no longer allowed for dimnames attribute");
+	/**** this could be dropped for REFCNT or be less
+	      stringent for NAMED for attributes where the setter
+	      does not have a consistency check that could fail
+	      after mutation in a complex assignment LT */
+	MARK_NOT_MUTABLE(CAR(s));
+	return CAR(s);
+    }
     return R_NilValue;
 }
 
@@ -351,21 +473,19 @@ void copyMostAttribNoTs(SEXP inp, SEXP ans)
 /* Tweaks here based in part on PR#14934 */
 static SEXP installAttrib(SEXP vec, SEXP name, SEXP val)
 {
-    SEXP t = R_NilValue; /* -Wall */
+    SEXP t;
 
     if(TYPEOF(vec) == CHARSXP)
 	error("cannot set attribute on a CHARSXP");
     if (TYPEOF(vec) == SYMSXP)
 	error(_("cannot set attribute on a symbol"));
     /* this does no allocation */
-    for (SEXP s = ATTRIB(vec); s != R_NilValue; s = CDR(s)) {
-	if (TAG(s) == name) {
-	    if (MAYBE_REFERENCED(val) && val != CAR(s))
-		val = R_FixupRHS(vec, val);
-	    SETCAR(s, val);
-	    return val;
-	}
-	t = s; // record last attribute, if any
+    t = findAttribCell(ATTRIB(vec), name);
+    if (t != R_NilValue) {
+	if (MAYBE_REFERENCED(val) && val != CAR(t))
+	    val = R_FixupRHS(vec, val);
+	SETCAR(t, val);
+	return val;
     }
 
     /* The usual convention is that the caller protects,
@@ -375,7 +495,23 @@ static SEXP installAttrib(SEXP vec, SEXP name, SEXP val)
     if (MAYBE_REFERENCED(val)) ENSURE_NAMEDMAX(val);
     SEXP s = CONS(val, R_NilValue);
     SET_TAG(s, name);
-    if (ATTRIB(vec) == R_NilValue) SET_ATTRIB(vec, s); else SETCDR(t, s);
+    if (ATTRIB(vec) == R_NilValue) SET_ATTRIB(vec, s);
+    else {
+	R_xlen_t k = attribIndexFind(ATTRIB(vec));
+	if (k >= 0) {
+	    SETCDR(VECTOR_ELT(AttribIndex, k + 1), s);
+	    SET_VECTOR_ELT(AttribIndex, k + 1, s);
+	    if (attrib_index_count[k / ATTRIB_INDEX_ENTRY] <
+		ATTRIB_INDEX_CAP / 2)
+		attribIndexAdd(k, s);
+	    else
+		attribIndexDrop(ATTRIB(vec));
+	}
+	else {
+	    for (t = ATTRIB(vec); CDR(t) != R_NilValue; t = CDR(t));
+	    SETCDR(t, s);
+	}
+    }
     UNPROTECT(3);
     return val;
 }
@@ -1482,8 +1618,16 @@ attribute_hidden SEXP do_attr(SEXP call, SEXP op, SEXP args, SEXP env)
     str = translateChar(STRING_ELT(t, 0));
     size_t n = strlen(str);
 
+    /* an exact match in an indexed list needs no search */
+    if (attribIndexFind(ATTRIB(s)) >= 0) {
+	tag = installTrChar(STRING_ELT(t, 0));
+	if (findAttribCell(ATTRIB(s), tag) != R_NilValue)
+	    match = FULL;
+    }
+
     /* try to find a match among the attributes list */
-    for (alist = ATTRIB(s); alist != R_NilValue; alist = CDR(alist)) {
+    for (alist = ATTRIB(s); match != FULL && alist != R_NilValue;
+	 alist = CDR(alist)) {
 	SEXP tmp = TAG(alist);
 	const char *s = CHAR(PRINTNAME(tmp));
 	if (! strncmp(s, str, n)) {
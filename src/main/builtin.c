@@ -334,6 +334,8 @@ attribute_hidden SEXP do_envirgets(SEXP call, SEXP op, SEXP args, SEXP rho)
 
 
 /** do_newenv() :  .Internal(new.env(hash, parent, size))
+ *
+ * hash = "open" asks for an open-addressing table, see envir.c
  *
  * @return a newly created environment()
  */
@@ -341,10 +343,18 @@ attribute_hidden SEXP do_newenv(SEXP call, SEXP op, SEXP args, SEXP rho)
 {
     SEXP enclos;
     int hash, size = 0;
+    Rboolean open = FALSE;
 
     checkArity(op, args);
 
-    hash = asInteger(CAR(args));
+    if (isString(CAR(args))) {
+	if (XLENGTH(CAR(args)) != 1 || STRING_ELT(CAR(args), 0) == NA_STRING ||
+	    strcmp(CHAR(STRING_ELT(CAR(args), 0)), "open"))
+	    error(_("invalid '%s' argument"), "hash");
+	hash = open = TRUE;
+    }
+    else
+	hash = asInteger(CAR(args));
     args = CDR(args);
     enclos = CAR(args);
     if (isNull(enclos))
@@ -360,6 +370,8 @@ attribute_hidden SEXP do_newenv(SEXP call, SEXP op, SEXP args, SEXP rho)
 	    size = 0; /* so it will use the internal default */
     }
     else size = 0;
+    if (open)
+	return R_NewOpenHashedEnv(enclos, size);
     return R_NewEnv(enclos, hash, size);
 }
 
@@ -423,6 +435,7 @@ attribute_hidden SEXP do_parentenvgets(SEXP call, SEXP op, SEXP args, SEXP rho)
 	error(_("'parent' is not an environment"));
 
     SET_ENCLOS(env, parent);
+    R_BindingEpoch++; /* invalidate cached lookups through env */
 
     return( CAR(args) );
 }
@@ -24,6 +24,12 @@
 
 #include <Defn.h>
 #include <Internal.h>
+#include <R_ext/Itermacros.h> /* for ITERATE_BY_REGION */
+
+/* The real and integer versions read x by ITERATE_BY_REGION, so ALTREP
+   arguments such as compact sequences and compressed or memory mapped
+   vectors are not expanded.  A break in the loop body ends the
+   iteration. */
 
 /* Handle NaN and NA in input for a cumulative operation, preserving
    distinction between NA and NaN. */
@@ -31,45 +37,53 @@ static SEXP handleNaN(SEXP x, SEXP s)
 {
     Rboolean hasNA = FALSE;
     Rboolean hasNaN = FALSE;
-    double *rx = REAL(x), *rs = REAL(s);
+    double *rs = REAL(s);
 
-    for (R_xlen_t i = 0 ; i < XLENGTH(x) ; i++) {
-	hasNaN = hasNaN || ISNAN(rx[i]);
-	hasNA = hasNA || (hasNaN && R_IsNA(rx[i]));
+    ITERATE_BY_REGION(x, rx, i, nbatch, double, REAL, {
+	    for (R_xlen_t k = 0; k < nbatch; k++) {
+		hasNaN = hasNaN || ISNAN(rx[k]);
+		hasNA = hasNA || (hasNaN && R_IsNA(rx[k]));
 
-	if (hasNA)
-	    rs[i] = NA_REAL;
-	else if (hasNaN)
-	    rs[i] = R_NaN;
-    }
+		if (hasNA)
+		    rs[i + k] = NA_REAL;
+		else if (hasNaN)
+		    rs[i + k] = R_NaN;
+	    }
+	});
     return s;
 }
 
 static SEXP cumsum(SEXP x, SEXP s)
 {
     LDOUBLE sum = 0.;
-    double *rx = REAL(x), *rs = REAL(s);
-    for (R_xlen_t i = 0 ; i < XLENGTH(x) ; i++) {
-	sum += rx[i]; /* NA and NaN propagated */
-	rs[i] = (double) sum;
-    }
+    double *rs = REAL(s);
+    ITERATE_BY_REGION(x, rx, i, nbatch, double, REAL, {
+	    for (R_xlen_t k = 0; k < nbatch; k++) {
+		sum += rx[k]; /* NA and NaN propagated */
+		rs[i + k] = (double) sum;
+	    }
+	});
     return ISNAN(sum) ? handleNaN(x, s) : s;
 }
 
 /* We need to ensure that overflow gives NA here */
 static SEXP icumsum(SEXP x, SEXP s)
 {
-    int *ix = INTEGER(x), *is = INTEGER(s);
+    int *is = INTEGER(s);
     double sum = 0.0;
-    for (R_xlen_t i = 0 ; i < XLENGTH(x) ; i++) {
-	if (ix[i] == NA_INTEGER) break;
-	sum += ix[i];
-	if(sum > INT_MAX || sum < 1 + INT_MIN) { /* INT_MIN is NA_INTEGER */
-	    warning(_("integer overflow in 'cumsum'; use 'cumsum(as.numeric(.))'"));
-	    break;
-	}
-	is[i] = (int) sum;
-    }
+    ITERATE_BY_REGION(x, ix, i, nbatch, int, INTEGER, {
+	    R_xlen_t k;
+	    for (k = 0; k < nbatch; k++) {
+		if (ix[k] == NA_INTEGER) break;
+		sum += ix[k];
+		if(sum > INT_MAX || sum < 1 + INT_MIN) { /* INT_MIN is NA_INTEGER */
+		    warning(_("integer overflow in 'cumsum'; use 'cumsum(as.numeric(.))'"));
+		    break;
+		}
+		is[i + k] = (int) sum;
+	    }
+	    if (k < nbatch) break;
+	});
     return s;
 }
 
@@ -112,12 +126,14 @@ static SEXP ccumsum(SEXP x, SEXP s)
 static SEXP cumprod(SEXP x, SEXP s)
 {
     LDOUBLE prod;
-    double *rx = REAL(x), *rs = REAL(s);
+    double *rs = REAL(s);
     prod = 1.0;
-    for (R_xlen_t i = 0 ; i < XLENGTH(x) ; i++) {
-	prod *= rx[i]; /* NA and NaN propagated */
-	rs[i] = (double) prod;
-    }
+    ITERATE_BY_REGION(x, rx, i, nbatch, double, REAL, {
+	    for (R_xlen_t k = 0; k < nbatch; k++) {
+		prod *= rx[k]; /* NA and NaN propagated */
+		rs[i + k] = (double) prod;
+	    }
+	});
     return ISNAN(prod) ? handleNaN(x, s) : s;
 }
 
@@ -139,55 +155,67 @@ static SEXP ccumprod(SEXP x, SEXP s)
 
 static SEXP cummax(SEXP x, SEXP s)
 {
-    double max, *rx = REAL(x), *rs = REAL(s);
+    double max, *rs = REAL(s);
     max = R_NegInf;
-    for (R_xlen_t i = 0 ; i < XLENGTH(x) ; i++) {
-	if (ISNAN(rx[i]))
-	    return handleNaN(x, s);
-	else
-	    max = (max > rx[i]) ? max : rx[i];
-	rs[i] = max;
-    }
+    ITERATE_BY_REGION(x, rx, i, nbatch, double, REAL, {
+	    for (R_xlen_t k = 0; k < nbatch; k++) {
+		if (ISNAN(rx[k]))
+		    return handleNaN(x, s);
+		else
+		    max = (max > rx[k]) ? max : rx[k];
+		rs[i + k] = max;
+	    }
+	});
     return s;
 }
 
 static SEXP cummin(SEXP x, SEXP s)
 {
-    double min, *rx = REAL(x), *rs = REAL(s);
+    double min, *rs = REAL(s);
     min = R_PosInf; /* always positive, not NA */
-    for (R_xlen_t i = 0 ; i < XLENGTH(x) ; i++ ) {
-	if (ISNAN(rx[i]))
-	    return handleNaN(x, s);
-	else
-	    min = (min < rx[i]) ? min : rx[i];
-	rs[i] = min;
-    }
+    ITERATE_BY_REGION(x, rx, i, nbatch, double, REAL, {
+	    for (R_xlen_t k = 0; k < nbatch; k++) {
+		if (ISNAN(rx[k]))
+		    return handleNaN(x, s);
+		else
+		    min = (min < rx[k]) ? min : rx[k];
+		rs[i + k] = min;
+	    }
+	});
     return s;
 }
 
 static SEXP icummax(SEXP x, SEXP s)
 {
-    int *ix = INTEGER(x);
-    if(ix[0] == NA_INTEGER)
+    int *is = INTEGER(s), max = INTEGER_ELT(x, 0);
+    if(max == NA_INTEGER)
 	return s; // all NA
-    int *is = INTEGER(s), max = ix[0];
     is[0] = max;
-    for (R_xlen_t i = 1 ; i < XLENGTH(x) ; i++) {
-	if(ix[i] == NA_INTEGER) break;
-	is[i] = max = (max > ix[i]) ? max : ix[i];
-    }
+    ITERATE_BY_REGION_PARTIAL(x, ix, i, nbatch, int, INTEGER,
+			      1, XLENGTH(x) - 1, {
+	    R_xlen_t k;
+	    for (k = 0; k < nbatch; k++) {
+		if(ix[k] == NA_INTEGER) break;
+		is[i + k] = max = (max > ix[k]) ? max : ix[k];
+	    }
+	    if (k < nbatch) break;
+	});
     return s;
 }
 
 static SEXP icummin(SEXP x, SEXP s)
 {
-    int *ix = INTEGER(x), *is = INTEGER(s);
-    int min = ix[0];
+    int *is = INTEGER(s), min = INTEGER_ELT(x, 0);
     is[0] = min;
-    for (R_xlen_t i = 1 ; i < XLENGTH(x) ; i++ ) {
-	if(ix[i] == NA_INTEGER) break;
-	is[i] = min = (min < ix[i]) ? min : ix[i];
-    }
+    ITERATE_BY_REGION_PARTIAL(x, ix, i, nbatch, int, INTEGER,
+			      1, XLENGTH(x) - 1, {
+	    R_xlen_t k;
+	    for (k = 0; k < nbatch; k++) {
+		if(ix[k] == NA_INTEGER) break;
+		is[i + k] = min = (min < ix[k]) ? min : ix[k];
+	    }
+	    if (k < nbatch) break;
+	});
     return s;
 }
 
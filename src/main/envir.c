@@ -203,12 +203,20 @@ attribute_hidden Rboolean R_envHasNoSpecialSymbols (SEXP env)
 #define HASHSIZE(x)	     ((int) STDVEC_LENGTH(x))
 #define HASHPRI(x)	     ((int) STDVEC_TRUELENGTH(x))
 #define HASHTABLEGROWTHRATE  1.2
+#define HASHLARGESIZE	     65536 /* tables doubled from this size on */
 #define HASHMINSIZE	     29
 #define SET_HASHPRI(x,v)     SET_TRUELENGTH(x,v)
 #define HASHCHAIN(table, i)  ((SEXP *) STDVEC_DATAPTR(table))[i]
 
 #define IS_HASHED(x)	     (HASHTAB(x) != R_NilValue)
 
+/* open-addressing tables, see "Open Hash Tables" below */
+#define OPEN_TABLE_MASK	     (1<<11)
+#define IS_OPEN_TABLE(x)     ((x)->sxpinfo.gp & OPEN_TABLE_MASK)
+#define SET_OPEN_TABLE(x)    ((x)->sxpinfo.gp |= OPEN_TABLE_MASK)
+#define IS_OPEN_FRAME(rho)   (TYPEOF(HASHTAB(rho)) == VECSXP && \
+			      IS_OPEN_TABLE(HASHTAB(rho)))
+
 /*----------------------------------------------------------------------
 
   String Hashing
@@ -390,6 +398,7 @@ SEXP R_NewHashedEnv(SEXP enclos, int size)
 */
 
 static SEXP RemoveFromList(SEXP thing, SEXP list, int *found);
+static Rboolean R_OpenTableDelete(SEXP table, SEXP symbol);
 
 static void R_HashDelete(int hashcode, SEXP symbol, SEXP env, int *found)
 {
@@ -397,6 +406,12 @@ static void R_HashDelete(int hashcode, SEXP symbol, SEXP env, int *found)
     SEXP list, hashtab;
 
     hashtab = HASHTAB(env);
+    if (IS_OPEN_TABLE(hashtab)) {
+	*found = R_OpenTableDelete(hashtab, symbol);
+	if (*found && env == R_GlobalEnv)
+	    R_DirtyImage = 1;
+	return;
+    }
     idx = hashcode % HASHSIZE(hashtab);
     list = RemoveFromList(symbol, VECTOR_ELT(hashtab, idx), found);
     if (*found) {
@@ -428,17 +443,21 @@ static SEXP R_HashResize(SEXP table)
     if (TYPEOF(table) != VECSXP)
 	error("first argument ('table') not of type VECSXP, from R_HashResize");
 
-    /* This may have to change.	 The growth rate should
-       be independent of the size (not implemented yet) */
-    /* hash_grow = HASHSIZE(table); */
+    /* Small tables grow slowly to save space, but large ones (as
+       when environments are used as maps with millions of keys) are
+       doubled, as otherwise most of the time is spent rehashing. */
+    double growth = HASHSIZE(table) < HASHLARGESIZE ?
+	HASHTABLEGROWTHRATE : 2.0;
 
     /* Allocate the new hash table */
-    SEXP new_table = R_NewHashTable(1 + (int)(HASHSIZE(table) * HASHTABLEGROWTHRATE));
+    SEXP new_table = R_NewHashTable(1 + (int)(HASHSIZE(table) * growth));
     for (int counter = 0; counter < length(table); counter++) {
 	SEXP chain = VECTOR_ELT(table, counter);
 	while (!ISNULL(chain)) {
-	    int new_hashcode = R_Newhashpjw(CHAR(PRINTNAME(TAG(chain)))) %
-		HASHSIZE(new_table);
+	    /* the symbol hash is cached once a symbol is in a table */
+	    SEXP c = PRINTNAME(TAG(chain));
+	    int hashcode = HASHASH(c) ? HASHVALUE(c) : R_Newhashpjw(CHAR(c));
+	    int new_hashcode = hashcode % HASHSIZE(new_table);
 	    SEXP new_chain = VECTOR_ELT(new_table, new_hashcode);
 	    /* If using a primary slot then increase HASHPRI */
 	    if (ISNULL(new_chain))
@@ -533,6 +552,199 @@ static SEXP R_HashFrame(SEXP rho)
 }
 
 
+/*----------------------------------------------------------------------
+
+  Open Hash Tables
+
+  Environments created by new.env(hash = "open") keep their bindings
+  in a single vector holding the symbols and the values of 2^k slots
+  in turn, probed linearly from the cached hash of the symbol's name.
+  This takes two pointers per binding instead of a cons cell and a
+  bucket, and a lookup reads adjacent memory rather than following a
+  chain.  Removed bindings leave R_UnboundValue as a tombstone.
+  HASHPRI counts the slots used, including tombstones, and the table
+  is rebuilt when more than half are.
+
+  These tables have no binding cells, so they cannot hold locked or
+  active bindings, and the byte code interpreter and the global and
+  lookup caches refer to binding cells.  Such an environment is
+  converted to a table of chains by R_OpenFrameToCells whenever a
+  binding cell is needed, such as when the location of a binding is
+  looked up, bindings are locked or the environment is serialized.
+*/
+
+#define OPEN_MINSIZE	     32
+#define OPEN_MAXSIZE	     (1 << 29)
+#define OPEN_SIZE(x)	     (XLENGTH(x) / 2)
+#define OPEN_KEY(x, i)	     VECTOR_ELT(x, 2 * (i))
+#define OPEN_VALUE(x, i)     VECTOR_ELT(x, 2 * (i) + 1)
+#define OPEN_LIVE_KEY(k)     ((k) != R_NilValue && (k) != R_UnboundValue)
+
+/* A table with room for count bindings at most half full */
+static SEXP R_NewOpenTable(R_xlen_t count)
+{
+    R_xlen_t size = OPEN_MINSIZE;
+    while (size < 2 * count && size < OPEN_MAXSIZE)
+	size *= 2;
+    SEXP table = allocVector(VECSXP, 2 * size);
+    SET_OPEN_TABLE(table);
+    SET_HASHPRI(table, 0);
+    return table;
+}
+
+static R_INLINE R_xlen_t OpenTableStart(SEXP symbol, R_xlen_t mask)
+{
+    SEXP c = PRINTNAME(symbol);
+    if( !HASHASH(c) ) {
+	SET_HASHVALUE(c, R_Newhashpjw(CHAR(c)));
+	SET_HASHASH(c, 1);
+    }
+    /* mix the bits, as names often differ only in their last letters
+       (the finalizer of MurmurHash3) */
+    unsigned int h = (unsigned int) HASHVALUE(c);
+    h ^= h >> 16;
+    h *= 0x85ebca6bU;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35U;
+    h ^= h >> 16;
+    return (R_xlen_t) h & mask;
+}
+
+/* The slot holding symbol, or the empty slot ending its probe sequence */
+static R_INLINE R_xlen_t OpenTableFind(SEXP table, SEXP symbol)
+{
+    R_xlen_t mask = OPEN_SIZE(table) - 1;
+    R_xlen_t i = OpenTableStart(symbol, mask);
+    for (;;) {
+	SEXP key = OPEN_KEY(table, i);
+	if (key == symbol || key == R_NilValue)
+	    return i;
+	i = (i + 1) & mask;
+    }
+}
+
+static R_xlen_t OpenTableCount(SEXP table)
+{
+    R_xlen_t count = 0, size = OPEN_SIZE(table);
+    for (R_xlen_t i = 0; i < size; i++)
+	if (OPEN_LIVE_KEY(OPEN_KEY(table, i)))
+	    count++;
+    return count;
+}
+
+/* Rebuild the table of rho without tombstones, with room for extra
+   more bindings */
+static void R_OpenTableResize(SEXP rho, R_xlen_t extra)
+{
+    SEXP table = HASHTAB(rho);
+    R_xlen_t size = OPEN_SIZE(table);
+    SEXP new_table = R_NewOpenTable(OpenTableCount(table) + extra);
+    for (R_xlen_t i = 0; i < size; i++) {
+	SEXP key = OPEN_KEY(table, i);
+	if (OPEN_LIVE_KEY(key)) {
+	    R_xlen_t j = OpenTableFind(new_table, key);
+	    SET_VECTOR_ELT(new_table, 2 * j, key);
+	    SET_VECTOR_ELT(new_table, 2 * j + 1, OPEN_VALUE(table, i));
+	    SET_HASHPRI(new_table, HASHPRI(new_table) + 1);
+	}
+    }
+    SET_HASHTAB(rho, new_table);
+}
+
+/* Returns the value bound to symbol, or R_UnboundValue */
+static R_INLINE SEXP R_OpenTableGet(SEXP table, SEXP symbol)
+{
+    R_xlen_t i = OpenTableFind(table, symbol);
+    return OPEN_KEY(table, i) == symbol ?
+	OPEN_VALUE(table, i) : R_UnboundValue;
+}
+
+/* Sets the value bound to symbol, adding a binding if there is none
+   and add is true.  Returns FALSE if there was no binding. */
+static Rboolean R_OpenTableSet(SEXP rho, SEXP symbol, SEXP value,
+			       Rboolean add)
+{
+    SEXP table = HASHTAB(rho);
+    R_xlen_t i = OpenTableFind(table, symbol);
+    if (OPEN_KEY(table, i) == symbol) {
+	SET_VECTOR_ELT(table, 2 * i + 1, value);
+	return TRUE;
+    }
+    if (! add)
+	return FALSE;
+    if (OPEN_SIZE(table) >= OPEN_MAXSIZE &&
+	HASHPRI(table) >= OPEN_MAXSIZE - OPEN_MAXSIZE / 4)
+	error(_("too many bindings in environment"));
+
+    /* reuse the first tombstone in the probe sequence, if any */
+    R_xlen_t mask = OPEN_SIZE(table) - 1;
+    for (R_xlen_t j = OpenTableStart(symbol, mask); j != i;
+	 j = (j + 1) & mask)
+	if (OPEN_KEY(table, j) == R_UnboundValue) {
+	    SET_VECTOR_ELT(table, 2 * j, symbol);
+	    SET_VECTOR_ELT(table, 2 * j + 1, value);
+	    return FALSE;
+	}
+    SET_VECTOR_ELT(table, 2 * i, symbol);
+    SET_VECTOR_ELT(table, 2 * i + 1, value);
+    SET_HASHPRI(table, HASHPRI(table) + 1);
+    if (HASHPRI(table) > OPEN_SIZE(table) / 2 &&
+	OPEN_SIZE(table) < OPEN_MAXSIZE) {
+	PROTECT(value);
+	R_OpenTableResize(rho, 1);
+	UNPROTECT(1);
+    }
+    return FALSE;
+}
+
+static Rboolean R_OpenTableDelete(SEXP table, SEXP symbol)
+{
+    R_xlen_t i = OpenTableFind(table, symbol);
+    if (OPEN_KEY(table, i) != symbol)
+	return FALSE;
+    SET_VECTOR_ELT(table, 2 * i, R_UnboundValue);
+    SET_VECTOR_ELT(table, 2 * i + 1, R_NilValue);
+    return TRUE;
+}
+
+attribute_hidden Rboolean R_IsOpenFrame(SEXP rho)
+{
+    return TYPEOF(rho) == ENVSXP && IS_OPEN_FRAME(rho);
+}
+
+/* Convert the open table of rho to a table of chains of binding
+   cells; does nothing for other environments. */
+attribute_hidden void R_OpenFrameToCells(SEXP rho)
+{
+    if (! R_IsOpenFrame(rho))
+	return;
+    SEXP table = HASHTAB(rho);
+    R_xlen_t count = OpenTableCount(table);
+    if (count > INT_MAX)
+	error(_("too many bindings to convert environment"));
+    SEXP new_table = PROTECT(R_NewHashTable(1 + (int) (count / 0.85)));
+    R_xlen_t size = OPEN_SIZE(table);
+    for (R_xlen_t i = 0; i < size; i++) {
+	SEXP key = OPEN_KEY(table, i);
+	if (OPEN_LIVE_KEY(key)) {
+	    int hashcode = HASHVALUE(PRINTNAME(key)) % HASHSIZE(new_table);
+	    R_HashSet(hashcode, key, new_table, OPEN_VALUE(table, i), FALSE);
+	}
+    }
+    SET_HASHTAB(rho, new_table);
+    UNPROTECT(1); /* new_table */
+}
+
+attribute_hidden SEXP R_NewOpenHashedEnv(SEXP enclos, int size)
+{
+    PROTECT(enclos);
+    SEXP s = PROTECT(NewEnvironment(R_NilValue, R_NilValue, enclos));
+    SET_HASHTAB(s, R_NewOpenTable(size));
+    UNPROTECT(2);
+    return s;
+}
+
+
 /* ---------------------------------------------------------------------
 
    R_HashProfile
@@ -563,6 +775,19 @@ static SEXP R_HashProfile(SEXP table)
     setAttrib(ans, R_NamesSymbol, nms);
     UNPROTECT(1);
 
+    if (IS_OPEN_TABLE(table)) {
+	/* slots rather than chains, holding at most one binding */
+	R_xlen_t size = OPEN_SIZE(table);
+	SET_VECTOR_ELT(ans, 0, ScalarInteger((int) size));
+	SET_VECTOR_ELT(ans, 1, ScalarInteger((int) OpenTableCount(table)));
+	chain_counts = allocVector(INTSXP, size);
+	SET_VECTOR_ELT(ans, 2, chain_counts);
+	for (R_xlen_t j = 0; j < size; j++)
+	    INTEGER(chain_counts)[j] = OPEN_LIVE_KEY(OPEN_KEY(table, j));
+	UNPROTECT(1); /* ans */
+	return ans;
+    }
+
     SET_VECTOR_ELT(ans, 0, ScalarInteger(length(table)));
     SET_VECTOR_ELT(ans, 1, ScalarInteger(HASHPRI(table)));
 
@@ -658,6 +883,38 @@ static SEXP R_HashProfile(SEXP table)
 
 static SEXP R_GlobalCache, R_GlobalCachePreserve;
 #endif
+
+/* Lookup caches.  The byte code interpreter keeps, for each symbol in
+   a constant pool, the binding cell found by a search starting at the
+   enclosure of the function's frame (see R_findVarLocForCache below).
+   Such a result stays valid until the binding is removed, which the
+   interpreter detects as for its local cache, or until a new binding
+   for the symbol is created in one of the frames the search went
+   through.  The frames searched and the symbols searched for are
+   flagged.  Creating a binding for a flagged symbol in a flagged
+   frame or in a global frame, or adding one to the base environment,
+   and attaching or detaching and changing an enclosure all increment
+   R_BindingEpoch, which invalidates every cached result at once.
+   Bindings for the symbols looked up in this way are rarely added
+   once packages are loaded, and new variables in the global
+   environment usually have other names, so this is cheap. */
+
+#define LOOKUP_FRAME_MASK (1<<13)
+#define IS_LOOKUP_FRAME(e) (ENVFLAGS(e) & LOOKUP_FRAME_MASK)
+#define MARK_AS_LOOKUP_FRAME(e) \
+  SET_ENVFLAGS(e, ENVFLAGS(e) | LOOKUP_FRAME_MASK)
+
+#define LOOKUP_SYMBOL_MASK (1<<10)
+#define IS_LOOKUP_SYMBOL(s) ((s)->sxpinfo.gp & LOOKUP_SYMBOL_MASK)
+#define MARK_AS_LOOKUP_SYMBOL(s) ((s)->sxpinfo.gp |= LOOKUP_SYMBOL_MASK)
+
+#ifdef USE_GLOBAL_CACHE
+# define LOOKUP_CACHE_WATCHES(e, s) \
+    (IS_LOOKUP_SYMBOL(s) && (IS_LOOKUP_FRAME(e) || IS_GLOBAL_FRAME(e)))
+#else
+# define LOOKUP_CACHE_WATCHES(e, s) (IS_LOOKUP_SYMBOL(s) && IS_LOOKUP_FRAME(e))
+#endif
+
 static SEXP R_BaseNamespaceName;
 static SEXP R_NamespaceSymbol;
 
@@ -919,6 +1176,8 @@ static SEXP findVarLocInFrame(SEXP rho, SEXP symbol, Rboolean *canCache)
 	return frame;
     }
     else {
+	/* the caller needs a binding cell */
+	R_OpenFrameToCells(rho);
 	c = PRINTNAME(symbol);
 	if( !HASHASH(c) ) {
 	    SET_HASHVALUE(c, R_Newhashpjw(CHAR(c)));
@@ -1030,6 +1289,8 @@ SEXP findVarInFrame3(SEXP rho, SEXP symbol, Rboolean doGet)
 	    frame = CDR(frame);
 	}
     }
+    else if (IS_OPEN_FRAME(rho))
+	return R_OpenTableGet(HASHTAB(rho), symbol);
     else {
 	c = PRINTNAME(symbol);
 	if( !HASHASH(c) ) {
@@ -1079,6 +1340,8 @@ Rboolean R_existsVarInFrame(SEXP rho, SEXP symbol)
 	    frame = CDR(frame);
 	}
     }
+    else if (IS_OPEN_FRAME(rho))
+	return R_OpenTableGet(HASHTAB(rho), symbol) != R_UnboundValue;
     else {
 	c = PRINTNAME(symbol);
 	if( !HASHASH(c) ) {
@@ -1295,6 +1558,72 @@ R_varloc_t R_findVarLoc(SEXP rho, SEXP symbol)
     return val;
 }
 
+/* Search for a binding of symbol starting at rho for the byte code
+   interpreter's lookup cache.  Returns the binding cell, or the
+   symbol if the binding is in base, when the result can be cached
+   and R_NilValue otherwise.  Only searches starting at locked or
+   global frames are cached, as the cache keeps the starting
+   environment alive.  If fun is true the search is for a function
+   as in findFun, and only succeeds if the first binding found is a
+   function or an evaluated promise for one: the results of searches
+   that skip other bindings would not be invalidated by changes of
+   their values. */
+attribute_hidden SEXP R_findVarLocForCache(SEXP symbol, SEXP rho,
+					   Rboolean fun)
+{
+#ifdef USE_GLOBAL_CACHE
+    if (! FRAME_IS_LOCKED(rho) && ! IS_GLOBAL_FRAME(rho))
+	return R_NilValue;
+#else
+    if (! FRAME_IS_LOCKED(rho))
+	return R_NilValue;
+#endif
+
+    MARK_AS_LOOKUP_SYMBOL(symbol);
+    for (; rho != R_EmptyEnv; rho = ENCLOS(rho)) {
+	if (IS_USER_DATABASE(rho))
+	    return R_NilValue;
+	MARK_AS_LOOKUP_FRAME(rho);
+	SEXP loc = findVarLocInFrame(rho, symbol, NULL);
+	if (loc != R_NilValue) {
+	    if (IS_ACTIVE_BINDING(loc))
+		return R_NilValue;
+	    if (fun) {
+		SEXP val = TYPEOF(loc) == SYMSXP ?
+		    SYMVALUE(loc) : BINDING_VALUE(loc);
+		if (TYPEOF(val) == PROMSXP) {
+		    if (! PROMISE_IS_EVALUATED(val))
+			return R_NilValue;
+		    val = PRVALUE(val);
+		}
+		if (! isFunction(val))
+		    return R_NilValue;
+	    }
+	    return loc;
+	}
+    }
+    return R_NilValue;
+}
+
+/* Look up the binding of symbol in the frame of rho for a cache
+   validated by R_BindingEpoch, as for S3 method dispatch in objects.c.
+   The frame and the symbol are flagged.  Returns the binding cell, or the symbol for
+   base, R_NilValue if there is no binding and R_UnboundValue if the
+   result cannot be cached. */
+attribute_hidden SEXP R_findVarLocInFrameForCache(SEXP rho, SEXP symbol)
+{
+    if (rho == R_EmptyEnv)
+	return R_NilValue;
+    if (IS_USER_DATABASE(rho))
+	return R_UnboundValue;
+    MARK_AS_LOOKUP_FRAME(rho);
+    MARK_AS_LOOKUP_SYMBOL(symbol);
+    SEXP loc = findVarLocInFrame(rho, symbol, NULL);
+    if (loc != R_NilValue && IS_ACTIVE_BINDING(loc))
+	return R_UnboundValue;
+    return loc;
+}
+
 
 /*----------------------------------------------------------------------
 
@@ -1640,6 +1969,7 @@ void defineVar(SEXP symbol, SEXP value, SEXP rho)
 #ifdef USE_GLOBAL_CACHE
 	if (IS_GLOBAL_FRAME(rho)) R_FlushGlobalCache(symbol);
 #endif
+	if (LOOKUP_CACHE_WATCHES(rho, symbol)) R_BindingEpoch++;
 	return;
     }
 
@@ -1666,9 +1996,18 @@ void defineVar(SEXP symbol, SEXP value, SEXP rho)
 	    }
 	    if (FRAME_IS_LOCKED(rho))
 		error(_("cannot add bindings to a locked environment"));
+	    if (LOOKUP_CACHE_WATCHES(rho, symbol)) R_BindingEpoch++;
 	    SET_FRAME(rho, CONS(value, FRAME(rho)));
 	    SET_TAG(FRAME(rho), symbol);
 	}
+	else if (IS_OPEN_FRAME(rho)) {
+	    if (FRAME_IS_LOCKED(rho) &&
+		R_OpenTableGet(HASHTAB(rho), symbol) == R_UnboundValue)
+		error(_("cannot add bindings to a locked environment"));
+	    if (! R_OpenTableSet(rho, symbol, value, TRUE) &&
+		LOOKUP_CACHE_WATCHES(rho, symbol))
+		R_BindingEpoch++;
+	}
 	else {
 	    c = PRINTNAME(symbol);
 	    if( !HASHASH(c) ) {
@@ -1676,6 +2015,9 @@ void defineVar(SEXP symbol, SEXP value, SEXP rho)
 		SET_HASHASH(c, 1);
 	    }
 	    hashcode = HASHVALUE(c) % HASHSIZE(HASHTAB(rho));
+	    if (LOOKUP_CACHE_WATCHES(rho, symbol) &&
+		R_HashGetLoc(hashcode, symbol, HASHTAB(rho)) == R_NilValue)
+		R_BindingEpoch++;
 	    R_HashSet(hashcode, symbol, HASHTAB(rho), value,
 		      FRAME_IS_LOCKED(rho));
 	    if (R_HashSizeCheck(HASHTAB(rho)))
@@ -1786,6 +2128,9 @@ static SEXP setVarInFrame(SEXP rho, SEXP symbol, SEXP value)
 	    }
 	    frame = CDR(frame);
 	}
+    } else if (IS_OPEN_FRAME(rho)) {
+	if (R_OpenTableSet(rho, symbol, value, FALSE))
+	    return symbol;
     } else {
 	/* Do the hash table thing */
 	c = PRINTNAME(symbol);
@@ -1853,6 +2198,8 @@ void gsetVar(SEXP symbol, SEXP value, SEXP rho)
 #ifdef USE_GLOBAL_CACHE
     R_FlushGlobalCache(symbol);
 #endif
+    if (SYMVALUE(symbol) == R_UnboundValue && IS_LOOKUP_SYMBOL(symbol))
+	R_BindingEpoch++;
     SET_SYMBOL_BINDING_VALUE(symbol, value);
 }
 
@@ -2558,6 +2905,7 @@ attribute_hidden SEXP do_attach(SEXP call, SEXP op, SEXP args, SEXP env)
 	    SEXP p, loadenv = CAR(args);
 
 	    PROTECT(s = allocSExp(ENVSXP));
+	    R_OpenFrameToCells(loadenv); /* copied by binding cell */
 	    if (HASHTAB(loadenv) != R_NilValue) {
 		int i, n;
 		n = length(HASHTAB(loadenv));
@@ -2616,6 +2964,7 @@ attribute_hidden SEXP do_attach(SEXP call, SEXP op, SEXP args, SEXP env)
 	SET_ENCLOS(t, s);
 	SET_ENCLOS(s, x);
     }
+    R_BindingEpoch++;
 
     if(!isSpecial) { /* Temporary: need to remove the elements identified by objects(CAR(args)) */
 #ifdef USE_GLOBAL_CACHE
@@ -2677,6 +3026,7 @@ attribute_hidden SEXP do_detach(SEXP call, SEXP op, SEXP args, SEXP env)
 
 	SET_ENCLOS(s, R_BaseEnv);
     }
+    R_BindingEpoch++;
 #ifdef USE_GLOBAL_CACHE
     if(!isSpecial) {
 	R_FlushGlobalCacheFromTable(HASHTAB(s));
@@ -2809,10 +3159,21 @@ static void FrameValues(SEXP frame, int all, SEXP values, int *indx)
 	    error("bad hash table contents");	\
     } while (0)
 
+/* Bindings of open tables, in slot order */
+#define OPEN_LISTED(key, all)					\
+    (OPEN_LIVE_KEY(key) && ((all) || CHAR(PRINTNAME(key))[0] != '.'))
+
 static int HashTableSize(SEXP table, int all)
 {
     CHECK_HASH_TABLE(table);
     int count = 0;
+    if (IS_OPEN_TABLE(table)) {
+	R_xlen_t size = OPEN_SIZE(table);
+	for (R_xlen_t i = 0; i < size; i++)
+	    if (OPEN_LISTED(OPEN_KEY(table, i), all))
+		count++;
+	return count;
+    }
     int n = length(table);
     int i;
     for (i = 0; i < n; i++)
@@ -2823,6 +3184,17 @@ static int HashTableSize(SEXP table, int all)
 static void HashTableNames(SEXP table, int all, SEXP names, int *indx)
 {
     CHECK_HASH_TABLE(table);
+    if (IS_OPEN_TABLE(table)) {
+	R_xlen_t size = OPEN_SIZE(table);
+	for (R_xlen_t i = 0; i < size; i++) {
+	    SEXP key = OPEN_KEY(table, i);
+	    if (OPEN_LISTED(key, all)) {
+		SET_STRING_ELT(names, *indx, PRINTNAME(key));
+		(*indx)++;
+	    }
+	}
+	return;
+    }
     int n = length(table);
     int i;
     for (i = 0; i < n; i++)
@@ -2832,18 +3204,38 @@ static void HashTableNames(SEXP table, int all, SEXP names, int *indx)
 static void HashTableValues(SEXP table, int all, SEXP values, int *indx)
 {
     CHECK_HASH_TABLE(table);
+    if (IS_OPEN_TABLE(table)) {
+	/* forcing a promise may replace the table of the environment */
+	PROTECT(table);
+	R_xlen_t size = OPEN_SIZE(table);
+	for (R_xlen_t i = 0; i < size; i++) {
+	    if (OPEN_LISTED(OPEN_KEY(table, i), all)) {
+		SEXP value = OPEN_VALUE(table, i);
+		if (TYPEOF(value) == PROMSXP) {
+		    PROTECT(value);
+		    value = eval(value, R_GlobalEnv);
+		    UNPROTECT(1);
+		}
+		SET_VECTOR_ELT(values, *indx, lazy_duplicate(value));
+		(*indx)++;
+	    }
+	}
+	UNPROTECT(1); /* table */
+	return;
+    }
     int n = length(table);
     int i;
     for (i = 0; i < n; i++)
 	FrameValues(VECTOR_ELT(table, i), all, values, indx);
 }
+#undef OPEN_LISTED
 
 static int BuiltinSize(int all, int intern)
 {
     int count = 0;
     SEXP s;
     int j;
-    for (j = 0; j < HSIZE; j++) {
+    for (j = 0; j < R_SymbolTableSize; j++) {
 	for (s = R_SymbolTable[j]; s != R_NilValue; s = CDR(s)) {
 	    if (intern) {
 		if (INTERNAL(CAR(s)) != R_NilValue)
@@ -2864,7 +3256,7 @@ BuiltinNames(int all, int intern, SEXP names, int *indx)
 {
     SEXP s;
     int j;
-    for (j = 0; j < HSIZE; j++) {
+    for (j = 0; j < R_SymbolTableSize; j++) {
 	for (s = R_SymbolTable[j]; s != R_NilValue; s = CDR(s)) {
 	    if (intern) {
 		if (INTERNAL(CAR(s)) != R_NilValue)
@@ -2883,34 +3275,31 @@ static void
 BuiltinValues(int all, int intern, SEXP values, int *indx)
 {
     SEXP s, vl;
-    int j;
-    for (j = 0; j < HSIZE; j++) {
+    int j, start = *indx;
+    for (j = 0; j < R_SymbolTableSize; j++) {
 	for (s = R_SymbolTable[j]; s != R_NilValue; s = CDR(s)) {
 	    if (intern) {
-		if (INTERNAL(CAR(s)) != R_NilValue) {
-		    vl = SYMVALUE(CAR(s));
-		    if (TYPEOF(vl) == PROMSXP) {
-			PROTECT(vl);
-			vl = eval(vl, R_BaseEnv);
-			UNPROTECT(1);
-		    }
-		    SET_VECTOR_ELT(values, (*indx)++, lazy_duplicate(vl));
-		}
+		if (INTERNAL(CAR(s)) != R_NilValue)
+		    SET_VECTOR_ELT(values, (*indx)++, SYMVALUE(CAR(s)));
 	    }
 	    else {
 		if ((all || CHAR(PRINTNAME(CAR(s)))[0] != '.')
-		    && SYMVALUE(CAR(s)) != R_UnboundValue) {
-		    vl = SYMVALUE(CAR(s));
-		    if (TYPEOF(vl) == PROMSXP) {
-			PROTECT(vl);
-			vl = eval(vl, R_BaseEnv);
-			UNPROTECT(1);
-		    }
-		    SET_VECTOR_ELT(values, (*indx)++, lazy_duplicate(vl));
-		}
+		    && SYMVALUE(CAR(s)) != R_UnboundValue)
+		    SET_VECTOR_ELT(values, (*indx)++, SYMVALUE(CAR(s)));
 	    }
 	}
     }
+    /* Promises are forced after walking the symbol table, as this
+       may install symbols and so resize the table. */
+    for (j = start; j < *indx; j++) {
+	vl = VECTOR_ELT(values, j);
+	if (TYPEOF(vl) == PROMSXP) {
+	    PROTECT(vl);
+	    vl = eval(vl, R_BaseEnv);
+	    UNPROTECT(1);
+	}
+	SET_VECTOR_ELT(values, j, lazy_duplicate(vl));
+    }
 }
 
 // .Internal(ls(envir, all.names, sorted)) :
@@ -3350,7 +3739,7 @@ void R_LockEnvironment(SEXP env, Rboolean bindings)
 	if (bindings) {
 	    SEXP s;
 	    int j;
-	    for (j = 0; j < HSIZE; j++)
+	    for (j = 0; j < R_SymbolTableSize; j++)
 		for (s = R_SymbolTable[j]; s != R_NilValue; s = CDR(s))
 		    if(SYMVALUE(CAR(s)) != R_UnboundValue)
 			LOCK_BINDING(CAR(s));
@@ -3362,6 +3751,7 @@ void R_LockEnvironment(SEXP env, Rboolean bindings)
     if (TYPEOF(env) != ENVSXP)
 	error(_("not an environment"));
     if (bindings) {
+	R_OpenFrameToCells(env); /* locked bindings need binding cells */
 	if (IS_HASHED(env)) {
 	    SEXP table, chain;
 	    int i, size;
@@ -3467,6 +3857,8 @@ void R_MakeActiveBinding(SEXP sym, SEXP fun, SEXP env)
 	    error(_("symbol already has a regular binding"));
 	else if (BINDING_IS_LOCKED(sym))
 	    error(_("cannot change active binding if binding is locked"));
+	if (SYMVALUE(sym) == R_UnboundValue && IS_LOOKUP_SYMBOL(sym))
+	    R_BindingEpoch++;
 	SET_SYMVALUE(sym, fun);
 	SET_ACTIVE_BINDING_BIT(sym);
 	/* we don't need to worry about the global cache here as
@@ -3532,7 +3924,9 @@ Rboolean R_BindingIsActive(SEXP sym, SEXP env)
 
 attribute_hidden Rboolean R_HasFancyBindings(SEXP rho)
 {
-    if (IS_HASHED(rho)) {
+    if (IS_OPEN_FRAME(rho))
+	return FALSE;
+    else if (IS_HASHED(rho)) {
 	SEXP table, chain;
 	int i, size;
 
@@ -4146,6 +4540,11 @@ attribute_hidden SEXP mkCharWUTF8(const wchar_t *wname)
 static unsigned int char_hash_size = 65536;
 static unsigned int char_hash_mask = 65535;
 
+/* Counts of searches, for stringCacheStats() */
+static struct {
+    double lookups, probes, inserts;
+} char_hash_stats;
+
 static unsigned int char_hash(const char *s, int len)
 {
     /* djb2 as from http://www.cse.yorku.ca/~oz/hash.html */
@@ -4162,6 +4561,24 @@ attribute_hidden void InitStringHash(void)
     R_StringHash = R_NewHashTable(char_hash_size);
 }
 
+/* The cached CHARSXP in chain with the given bytes and encoding bits,
+   or R_NilValue.  *nprobes is incremented by the number of entries
+   compared. */
+static R_INLINE SEXP findCachedChar(SEXP chain, const char *name, int len,
+				    int need_enc, int *nprobes)
+{
+    for (; !ISNULL(chain) ; chain = CXTAIL(chain)) {
+	SEXP val = CXHEAD(chain);
+	(*nprobes)++;
+	if (TYPEOF(val) != CHARSXP) break; /* sanity check */
+	if (need_enc == (ENC_KNOWN(val) | IS_BYTES(val)) &&
+	    LENGTH(val) == len &&  /* quick pretest */
+	    (!len || (memcmp(CHAR(val), name, len) == 0))) // called with len = 0
+	    return val;
+    }
+    return R_NilValue;
+}
+
 /* #define DEBUG_GLOBAL_STRING_HASH 1 */
 
 /* Resize the global R_StringHash CHARSXP cache */
@@ -4286,13 +4703,16 @@ static void reportInvalidString(SEXP cval, int actionWhenInvalid)
 /* mkCharLenCE - make a character (CHARSXP) variable and set its
    encoding bit.  If a CHARSXP with the same string already exists in
    the global CHARSXP cache, R_StringHash, it is returned.  Otherwise,
-   a new CHARSXP is created, added to the cache and then returned. */
+   a new CHARSXP is created, added to the cache and then returned.
+   Like any allocation this may only be done on the main thread: the
+   cache takes no locks, as the readers which would intern strings
+   from worker threads would also need a thread-safe allocator. */
 
 SEXP mkCharLenCE(const char *name, int len, cetype_t enc)
 {
     SEXP cval, chain;
     unsigned int hashcode;
-    int need_enc;
+    int need_enc, nprobes = 0;
     Rboolean embedNul = FALSE, is_ascii = TRUE;
     static int checkValid = -1;
     static int actionWhenInvalid = 0;
@@ -4341,18 +4761,10 @@ SEXP mkCharLenCE(const char *name, int len, cetype_t enc)
     hashcode = char_hash(name, len) & char_hash_mask;
 
     /* Search for a cached value */
-    cval = R_NilValue;
-    chain = VECTOR_ELT(R_StringHash, hashcode);
-    for (; !ISNULL(chain) ; chain = CXTAIL(chain)) {
-	SEXP val = CXHEAD(chain);
-	if (TYPEOF(val) != CHARSXP) break; /* sanity check */
-	if (need_enc == (ENC_KNOWN(val) | IS_BYTES(val)) &&
-	    LENGTH(val) == len &&  /* quick pretest */
-	    (!len || (memcmp(CHAR(val), name, len) == 0))) { // called with len = 0
-	    cval = val;
-	    break;
-	}
-    }
+    cval = findCachedChar(VECTOR_ELT(R_StringHash, hashcode), name, len,
+			  need_enc, &nprobes);
+    char_hash_stats.lookups++;
+    char_hash_stats.probes += nprobes;
     if (cval == R_NilValue) {
 	/* no cached value; need to allocate one and add to the cache */
 	PROTECT(cval = allocCharsxp(len));
@@ -4375,6 +4787,7 @@ SEXP mkCharLenCE(const char *name, int len, cetype_t enc)
 	if (is_ascii) SET_ASCII(cval);
 	SET_CACHED(cval);  /* Mark it */
 	/* add the new value to the cache */
+	char_hash_stats.inserts++;
 	chain = VECTOR_ELT(R_StringHash, hashcode);
 	if (ISNULL(chain))
 	    SET_HASHPRI(R_StringHash, HASHPRI(R_StringHash) + 1);
@@ -4459,6 +4872,41 @@ SEXP mkCharLenCE(const char *name, int len, cetype_t enc)
     return cval;
 }
 
+attribute_hidden SEXP do_stringcachestats(SEXP call, SEXP op, SEXP args,
+					  SEXP rho)
+{
+    checkArity(op, args);
+    int reset = asLogical(CAR(args));
+    if (reset == NA_LOGICAL)
+	error(_("invalid '%s' argument"), "reset");
+
+    double entries = 0, maxchain = 0;
+    for (R_xlen_t i = 0; i < XLENGTH(R_StringHash); i++) {
+	double n = 0;
+	for (SEXP chain = VECTOR_ELT(R_StringHash, i); !ISNULL(chain);
+	     chain = CXTAIL(chain))
+	    n++;
+	entries += n;
+	if (n > maxchain) maxchain = n;
+    }
+
+    const char *nms[] = {"size", "entries", "used.buckets", "max.chain",
+			 "lookups", "mean.probes", "inserts", ""};
+    SEXP ans = PROTECT(mkNamed(REALSXP, nms));
+    REAL(ans)[0] = (double) XLENGTH(R_StringHash);
+    REAL(ans)[1] = entries;
+    REAL(ans)[2] = (double) HASHPRI(R_StringHash);
+    REAL(ans)[3] = maxchain;
+    REAL(ans)[4] = char_hash_stats.lookups;
+    REAL(ans)[5] = char_hash_stats.lookups > 0 ?
+	char_hash_stats.probes / char_hash_stats.lookups : 0;
+    REAL(ans)[6] = char_hash_stats.inserts;
+    if (reset)
+	char_hash_stats.lookups = char_hash_stats.probes =
+	    char_hash_stats.inserts = 0;
+    UNPROTECT(1); /* ans */
+    return ans;
+}
 
 #ifdef DEBUG_SHOW_CHARSXP_CACHE
 /* Call this from gdb with
@@ -117,6 +117,20 @@ static int R_Profiling = 0;
 static pthread_t R_profiled_thread;
 #endif
 
+/* Native profiling also records the C stack, using backtrace(), and
+   symbolizes it in a separate writer thread. */
+#if !defined(Win32) && defined(HAVE_PTHREAD) && defined(HAVE_DLADDR) && \
+    defined(HAVE_DLFCN_H) && defined(__GNUC__) && defined(__has_include)
+# if __has_include(<execinfo.h>)
+#  define R_NATIVE_PROFILING
+#  include <execinfo.h>		/* for backtrace */
+#  include <dlfcn.h>		/* for dladdr */
+#  ifdef RTLD_DL_SYMENT
+#   include <link.h>		/* for ElfW */
+#  endif
+# endif
+#endif
+
 #ifdef Win32
 static FILE *R_ProfileOutfile = NULL;
 #else
@@ -434,6 +448,328 @@ static void pf_int(int num)
 #endif
 }
 
+/* Write the name of the function called in a context. */
+static void pb_fun(profbuf *pb, SEXP fun)
+{
+    if (TYPEOF(fun) == SYMSXP) {
+	pb_str(pb, CHAR(PRINTNAME(fun)));
+
+    } else if ((CAR(fun) == R_DoubleColonSymbol ||
+		CAR(fun) == R_TripleColonSymbol ||
+		CAR(fun) == R_DollarSymbol) &&
+	       TYPEOF(CADR(fun)) == SYMSXP &&
+	       TYPEOF(CADDR(fun)) == SYMSXP) {
+	/* Function accessed via ::, :::, or $. Both args must be
+	   symbols. It is possible to use strings with these
+	   functions, as in "base"::"list", but that's a very rare
+	   case so we won't bother handling it. */
+	pb_str(pb, CHAR(PRINTNAME(CADR(fun))));
+	pb_str(pb, CHAR(PRINTNAME(CAR(fun))));
+	pb_str(pb, CHAR(PRINTNAME(CADDR(fun))));
+    } else if (CAR(fun) == R_Bracket2Symbol &&
+	       TYPEOF(CADR(fun)) == SYMSXP &&
+	       ((TYPEOF(CADDR(fun)) == SYMSXP ||
+		 TYPEOF(CADDR(fun)) == STRSXP ||
+		 TYPEOF(CADDR(fun)) == INTSXP ||
+		 TYPEOF(CADDR(fun)) == REALSXP) &&
+		length(CADDR(fun)) > 0)) {
+	/* Function accessed via [[. The first arg must be a symbol
+	   and the second can be a symbol, string, integer, or
+	   real. */
+	SEXP arg1 = CADR(fun);
+	SEXP arg2 = CADDR(fun);
+
+	pb_str(pb, CHAR(PRINTNAME(arg1)));
+	pb_str(pb, "[[");
+
+	if (TYPEOF(arg2) == SYMSXP) {
+	    pb_str(pb, CHAR(PRINTNAME(arg2)));
+	} else if (TYPEOF(arg2) == STRSXP) {
+	    pb_str(pb, "\"");
+	    pb_str(pb, CHAR(STRING_ELT(arg2, 0)));
+	    pb_str(pb, "\"");
+	} else if (TYPEOF(arg2) == INTSXP) {
+	    pb_int(pb, INTEGER(arg2)[0]);
+	} else if (TYPEOF(arg2) == REALSXP) {
+	    pb_dbl(pb, REAL(arg2)[0]); /* %0.f */
+	}
+
+	pb_str(pb, "]]");
+
+    } else {
+	pb_str(pb, "<Anonymous>");
+    }
+}
+
+#ifdef R_NATIVE_PROFILING
+/* Native profiling.  With Rprof(native = TRUE) each sample records the
+   R call stack together with the C frames called from the innermost
+   evaluation, that is the frames of the builtin, .Call or .External
+   code currently running.  The signal handler does no I/O: it fills a
+   slot of a ring buffer, which a writer thread drains, symbolizes with
+   dladdr and writes out one line per sample in the "collapsed stack"
+   format read by flame graph tools,
+
+       outer;...;inner;Cfun;...;Cleaf 1
+
+   The ring has a single producer, the handler on the profiled thread,
+   and a single consumer, the writer, so it needs no lock: the producer
+   only advances 'head' and the consumer only advances 'tail'.  If the
+   ring is full the sample is dropped and counted. */
+
+#define NPROF_RINGSIZE 256	/* a power of 2 */
+#define NPROF_MAXNATIVE 64
+#define NPROF_RBUFSIZ 4096
+
+typedef struct {
+    int nnative;
+    void *native[NPROF_MAXNATIVE];	/* innermost first */
+    char rstack[NPROF_RBUFSIZ];		/* innermost first, ';' separated */
+} nprof_sample;
+
+static int R_Native_Profiling = 0;
+static nprof_sample *R_NProf_Ring = NULL;
+static unsigned int R_NProf_Head, R_NProf_Tail, R_NProf_Dropped;
+static R_profile_thread_info_t R_NProf_Writer_Info;
+
+/* backtrace() is async-signal-safe once it has been called, which
+   loads and initializes the unwinder: R_InitNativeProfiling does so
+   before the timer is armed.  The frames it returns from the handler
+   start with those of doprof_native and doprof, which are not inlined,
+   and of the signal trampoline; then comes the interrupted
+   instruction, followed by return addresses. */
+#define NPROF_SKIP 3
+
+static void __attribute__((noinline)) doprof_native(void)
+{
+    unsigned int head = __atomic_load_n(&R_NProf_Head, __ATOMIC_RELAXED);
+    unsigned int tail = __atomic_load_n(&R_NProf_Tail, __ATOMIC_ACQUIRE);
+    if (head - tail == NPROF_RINGSIZE) {
+	R_NProf_Dropped++;
+	return;
+    }
+    nprof_sample *s = R_NProf_Ring + (head & (NPROF_RINGSIZE - 1));
+
+    void *frames[NPROF_MAXNATIVE + NPROF_SKIP];
+    int n = backtrace(frames, NPROF_MAXNATIVE + NPROF_SKIP);
+    s->nnative = 0;
+    for (int i = NPROF_SKIP; i < n; i++)
+	/* return addresses may be just past the end of the caller */
+	s->native[s->nnative++] = i == NPROF_SKIP ? frames[i] :
+	    (void *) ((uintptr_t) frames[i] - 1);
+
+    profbuf pb;
+    pb.ptr = s->rstack;
+    pb.left = NPROF_RBUFSIZ;
+    if (R_GC_Profiling && R_gc_running())
+	pb_str(&pb, "<GC>;");
+    for (RCNTXT *cptr = R_GlobalContext;
+	 cptr != NULL;
+	 cptr = findProfContext(cptr)) {
+	if ((cptr->callflag & (CTXT_FUNCTION | CTXT_BUILTIN))
+	    && TYPEOF(cptr->call) == LANGSXP) {
+	    char *start = pb.ptr;
+	    pb_fun(&pb, CAR(cptr->call));
+	    /* ';' separates frames */
+	    for (char *p = start; p < pb.ptr; p++)
+		if (*p == ';') *p = ':';
+	    pb_str(&pb, ";");
+	}
+    }
+    /* frames which do not fit are dropped from the outer end */
+    pb.ptr[0] = '\0';
+
+    __atomic_store_n(&R_NProf_Head, head + 1, __ATOMIC_RELEASE);
+}
+
+static void pb_hex(profbuf *pb, uintptr_t num)
+{
+    char digits[2 * sizeof(uintptr_t)];
+    int i = 0;
+
+    do {
+	digits[i++] = "0123456789abcdef"[num & 0xf];
+	num >>= 4;
+    } while (num);
+    pb_str(pb, "0x");
+    for (i--; i >= 0 && pb->left > 1; i--) {
+	*pb->ptr++ = digits[i];
+	pb->left--;
+    }
+}
+
+/* The exported function containing 'addr', or NULL when it is not
+   exported (dladdr would otherwise report the closest preceding
+   exported symbol) or 'addr' is not in a loaded object. */
+static const char *nprof_symbol(void *addr, Dl_info *info)
+{
+#ifdef RTLD_DL_SYMENT
+    const ElfW(Sym) *sym = NULL;
+    if (! dladdr1(addr, info, (void **) &sym, RTLD_DL_SYMENT)) {
+	info->dli_fname = NULL;
+	return NULL;
+    }
+    if (info->dli_sname && sym && (uintptr_t) addr -
+	(uintptr_t) info->dli_saddr < (uintptr_t) sym->st_size)
+	return info->dli_sname;
+#else
+    if (! dladdr(addr, info)) {
+	info->dli_fname = NULL;
+	return NULL;
+    }
+    return info->dli_sname;
+#endif
+    return NULL;
+}
+
+/* Write the function containing 'addr', or its object file and offset */
+static void pb_native(profbuf *pb, void *addr)
+{
+    Dl_info info;
+    const char *sname = nprof_symbol(addr, &info);
+    if (sname)
+	pb_str(pb, sname);
+    else if (info.dli_fname) {
+	const char *base = strrchr(info.dli_fname, '/');
+	pb_str(pb, base ? base + 1 : info.dli_fname);
+	pb_str(pb, "+");
+	pb_hex(pb, (uintptr_t) addr - (uintptr_t) info.dli_fbase);
+    } else
+	pb_hex(pb, (uintptr_t) addr);
+}
+
+static void nprof_write(nprof_sample *s)
+{
+    char buf[PROFBUFSIZ];
+    profbuf pb;
+    pb.ptr = buf;
+    pb.left = PROFBUFSIZ;
+
+    /* R frames, outermost first */
+    const char *r = s->rstack;
+    size_t end = strlen(r);
+    int first = 1;
+    while (end > 0) {
+	if (r[end - 1] == ';') end--;
+	size_t start = end;
+	while (start > 0 && r[start - 1] != ';') start--;
+	if (end > start) {
+	    if (! first) pb_str(&pb, ";");
+	    first = 0;
+	    if (end - start < pb.left) {
+		memcpy(pb.ptr, r + start, end - start);
+		pb.ptr += end - start;
+		pb.left -= end - start;
+	    } else
+		pb.left = 0;
+	}
+	end = start;
+    }
+    /* the C frames from the innermost eval() outwards run the R frames
+       already written */
+    int nnative = 0;
+    while (nnative < s->nnative) {
+	Dl_info info;
+	const char *sname = nprof_symbol(s->native[nnative], &info);
+	if (sname && ! strcmp(sname, "Rf_eval"))
+	    break;
+	nnative++;
+    }
+    for (int i = nnative - 1; i >= 0; i--) {
+	if (! first) pb_str(&pb, ";");
+	first = 0;
+	pb_native(&pb, s->native[i]);
+    }
+    if (first)
+	pb_str(&pb, "<Toplevel>");
+    pb_str(&pb, " 1\n");
+
+    if (pb.left) {
+	pb.ptr[0] = '\0';
+	pf_str(buf);
+    } else
+	R_Profiling_Error = 3;
+}
+
+static void nprof_drain(void)
+{
+    unsigned int tail = __atomic_load_n(&R_NProf_Tail, __ATOMIC_RELAXED);
+    unsigned int head = __atomic_load_n(&R_NProf_Head, __ATOMIC_ACQUIRE);
+    for (; tail != head; tail++) {
+	nprof_write(R_NProf_Ring + (tail & (NPROF_RINGSIZE - 1)));
+	__atomic_store_n(&R_NProf_Tail, tail + 1, __ATOMIC_RELEASE);
+    }
+}
+
+/* Writer thread main function */
+static void *NativeProfileWriter(void *pinfo)
+{
+    R_profile_thread_info_t *nfo = pinfo;
+
+    pthread_mutex_lock(&nfo->terminate_mu);
+    while(!nfo->should_terminate) {
+	struct timespec until;
+	double duntil_s = currentTime() + nfo->interval_us / 1e6;
+
+	until.tv_sec = (time_t) duntil_s;
+	until.tv_nsec = (long) (1e9 * (duntil_s - until.tv_sec));
+	pthread_cond_timedwait(&nfo->terminate_cv, &nfo->terminate_mu,
+			       &until);
+	pthread_mutex_unlock(&nfo->terminate_mu);
+	nprof_drain();
+	pthread_mutex_lock(&nfo->terminate_mu);
+    }
+    pthread_mutex_unlock(&nfo->terminate_mu);
+    nprof_drain();
+    return NULL;
+}
+
+static void R_InitNativeProfiling(void)
+{
+    R_NProf_Ring = calloc(NPROF_RINGSIZE, sizeof(nprof_sample));
+    if (R_NProf_Ring == NULL) {
+	close(R_ProfileOutfile);
+	R_ProfileOutfile = -1;
+	error(_("Rprof: cannot allocate the native profiling buffer"));
+    }
+    R_NProf_Head = R_NProf_Tail = R_NProf_Dropped = 0;
+
+    /* The first backtrace() may load and initialize the unwinder,
+       which is not safe to do in a signal handler. */
+    void *frames[NPROF_MAXNATIVE];
+    backtrace(frames, NPROF_MAXNATIVE);
+
+    R_profile_thread_info_t *nfo = &R_NProf_Writer_Info;
+    pthread_mutex_init(&nfo->terminate_mu, NULL);
+    pthread_cond_init(&nfo->terminate_cv, NULL);
+    nfo->should_terminate = 0;
+    nfo->interval_us = 100000;
+    sigset_t all, old_set;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old_set);
+    if (pthread_create(&nfo->thread, NULL, NativeProfileWriter, nfo))
+	R_Suicide("unable to create profiling thread");
+    pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+    R_Native_Profiling = 1;
+}
+
+/* Called after the sampling has stopped: write the remaining samples. */
+static void R_EndNativeProfiling(void)
+{
+    R_profile_thread_info_t *nfo = &R_NProf_Writer_Info;
+    pthread_mutex_lock(&nfo->terminate_mu);
+    nfo->should_terminate = 1;
+    pthread_cond_signal(&nfo->terminate_cv);
+    pthread_mutex_unlock(&nfo->terminate_mu);
+    pthread_join(nfo->thread, NULL);
+    pthread_cond_destroy(&nfo->terminate_cv);
+    pthread_mutex_destroy(&nfo->terminate_mu);
+    free(R_NProf_Ring);
+    R_NProf_Ring = NULL;
+    R_Native_Profiling = 0;
+}
+#endif /* R_NATIVE_PROFILING */
+
 static void doprof(int sig)  /* sig is ignored in Windows */
 {
     char buf[PROFBUFSIZ];
@@ -471,6 +807,15 @@ static void doprof(int sig)  /* sig is ignored in Windows */
     }
 #endif /* Win32 */
 
+#ifdef R_NATIVE_PROFILING
+    if (R_Native_Profiling) {
+	doprof_native();
+	signal(SIGPROF, doprof);
+	errno = old_errno;
+	return;
+    }
+#endif
+
     if (R_Mem_Profiling) {
 	get_current_mem(&smallv, &bigv, &nodes);
 	pb_str(&pb, ":");
@@ -497,57 +842,8 @@ static void doprof(int sig)  /* sig is ignored in Windows */
 	if ((cptr->callflag & (CTXT_FUNCTION | CTXT_BUILTIN))
 	    && TYPEOF(cptr->call) == LANGSXP) {
 
-	    SEXP fun = CAR(cptr->call);
 	    pb_str(&pb, "\"");
-
-	    if (TYPEOF(fun) == SYMSXP) {
-		pb_str(&pb, CHAR(PRINTNAME(fun)));
-
-	    } else if ((CAR(fun) == R_DoubleColonSymbol ||
-			CAR(fun) == R_TripleColonSymbol ||
-			CAR(fun) == R_DollarSymbol) &&
-		       TYPEOF(CADR(fun)) == SYMSXP &&
-		       TYPEOF(CADDR(fun)) == SYMSXP) {
-		/* Function accessed via ::, :::, or $. Both args must be
-		   symbols. It is possible to use strings with these
-		   functions, as in "base"::"list", but that's a very rare
-		   case so we won't bother handling it. */
-		pb_str(&pb, CHAR(PRINTNAME(CADR(fun))));
-		pb_str(&pb, CHAR(PRINTNAME(CAR(fun))));
-		pb_str(&pb, CHAR(PRINTNAME(CADDR(fun))));
-	    } else if (CAR(fun) == R_Bracket2Symbol &&
-		       TYPEOF(CADR(fun)) == SYMSXP &&
-		       ((TYPEOF(CADDR(fun)) == SYMSXP ||
-			 TYPEOF(CADDR(fun)) == STRSXP ||
-			 TYPEOF(CADDR(fun)) == INTSXP ||
-			 TYPEOF(CADDR(fun)) == REALSXP) &&
-			length(CADDR(fun)) > 0)) {
-		/* Function accessed via [[. The first arg must be a symbol
-		   and the second can be a symbol, string, integer, or
-		   real. */
-		SEXP arg1 = CADR(fun);
-		SEXP arg2 = CADDR(fun);
-
-		pb_str(&pb, CHAR(PRINTNAME(arg1)));
-		pb_str(&pb, "[[");
-
-		if (TYPEOF(arg2) == SYMSXP) {
-		    pb_str(&pb, CHAR(PRINTNAME(arg2)));
-		} else if (TYPEOF(arg2) == STRSXP) {
-		    pb_str(&pb, "\"");
-		    pb_str(&pb, CHAR(STRING_ELT(arg2, 0)));
-		    pb_str(&pb, "\"");
-		} else if (TYPEOF(arg2) == INTSXP) {
-		    pb_int(&pb, INTEGER(arg2)[0]);
-		} else if (TYPEOF(arg2) == REALSXP) {
-		    pb_dbl(&pb, REAL(arg2)[0]); /* %0.f */
-		}
-
-		pb_str(&pb, "]]");
-
-	    } else {
-		pb_str(&pb, "<Anonymous>");
-	    }
+	    pb_fun(&pb, CAR(cptr->call));
 
 	    pb_str(&pb, "\" ");
 	    if (R_Line_Profiling) {
@@ -667,6 +963,10 @@ static void R_EndProfiling(void)
 	pthread_mutex_destroy(&nfo->terminate_mu);
     }
     signal(SIGPROF, doprof_null);
+# ifdef R_NATIVE_PROFILING
+    if (R_Native_Profiling)
+	R_EndNativeProfiling();
+# endif
     if(R_ProfileOutfile >= 0) close(R_ProfileOutfile);
     R_ProfileOutfile = -1;
 #endif /* not Win32 */
@@ -684,12 +984,21 @@ static void R_EndProfiling(void)
 	    warning(_("source files skipped by Rprof; please increase '%s'"),
 		      R_Profiling_Error == 1 ? "numfiles" : "bufsize");
     }
+#ifdef R_NATIVE_PROFILING
+    if (R_NProf_Dropped) {
+	unsigned int dropped = R_NProf_Dropped;
+	R_NProf_Dropped = 0;
+	warning(_("%u samples dropped by Rprof as the native profiling buffer was full"),
+		dropped);
+    }
+#endif
 }
 
 static void R_InitProfiling(SEXP filename, int append, double dinterval,
 			    int mem_profiling, int gc_profiling,
 			    int line_profiling, int filter_callframes,
-			    int numfiles, int bufsize, rpe_type event)
+			    int numfiles, int bufsize, rpe_type event,
+			    int native)
 {
 #ifndef Win32
     const void *vmax = vmaxget();
@@ -721,15 +1030,18 @@ static void R_InitProfiling(SEXP filename, int append, double dinterval,
     int interval;
 
     interval = (int)(1e6 * dinterval + 0.5);
-    if(mem_profiling)
-	pf_str("memory profiling: ");
-    if(gc_profiling)
-	pf_str("GC profiling: ");
-    if(line_profiling)
-	pf_str("line profiling: ");
-    pf_str("sample.interval=");
-    pf_int(interval); /* %d */
-    pf_str("\n");
+    /* the collapsed stack format of native profiling has no header */
+    if (!native) {
+	if(mem_profiling)
+	    pf_str("memory profiling: ");
+	if(gc_profiling)
+	    pf_str("GC profiling: ");
+	if(line_profiling)
+	    pf_str("line profiling: ");
+	pf_str("sample.interval=");
+	pf_int(interval); /* %d */
+	pf_str("\n");
+    }
 
     R_Mem_Profiling=mem_profiling;
     if (mem_profiling)
@@ -779,6 +1091,11 @@ static void R_InitProfiling(SEXP filename, int append, double dinterval,
     }
 # endif
 
+# ifdef R_NATIVE_PROFILING
+    if (native)
+	R_InitNativeProfiling();
+# endif
+
     signal(SIGPROF, doprof);
 
     if (R_Profiling_Event == RPE_ELAPSED) {
@@ -847,7 +1164,7 @@ SEXP do_Rprof(SEXP args)
 {
     SEXP filename;
     int append_mode, mem_profiling, gc_profiling, line_profiling,
-	filter_callframes;
+	filter_callframes, native;
     double dinterval;
     int numfiles, bufsize;
     const char *event_arg;
@@ -878,6 +1195,17 @@ SEXP do_Rprof(SEXP args)
         || STRING_ELT(CAR(args), 0) == NA_STRING)
 	error(_("invalid '%s' argument"), "event");
     event_arg = translateChar(STRING_ELT(CAR(args), 0));
+					      args = CDR(args);
+    native = asLogical(CAR(args));
+    if (native == NA_LOGICAL)
+	error(_("invalid '%s' argument"), "native");
+#ifdef R_NATIVE_PROFILING
+    if (native && (mem_profiling || line_profiling))
+	error(_("native profiling cannot be combined with memory or line profiling"));
+#else
+    if (native)
+	error(_("native profiling is not supported on this platform"));
+#endif
 #ifdef Win32
     if (streql(event_arg, "elapsed") || streql(event_arg, "default"))
 	event = RPE_ELAPSED;
@@ -910,7 +1238,7 @@ SEXP do_Rprof(SEXP args)
     if (LENGTH(filename))
 	R_InitProfiling(filename, append_mode, dinterval, mem_profiling,
 			gc_profiling, line_profiling, filter_callframes,
-			numfiles, bufsize, event);
+			numfiles, bufsize, event, native);
     else
 	R_EndProfiling();
     return R_NilValue;
@@ -1544,6 +1872,7 @@ static int JIT_score(SEXP e)
 #define STRATEGY_ALL_SMALL_MAYBE 2
 #define STRATEGY_NO_SCORE 3
 #define STRATEGY_NO_CACHE 4
+#define STRATEGY_HOT 5
 /* max strategy index is hardcoded in R_CheckJIT */
 
 /*
@@ -1566,10 +1895,40 @@ static int JIT_score(SEXP e)
           2nd time seen if top-level, never otherwise
       functions with high score compiled
           1st time seen if top-level, 2nd time seen otherwise
+
+  HOT
+      functions are compiled when the number of calls plus the number
+          of loop iterations run by the AST interpreter in their frames
+          reaches JIT_HOT_THRESHOLD; the score is not used
+      no operand type feedback is recorded for recompilation: the
+          arithmetic, comparison and subsetting instructions already
+          test for unboxed double and integer scalars first, which is
+          all a specialized variant for the common case could do
 */
 
 static int jit_strategy = -1;
 
+/* Hotness counters for the HOT strategy, in a direct mapped table
+   indexed by the address of the closure.  The closure is only compared
+   against and not protected: if it is collected and its address
+   reused, or on a collision, the count is restarted. */
+#define JIT_HOT_SIZE 1024
+#define JIT_HOT_INDEX(fun)						\
+    ((int) ((((uintptr_t) (fun)) >> 4 ^ ((uintptr_t) (fun)) >> 14) &	\
+	    (JIT_HOT_SIZE - 1)))
+static int JIT_HOT_THRESHOLD = 100;
+static struct { SEXP fun; unsigned int calls, backedges; } jit_hot[JIT_HOT_SIZE];
+
+static R_INLINE int jit_hot_slot(SEXP fun)
+{
+    int i = JIT_HOT_INDEX(fun);
+    if (jit_hot[i].fun != fun) {
+	jit_hot[i].fun = fun;
+	jit_hot[i].calls = jit_hot[i].backedges = 0;
+    }
+    return i;
+}
+
 static R_INLINE Rboolean R_CheckJIT(SEXP fun)
 {
     /* to help with testing */
@@ -1580,7 +1939,7 @@ static R_INLINE Rboolean R_CheckJIT(SEXP fun)
 	char *valstr = getenv("R_JIT_STRATEGY");
 	if (valstr != NULL)
 	    val = atoi(valstr);
-	if (val < 0 || val > 4)
+	if (val < 0 || val > 5)
 	    jit_strategy = dflt;
 	else
 	    jit_strategy = val;
@@ -1588,6 +1947,10 @@ static R_INLINE Rboolean R_CheckJIT(SEXP fun)
 	valstr = getenv("R_MIN_JIT_SCORE");
 	if (valstr != NULL)
 	    MIN_JIT_SCORE = atoi(valstr);
+
+	valstr = getenv("R_JIT_HOT_THRESHOLD");
+	if (valstr != NULL && atoi(valstr) > 0)
+	    JIT_HOT_THRESHOLD = atoi(valstr);
     }
 
     SEXP body = BODY(fun);
@@ -1595,6 +1958,13 @@ static R_INLINE Rboolean R_CheckJIT(SEXP fun)
     if (R_jit_enabled > 0 && TYPEOF(body) != BCODESXP &&
 	! R_disable_bytecode && ! NOJIT(fun)) {
 
+	if (jit_strategy == STRATEGY_HOT) {
+	    int i = jit_hot_slot(fun);
+	    jit_hot[i].calls++;
+	    return jit_hot[i].calls + jit_hot[i].backedges >=
+		(unsigned int) JIT_HOT_THRESHOLD;
+	}
+
 	if (MAYBEJIT(fun)) {
 	    /* function marked as MAYBEJIT the first time now seen
 	       twice, so go ahead and compile */
@@ -1637,6 +2007,25 @@ static R_INLINE Rboolean R_CheckJIT(SEXP fun)
     return FALSE;
 }
 
+/* Returns the back edge counter to be incremented by a loop run by the
+   AST interpreter in rho, or NULL if the HOT strategy is not in use or
+   rho is not the frame of a closure call. */
+static unsigned int *jit_backedge_counter(SEXP rho)
+{
+    if (jit_strategy != STRATEGY_HOT || R_jit_enabled <= 0)
+	return NULL;
+    for (RCNTXT *cptr = R_GlobalContext;
+	 cptr != NULL && cptr->callflag != CTXT_TOPLEVEL;
+	 cptr = cptr->nextcontext)
+	if ((cptr->callflag & CTXT_FUNCTION) && cptr->cloenv == rho) {
+	    SEXP fun = cptr->callfun;
+	    if (TYPEOF(fun) == CLOSXP && TYPEOF(BODY(fun)) != BCODESXP)
+		return &jit_hot[jit_hot_slot(fun)].backedges;
+	    break;
+	}
+    return NULL;
+}
+
 #ifdef DEBUG_JIT
 # define PRINT_JIT_INFO							\
     REprintf("JIT cache hits: %lu; env: %lu; body %lu\n",		\
@@ -1687,6 +2076,15 @@ static R_INLINE SEXP make_cached_cmpenv(SEXP fun)
 	for (SEXP env = cmpenv; env != top; env = CDR(env)) {
 	    if (IS_STANDARD_UNHASHED_FRAME(env))
 		cmpenv_enter_frame(FRAME(env), newenv);
+	    else if (R_IsOpenFrame(env)) {
+		/* no chains to walk in an open-addressing table */
+		SEXP names = R_lsInternal3(env, TRUE, FALSE);
+		PROTECT(names);
+		for (R_xlen_t i = 0; i < XLENGTH(names); i++)
+		    defineVar(installTrChar(STRING_ELT(names, i)),
+			      R_NilValue, newenv);
+		UNPROTECT(1); /* names */
+	    }
 	    else if (IS_STANDARD_HASHED_FRAME(env)) {
 		SEXP h = HASHTAB(env);
 		int n = length(h);
@@ -2814,6 +3212,7 @@ attribute_hidden SEXP do_for(SEXP call, SEXP op, SEXP args, SEXP rho)
 
     PROTECT_WITH_INDEX(v = R_NilValue, &vpi);
 
+    unsigned int *hot = jit_backedge_counter(rho);
     begincontext(&cntxt, CTXT_LOOP, R_NilValue, rho, R_BaseEnv, R_NilValue,
 		 R_NilValue);
     switch (SETJMP(cntxt.cjmpbuf)) {
@@ -2882,7 +3281,7 @@ attribute_hidden SEXP do_for(SEXP call, SEXP op, SEXP args, SEXP rho)
 	eval(body, rho);
 
     for_next:
-	; /* needed for strict ISO C compliance, according to gcc 2.95.2 */
+	if (hot != NULL) (*hot)++;
     }
  for_break:
     endcontext(&cntxt);
@@ -2912,6 +3311,7 @@ attribute_hidden SEXP do_while(SEXP call, SEXP op, SEXP args, SEXP rho)
     body = CADR(args);
     bgn = BodyHasBraces(body);
 
+    unsigned int *hot = jit_backedge_counter(rho);
     begincontext(&cntxt, CTXT_LOOP, R_NilValue, rho, R_BaseEnv, R_NilValue,
 		 R_NilValue);
     if (SETJMP(cntxt.cjmpbuf) != CTXT_BREAK) {
@@ -2920,6 +3320,7 @@ attribute_hidden SEXP do_while(SEXP call, SEXP op, SEXP args, SEXP rho)
 	    int condl = asLogicalNoNA(cond, call, rho);
 	    UNPROTECT(1);
 	    if (!condl) break;
+	    if (hot != NULL) (*hot)++;
 	    if (RDEBUG(rho) && !bgn && !R_GlobalContext->browserfinish) {
 		SrcrefPrompt("debug", R_Srcref);
 		PrintValue(body);
@@ -2957,10 +3358,12 @@ attribute_hidden SEXP do_repeat(SEXP call, SEXP op, SEXP args, SEXP rho)
 
     body = CAR(args);
 
+    unsigned int *hot = jit_backedge_counter(rho);
     begincontext(&cntxt, CTXT_LOOP, R_NilValue, rho, R_BaseEnv, R_NilValue,
 		 R_NilValue);
     if (SETJMP(cntxt.cjmpbuf) != CTXT_BREAK) {
 	for (;;) {
+	    if (hot != NULL) (*hot)++;
 	    eval(body, rho);
 	}
     }
@@ -4924,6 +5327,28 @@ static R_INLINE R_bcstack_t *bcStackScalarReal(R_bcstack_t *s, R_bcstack_t *v)
     return v;
 }
 
+/* Arithmetic and comparison treat logical scalars as integers;
+   NA_LOGICAL and NA_INTEGER are the same value. */
+static R_INLINE R_bcstack_t *bcStackScalarNum(R_bcstack_t *s, R_bcstack_t *v)
+{
+    R_bcstack_t *x = bcStackScalar(s, v);
+    if (x->tag == LGLSXP) {
+	v->tag = INTSXP;
+	v->u.ival = x->u.ival;
+	return v;
+    }
+    return x;
+}
+
+static R_INLINE int bcStackScalarLogical(R_bcstack_t *v)
+{
+    switch (v->tag) {
+    case LGLSXP: return v->u.ival;
+    case INTSXP: return INTEGER_TO_LOGICAL(v->u.ival);
+    default: return ISNAN(v->u.dval) ? NA_LOGICAL : v->u.dval != 0;
+    }
+}
+
 #define DO_FAST_RELOP2(op,a,b) do { \
     SKIP_OP(); \
     SETSTACK_LOGICAL(-2, ((a) op (b)) ? TRUE : FALSE);	\
@@ -4944,8 +5369,8 @@ static R_INLINE R_bcstack_t *bcStackScalarReal(R_bcstack_t *s, R_bcstack_t *v)
 
 #define FastRelop2(op,opval,opsym) do {					\
 	R_bcstack_t vvx, vvy;						\
-	R_bcstack_t *vx = bcStackScalar(R_BCNodeStackTop - 2, &vvx);	\
-	R_bcstack_t *vy = bcStackScalar(R_BCNodeStackTop - 1, &vvy);	\
+	R_bcstack_t *vx = bcStackScalarNum(R_BCNodeStackTop - 2, &vvx); \
+	R_bcstack_t *vy = bcStackScalarNum(R_BCNodeStackTop - 1, &vvy); \
 	if (vx->tag == REALSXP && ! ISNAN(vx->u.dval)) {		\
 	    if (vy->tag == REALSXP && ! ISNAN(vy->u.dval))		\
 		DO_FAST_RELOP2(op, vx->u.dval, vy->u.dval);		\
@@ -4959,12 +5384,39 @@ static R_INLINE R_bcstack_t *bcStackScalarReal(R_bcstack_t *s, R_bcstack_t *v)
 		DO_FAST_RELOP2(op, vx->u.ival, vy->u.ival);		\
 	    }								\
 	}								\
+	if (vx->tag != 0 && vy->tag != 0) {				\
+	    /* numeric scalars, at least one NA or NaN */		\
+	    SKIP_OP();							\
+	    SETSTACK_LOGICAL(-2, NA_LOGICAL);				\
+	    R_BCNodeStackTop--;						\
+	    R_Visible = TRUE;						\
+	    NEXT();							\
+	}								\
 	Relop2(opval, opsym);						\
     } while (0)
 
-/* not actually optimized yet; ignore op, opval for now */
-#define FastLogic2(op, opval, opsym) do {		\
-	Builtin2(do_logic, opsym, rho);		\
+/* three-valued scalar & and | */
+#define R_AND3(x, y)							\
+    ((x) == FALSE || (y) == FALSE ? FALSE :				\
+     (x) == NA_LOGICAL || (y) == NA_LOGICAL ? NA_LOGICAL : TRUE)
+#define R_OR3(x, y)							\
+    ((x) == TRUE || (y) == TRUE ? TRUE :				\
+     (x) == NA_LOGICAL || (y) == NA_LOGICAL ? NA_LOGICAL : FALSE)
+
+#define FastLogic2(fun, opsym) do {					\
+	R_bcstack_t vvx, vvy;						\
+	R_bcstack_t *vx = bcStackScalar(R_BCNodeStackTop - 2, &vvx);	\
+	R_bcstack_t *vy = bcStackScalar(R_BCNodeStackTop - 1, &vvy);	\
+	if (vx->tag != 0 && vy->tag != 0) {				\
+	    int lx = bcStackScalarLogical(vx);				\
+	    int ly = bcStackScalarLogical(vy);				\
+	    SKIP_OP();							\
+	    SETSTACK_LOGICAL(-2, fun(lx, ly));				\
+	    R_BCNodeStackTop--;						\
+	    R_Visible = TRUE;						\
+	    NEXT();							\
+	}								\
+	Builtin2(do_logic, opsym, rho);					\
     } while (0)
 
 static R_INLINE SEXP getPrimitive(SEXP symbol, SEXPTYPE type)
@@ -5131,18 +5583,27 @@ static SEXP cmp_arith2(SEXP call, int opval, SEXP opsym, SEXP x, SEXP y,
 	}						\
     } while(0)
 
+#define DO_FAST_BINOP_INT_NA() do {		\
+	SKIP_OP();				\
+	SETSTACK_INTEGER(-2, NA_INTEGER);	\
+	R_BCNodeStackTop--;			\
+	R_Visible = TRUE;			\
+	NEXT();					\
+    } while (0)
+
 #define FastUnary(op, opsym) do {					\
 	R_bcstack_t vvx;						\
-	R_bcstack_t *vx = bcStackScalar(R_BCNodeStackTop - 1, &vvx);	\
+	R_bcstack_t *vx = bcStackScalarNum(R_BCNodeStackTop - 1, &vvx); \
 	if (vx->tag == REALSXP) {					\
 	    SKIP_OP();							\
 	    SETSTACK_REAL(-1, op vx->u.dval);				\
 	    R_Visible = TRUE;						\
 	    NEXT();							\
 	}								\
-	else if (vx->tag == INTSXP && vx->u.ival != NA_INTEGER) {	\
+	else if (vx->tag == INTSXP) {					\
+	    int ival = vx->u.ival;					\
 	    SKIP_OP();							\
-	    SETSTACK_INTEGER(-1, op vx->u.ival);			\
+	    SETSTACK_INTEGER(-1, ival == NA_INTEGER ? NA_INTEGER : op ival); \
 	    R_Visible = TRUE;						\
 	    NEXT();							\
 	}								\
@@ -5157,21 +5618,28 @@ static SEXP cmp_arith2(SEXP call, int opval, SEXP opsym, SEXP x, SEXP y,
 		DO_FAST_BINOP(op, sx->u.dval, sy->u.dval);		\
 	}								\
 	R_bcstack_t vvx, vvy;						\
-	R_bcstack_t *vx = bcStackScalar(R_BCNodeStackTop - 2, &vvx);	\
-	R_bcstack_t *vy = bcStackScalar(R_BCNodeStackTop - 1, &vvy);	\
+	R_bcstack_t *vx = bcStackScalarNum(R_BCNodeStackTop - 2, &vvx); \
+	R_bcstack_t *vy = bcStackScalarNum(R_BCNodeStackTop - 1, &vvy); \
 	if (vx->tag == REALSXP) {					\
 	    if (vy->tag == REALSXP)					\
 		DO_FAST_BINOP(op, vx->u.dval, vy->u.dval);		\
-	    else if (vy->tag == INTSXP && vy->u.ival != NA_INTEGER)	\
-		DO_FAST_BINOP(op, vx->u.dval, vy->u.ival);		\
+	    else if (vy->tag == INTSXP)					\
+		DO_FAST_BINOP(op, vx->u.dval, INTEGER_TO_REAL(vy->u.ival)); \
 	}								\
-	else if (vx->tag == INTSXP && vx->u.ival != NA_INTEGER) {	\
+	else if (vx->tag == INTSXP) {					\
 	    int ix = vx->u.ival;					\
 	    if (vy->tag == REALSXP)					\
-		DO_FAST_BINOP(op, ix, vy->u.dval);			\
-	    else if (vy->tag == INTSXP && vy->u.ival != NA_INTEGER) {	\
+		DO_FAST_BINOP(op, INTEGER_TO_REAL(ix), vy->u.dval);	\
+	    else if (vy->tag == INTSXP) {				\
 		int iy = vy->u.ival;					\
-		if (opval == DIVOP || opval == POWOP)			\
+		if (opval == DIVOP)					\
+		    DO_FAST_BINOP(op, INTEGER_TO_REAL(ix),		\
+				  INTEGER_TO_REAL(iy));			\
+		else if (ix == NA_INTEGER || iy == NA_INTEGER) {	\
+		    if (opval != POWOP)					\
+			DO_FAST_BINOP_INT_NA();				\
+		}							\
+		else if (opval == POWOP)				\
 		    DO_FAST_BINOP(op, (double) ix, (double) iy);	\
 		else							\
 		    DO_FAST_BINOP_INT(op, ix, iy);			\
@@ -5785,17 +6253,205 @@ static R_INLINE SEXP FIND_VAR_NO_CACHE(SEXP symbol, SEXP rho, SEXP cell)
     else return R_GetVarLocValue(loc);
 }
 
+/* Lookup caches for variables and functions found in enclosing
+   environments.  Unlike the binding cache these persist across calls:
+   for each constant pool entry of a byte code object the binding cell
+   found by a search from the enclosure of the frame is recorded,
+   together with that enclosure and the value of R_BindingEpoch at the
+   time.  A recorded cell can be used as long as the enclosure and the
+   epoch match and the cell is still bound; envir.c increments the
+   epoch whenever a new binding might hide a recorded one.  Variable
+   and function lookups of the same symbol are recorded separately.
+
+   The caches are kept in a direct mapped table indexed by the address
+   of the byte code object, like the JIT cache; a collision replaces
+   the older entry.  Each entry is a list of the byte code object, a
+   list with the enclosure and cell for each of the two kinds of
+   lookup of each constant, and a numeric vector of the epochs. */
+
+#define LOOKUP_CACHE_SIZE 1024
+#define LOOKUP_CACHE_INDEX(body)					\
+    ((int) ((((uintptr_t) (body)) >> 4 ^ ((uintptr_t) (body)) >> 14) &	\
+	    (LOOKUP_CACHE_SIZE - 1)))
+#define LOOKUP_VAR 0
+#define LOOKUP_FUN 1
+
+static SEXP LookupCacheTable = NULL;
+
+static struct {
+    double var_hits, var_misses, fun_hits, fun_misses;
+    R_size_t epoch0;
+} lookup_cache_stats;
+
+static R_INLINE SEXP lookup_cache_entry(SEXP body)
+{
+    if (LookupCacheTable != NULL) {
+	SEXP entry = VECTOR_ELT(LookupCacheTable, LOOKUP_CACHE_INDEX(body));
+	if (entry != R_NilValue && VECTOR_ELT(entry, 0) == body)
+	    return entry;
+    }
+    return R_NilValue;
+}
+
+static R_INLINE SEXP GET_LOOKUP_CACHE_CELL(SEXP body, SEXP enclos,
+					   int sidx, int kind)
+{
+    SEXP entry = lookup_cache_entry(body);
+    if (entry != R_NilValue) {
+	R_xlen_t i = 2 * (R_xlen_t) sidx + kind;
+	SEXP slots = VECTOR_ELT(entry, 1);
+	if (VECTOR_ELT(slots, 2 * i) == enclos &&
+	    REAL(VECTOR_ELT(entry, 2))[i] == (double) R_BindingEpoch)
+	    return VECTOR_ELT(slots, 2 * i + 1);
+    }
+    return R_NilValue;
+}
+
+static void SET_LOOKUP_CACHE_CELL(SEXP body, SEXP enclos, int sidx,
+				  int kind, SEXP cell)
+{
+    SEXP entry = lookup_cache_entry(body);
+    if (entry == R_NilValue) {
+	PROTECT(cell);
+	if (LookupCacheTable == NULL)
+	    R_PreserveObject(LookupCacheTable =
+			     allocVector(VECSXP, LOOKUP_CACHE_SIZE));
+	R_xlen_t n = BCCONSTS_LEN(body);
+	PROTECT(entry = allocVector(VECSXP, 3));
+	SET_VECTOR_ELT(entry, 0, body);
+	SET_VECTOR_ELT(entry, 1, allocVector(VECSXP, 4 * n));
+	SEXP epochs = allocVector(REALSXP, 2 * n);
+	for (R_xlen_t i = 0; i < 2 * n; i++)
+	    REAL(epochs)[i] = 0; /* the epoch starts at 1 */
+	SET_VECTOR_ELT(entry, 2, epochs);
+	SET_VECTOR_ELT(LookupCacheTable, LOOKUP_CACHE_INDEX(body), entry);
+	UNPROTECT(2); /* entry, cell */
+    }
+    R_xlen_t i = 2 * (R_xlen_t) sidx + kind;
+    SEXP slots = VECTOR_ELT(entry, 1);
+    SET_VECTOR_ELT(slots, 2 * i, enclos);
+    SET_VECTOR_ELT(slots, 2 * i + 1, cell);
+    REAL(VECTOR_ELT(entry, 2))[i] = (double) R_BindingEpoch;
+}
+
+/* Recorded cells are binding cells or, for bindings in base, symbols */
+static R_INLINE SEXP LOOKUP_CACHE_VALUE(SEXP cell)
+{
+    return TYPEOF(cell) == SYMSXP ? SYMVALUE(cell) : BINDING_VALUE(cell);
+}
+
+/* TRUE if there certainly is no binding for symbol in the frame of rho */
+static R_INLINE Rboolean UNBOUND_IN_FRAME(SEXP symbol, SEXP rho)
+{
+    return rho != R_BaseEnv && rho != R_BaseNamespace &&
+	! IS_USER_DATABASE(rho) &&
+	R_VARLOC_IS_NULL(R_findVarLocInFrame(rho, symbol));
+}
+
+/* Find the value of a variable not bound in the frame of rho */
+static SEXP FIND_ENCLOS_VAR(SEXP symbol, SEXP rho, SEXP body, int sidx)
+{
+    SEXP enclos = ENCLOS(rho);
+    SEXP cell = GET_LOOKUP_CACHE_CELL(body, enclos, sidx, LOOKUP_VAR);
+    if (cell != R_NilValue) {
+	SEXP value = LOOKUP_CACHE_VALUE(cell);
+	if (value != R_UnboundValue) {
+	    lookup_cache_stats.var_hits++;
+	    return value;
+	}
+    }
+    lookup_cache_stats.var_misses++;
+    cell = R_findVarLocForCache(symbol, enclos, FALSE);
+    if (cell == R_NilValue)
+	return R_findVar(symbol, enclos);
+    SET_LOOKUP_CACHE_CELL(body, enclos, sidx, LOOKUP_VAR, cell);
+    return LOOKUP_CACHE_VALUE(cell);
+}
+
+/* findFun variant using the lookup cache */
+static SEXP findFunEX(SEXP symbol, SEXP rho, SEXP body, int sidx)
+{
+    if (! UNBOUND_IN_FRAME(symbol, rho))
+	return findFun(symbol, rho);
+
+    SEXP enclos = ENCLOS(rho);
+    SEXP cell = GET_LOOKUP_CACHE_CELL(body, enclos, sidx, LOOKUP_FUN);
+    if (cell != R_NilValue) {
+	SEXP value = LOOKUP_CACHE_VALUE(cell);
+	if (TYPEOF(value) == PROMSXP && PROMISE_IS_EVALUATED(value))
+	    value = PRVALUE(value);
+	if (isFunction(value)) {
+	    lookup_cache_stats.fun_hits++;
+	    return value;
+	}
+    }
+    lookup_cache_stats.fun_misses++;
+    /* find first, as this may force a promise */
+    SEXP value = PROTECT(findFun(symbol, enclos));
+    cell = R_findVarLocForCache(symbol, enclos, TRUE);
+    if (cell != R_NilValue)
+	SET_LOOKUP_CACHE_CELL(body, enclos, sidx, LOOKUP_FUN, cell);
+    UNPROTECT(1); /* value */
+    return value;
+}
+
+attribute_hidden SEXP do_lookupcachestats(SEXP call, SEXP op, SEXP args,
+					  SEXP rho)
+{
+    checkArity(op, args);
+    int reset = asLogical(CAR(args));
+    if (reset == NA_LOGICAL)
+	error(_("invalid '%s' argument"), "reset");
+
+    const char *nms[] = {"var.hits", "var.misses", "fun.hits", "fun.misses",
+			 "invalidations", ""};
+    SEXP ans = PROTECT(mkNamed(REALSXP, nms));
+    REAL(ans)[0] = lookup_cache_stats.var_hits;
+    REAL(ans)[1] = lookup_cache_stats.var_misses;
+    REAL(ans)[2] = lookup_cache_stats.fun_hits;
+    REAL(ans)[3] = lookup_cache_stats.fun_misses;
+    REAL(ans)[4] = (double) (R_BindingEpoch - 1 - lookup_cache_stats.epoch0);
+    if (reset) {
+	lookup_cache_stats.var_hits = lookup_cache_stats.var_misses = 0;
+	lookup_cache_stats.fun_hits = lookup_cache_stats.fun_misses = 0;
+	lookup_cache_stats.epoch0 = R_BindingEpoch - 1;
+    }
+    UNPROTECT(1); /* ans */
+    return ans;
+}
+
+/* .Internal(jitProfile(f)): the hotness counts of closure f */
+attribute_hidden SEXP do_jitprofile(SEXP call, SEXP op, SEXP args, SEXP rho)
+{
+    checkArity(op, args);
+    SEXP fun = CAR(args);
+    if (TYPEOF(fun) != CLOSXP)
+	error(_("argument is not a function"));
+
+    const char *nms[] = {"calls", "backedges", ""};
+    SEXP ans = PROTECT(mkNamed(VECSXP, nms));
+    int i = JIT_HOT_INDEX(fun);
+    Rboolean found = jit_hot[i].fun == fun;
+    SET_VECTOR_ELT(ans, 0, ScalarReal(found ? jit_hot[i].calls : 0));
+    SET_VECTOR_ELT(ans, 1, ScalarReal(found ? jit_hot[i].backedges : 0));
+    UNPROTECT(1); /* ans */
+    return ans;
+}
+
 /* findVar variant that handles dd vars and cached bindings */
 static R_INLINE SEXP findVarEX(SEXP symbol, SEXP rho, Rboolean dd,
-			       R_binding_cache_t vcache, int sidx)
+			       R_binding_cache_t vcache, int sidx, SEXP body)
 {
     if (dd)
 	return ddfindVar(symbol, rho);
     else if (vcache != NULL) {
 	SEXP cell = GET_BINDING_CELL_CACHE(symbol, rho, vcache, sidx);
 	SEXP value = BINDING_VALUE(cell);
-	if (value == R_UnboundValue)
+	if (value == R_UnboundValue) {
+	    if (cell == R_NilValue && UNBOUND_IN_FRAME(symbol, rho))
+		return FIND_ENCLOS_VAR(symbol, rho, body, sidx);
 	    return FIND_VAR_NO_CACHE(symbol, rho, cell);
+	}
 	else
 	    return value;
     }
@@ -5814,9 +6470,9 @@ static R_INLINE SEXP findVarEX(SEXP symbol, SEXP rho, Rboolean dd,
 
 static R_INLINE SEXP getvar(SEXP symbol, SEXP rho,
 			    Rboolean dd, Rboolean keepmiss,
-			    R_binding_cache_t vcache, int sidx)
+			    R_binding_cache_t vcache, int sidx, SEXP body)
 {
-    SEXP value = findVarEX(symbol, rho, dd, vcache, sidx);
+    SEXP value = findVarEX(symbol, rho, dd, vcache, sidx, body);
 
     if (value == R_UnboundValue)
 	UNBOUND_VARIABLE_ERROR(symbol, rho);
@@ -5928,7 +6584,7 @@ static R_INLINE SEXP getvar(SEXP symbol, SEXP rho,
 	}								\
     }									\
     SEXP symbol = GETCONST(constants, sidx);				\
-    SEXP value = findVarEX(symbol, rho, dd, vcache, sidx);		\
+    SEXP value = findVarEX(symbol, rho, dd, vcache, sidx, body);	\
     if (! keepmiss && TYPEOF(value) == PROMSXP &&			\
 	! PRSEEN(value) && ! PROMISE_IS_EVALUATED(value) &&		\
 	TYPEOF(PRCODE(value)) == BCODESXP) {				\
@@ -5936,7 +6592,7 @@ static R_INLINE SEXP getvar(SEXP symbol, SEXP rho,
 	NEXT();								\
 	/* return cleanup is in DO_GETVAR_FORCE_PROMISE_RETURN */	\
     }									\
-    BCNPUSH(getvar(symbol, rho, dd, keepmiss, vcache, sidx));		\
+    BCNPUSH(getvar(symbol, rho, dd, keepmiss, vcache, sidx, body));	\
     NEXT();								\
 } while (0)
 #else
@@ -5944,7 +6600,7 @@ static R_INLINE SEXP getvar(SEXP symbol, SEXP rho,
   int sidx = GETOP(); \
   SEXP symbol = GETCONST(constants, sidx); \
   R_Visible = TRUE; \
-  BCNPUSH(getvar(symbol, rho, dd, keepmiss, vcache, sidx));	\
+  BCNPUSH(getvar(symbol, rho, dd, keepmiss, vcache, sidx, body)); \
   NEXT(); \
 } while (0)
 #endif
@@ -7888,8 +8544,9 @@ static SEXP bcEval_loop(struct bcEval_locals *ploc)
     OP(GETFUN, 1):
       {
 	/* get the function */
-	SEXP symbol = GETCONST(constants, GETOP());
-	SEXP value = findFun(symbol, rho);
+	int sidx = GETOP();
+	SEXP symbol = GETCONST(constants, sidx);
+	SEXP value = findFunEX(symbol, rho, body, sidx);
 	INIT_CALL_FRAME(value);
 	if(RTRACE(value)) {
 	  Rprintf("trace: ");
@@ -8175,8 +8832,8 @@ static SEXP bcEval_loop(struct bcEval_locals *ploc)
     OP(LE, 1): FastRelop2(<=, LEOP, R_LeSym);
     OP(GE, 1): FastRelop2(>=, GEOP, R_GeSym);
     OP(GT, 1): FastRelop2(>, GTOP, R_GtSym);
-    OP(AND, 1): FastLogic2(&, ANDOP, R_AndSym);
-    OP(OR, 1): FastLogic2(|, OROP, R_OrSym);
+    OP(AND, 1): FastLogic2(R_AND3, R_AndSym);
+    OP(OR, 1): FastLogic2(R_OR3, R_OrSym);
     OP(NOT, 1):
       {
 	  R_Visible = TRUE;
@@ -8417,7 +9074,8 @@ static SEXP bcEval_loop(struct bcEval_locals *ploc)
 	SET_ASSIGNMENT_PENDING(loc.cell, TRUE);
 	BCNPUSH(loc.cell);
 
-	SEXP value = getvar(symbol, ENCLOS(rho), FALSE, FALSE, NULL, 0);
+	SEXP value = getvar(symbol, ENCLOS(rho), FALSE, FALSE, NULL, 0,
+			    R_NilValue);
 	if (maybe_in_assign || MAYBE_SHARED(value))
 	    value = shallow_duplicate(value);
 	BCNPUSH(value);
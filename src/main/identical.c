@@ -230,19 +230,19 @@ R_compute_identical(SEXP x, SEXP y, int flags)
     case LGLSXP:
 	if (XLENGTH(x) != XLENGTH(y)) return FALSE;
 	/* Use memcmp (which is ISO C90) to speed up the comparison */
-	return memcmp((void *)LOGICAL(x), (void *)LOGICAL(y),
+	return memcmp(LOGICAL_RO(x), LOGICAL_RO(y),
 		      xlength(x) * sizeof(int)) == 0 ? TRUE : FALSE;
     case INTSXP:
 	if (XLENGTH(x) != XLENGTH(y)) return FALSE;
 	/* Use memcmp (which is ISO C90) to speed up the comparison */
-	return memcmp((void *)INTEGER(x), (void *)INTEGER(y),
+	return memcmp(INTEGER_RO(x), INTEGER_RO(y),
 		      xlength(x) * sizeof(int)) == 0 ? TRUE : FALSE;
     case REALSXP:
     {
 	R_xlen_t n = XLENGTH(x);
 	if(n != XLENGTH(y)) return FALSE;
 	else {
-	    double *xp = REAL(x), *yp = REAL(y);
+	    const double *xp = REAL_RO(x), *yp = REAL_RO(y);
 	    int ne_strict = NUM_EQ | (SINGLE_NA << 1);
 	    for(R_xlen_t i = 0; i < n; i++)
 		if(neWithNaN(xp[i], yp[i], ne_strict)) return FALSE;
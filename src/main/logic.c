@@ -414,11 +414,46 @@ static SEXP binaryLogic2(int code, SEXP s1, SEXP s2)
 #define _OP_ALL 1
 #define _OP_ANY 2
 
+#define CHECK_BLOCK 65536
+
 static int checkValues(int op, int na_rm, SEXP x, R_xlen_t n)
 {
     R_xlen_t i;
     int has_na = 0;
     int *px = LOGICAL(x);
+#ifdef _OPENMP
+    /* With options(summary.threads) above one, long vectors are scanned
+       a block at a time by several threads, which stop once any of them
+       has found a deciding value.  The answer does not depend on where
+       that is, so it is the same as below. */
+    int nthreads = R_SummaryThreads;
+    if (nthreads > 1 && n > CHECK_BLOCK && !ALTREP(x)) {
+	R_xlen_t nb = (n + CHECK_BLOCK - 1) / CHECK_BLOCK;
+	int decided = 0, decider = op == _OP_ANY ? TRUE : FALSE;
+#pragma omp parallel for num_threads(nthreads) schedule(dynamic) \
+    reduction(|:has_na) shared(decided)
+	for (R_xlen_t b = 0; b < nb; b++) {
+	    int done;
+#pragma omp atomic read
+	    done = decided;
+	    if (done) continue;
+	    R_xlen_t end = b < nb - 1 ? (b + 1) * CHECK_BLOCK : n;
+	    for (R_xlen_t j = b * CHECK_BLOCK; j < end; j++) {
+		int xj = px[j];
+		if (xj == NA_LOGICAL) {
+		    if (!na_rm) has_na = 1;
+		}
+		else if (xj == decider) {
+#pragma omp atomic write
+		    decided = 1;
+		    break;
+		}
+	    }
+	}
+	if (decided) return decider;
+	n = 0; /* fall through to the result for no deciding value */
+    }
+#endif
     for (i = 0; i < n; i++) {
 //	if ((i+1) % NINTERRUPT == 0) R_CheckUserInterrupt();
 	int xi = px[i];
@@ -438,6 +473,7 @@ static int checkValues(int op, int na_rm, SEXP x, R_xlen_t n)
     }
     return NA_LOGICAL; /* -Wall */
 }
+#undef CHECK_BLOCK
 
 /* all, any */
 attribute_hidden SEXP do_logic3(SEXP call, SEXP op, SEXP args, SEXP env)
@@ -977,6 +977,7 @@ void setup_Rmainloop(void)
     InitGraphics();
     InitTypeTables(); /* must be before InitS3DefaultTypes */
     InitS3DefaultTypes();
+    InitAttribIndex();
     PrintDefaults();
     R_InitConditions();
 
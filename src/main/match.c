@@ -175,6 +175,123 @@ attribute_hidden SEXP matchArgExact(SEXP tag, SEXP * list)
 #define SET_ARGUSED(x,v) SETLEVELS(x,v)
 
 
+/* Argument matching cache.  The result of matching depends only on the
+   tags of the formals, the tags of the supplied arguments and on
+   which supplied arguments are empty, so for a call site that keeps
+   calling the same closure with the same argument shape the matching
+   can be recorded once and replayed.  The cache is a direct mapped
+   table indexed by the addresses of the call and the formals.  An
+   entry records, for each formal, the position of the supplied
+   argument matched to it, or -1, and for each supplied argument its
+   ARGUSED value; arguments not used go to '...'.
+
+   Only matches made by exact tags and by position are recorded:
+   partial matching may signal a warning, and empty arguments can be
+   matched both by tag and by position.  The formals are kept alive by
+   the table so that their address identifies them; the call is only
+   compared against. */
+
+#define MATCH_CACHE_SIZE 1024
+#define MATCH_CACHE_MAXARGS 16
+#define MATCH_CACHE_INDEX(call, formals)				\
+    ((int) ((((uintptr_t) (call)) >> 4 ^ ((uintptr_t) (formals)) >> 6) &	\
+	    (MATCH_CACHE_SIZE - 1)))
+
+static struct {
+    SEXP call, formals;
+    int nformals, nsupplied, dots;
+    SEXP tags[MATCH_CACHE_MAXARGS];
+    signed char source[MATCH_CACHE_MAXARGS];
+    unsigned char used[MATCH_CACHE_MAXARGS];
+} match_cache[MATCH_CACHE_SIZE];
+
+static SEXP MatchCacheFormals = NULL;
+
+/* Returns the matched arguments, or NULL if there is no usable entry */
+static SEXP matchArgsCached(SEXP formals, SEXP supplied, SEXP call)
+{
+    int k = MATCH_CACHE_INDEX(call, formals);
+    if (match_cache[k].call != call || match_cache[k].formals != formals)
+	return NULL;
+
+    int nf = match_cache[k].nformals, ns = match_cache[k].nsupplied;
+    int dots = match_cache[k].dots, nunused = 0;
+    SEXP vals[MATCH_CACHE_MAXARGS];
+    signed char source[MATCH_CACHE_MAXARGS];
+    int n = 0;
+    for (SEXP b = supplied; b != R_NilValue; b = CDR(b), n++) {
+	if (n == ns || TAG(b) != match_cache[k].tags[n] ||
+	    CAR(b) == R_MissingArg)
+	    return NULL;
+	vals[n] = CAR(b);
+	SET_ARGUSED(b, match_cache[k].used[n]);
+	if (! match_cache[k].used[n]) nunused++;
+    }
+    if (n != ns)
+	return NULL;
+    /* copy, as a finalizer run by an allocation below could replace
+       the entry */
+    memcpy(source, match_cache[k].source, nf);
+
+    SEXP dotsval = R_MissingArg;
+    if (nunused) {
+	SEXP d = dotsval = allocList(nunused);
+	SET_TYPEOF(dotsval, DOTSXP);
+	for (SEXP b = supplied; b != R_NilValue; b = CDR(b))
+	    if (! ARGUSED(b)) {
+		SETCAR(d, CAR(b));
+		SET_TAG(d, TAG(b));
+		d = CDR(d);
+	    }
+    }
+    PROTECT(dotsval);
+
+    SEXP actuals = R_NilValue;
+    for (int i = nf - 1; i >= 0; i--) {
+	if (i == dots) {
+	    actuals = CONS_NR(dotsval, actuals);
+	    SET_MISSING(actuals, 0);
+	}
+	else if (source[i] >= 0) {
+	    actuals = CONS_NR(vals[source[i]], actuals);
+	    SET_MISSING(actuals, 0);
+	}
+	else {
+	    actuals = CONS_NR(R_MissingArg, actuals);
+	    SET_MISSING(actuals, 1);
+	}
+    }
+    UNPROTECT(1); /* dotsval */
+    return actuals;
+}
+
+static void matchArgsRecord(SEXP formals, SEXP supplied, SEXP call,
+			    int nf, const int *source, int dots)
+{
+    int ns = 0;
+    for (SEXP b = supplied; b != R_NilValue; b = CDR(b), ns++)
+	if (ns == MATCH_CACHE_MAXARGS || CAR(b) == R_MissingArg)
+	    return;
+
+    if (MatchCacheFormals == NULL)
+	R_PreserveObject(MatchCacheFormals =
+			 allocVector(VECSXP, MATCH_CACHE_SIZE));
+    int k = MATCH_CACHE_INDEX(call, formals);
+    SET_VECTOR_ELT(MatchCacheFormals, k, formals);
+    match_cache[k].call = call;
+    match_cache[k].formals = formals;
+    match_cache[k].nformals = nf;
+    match_cache[k].nsupplied = ns;
+    match_cache[k].dots = dots;
+    for (int i = 0; i < nf; i++)
+	match_cache[k].source[i] = (signed char) source[i];
+    int n = 0;
+    for (SEXP b = supplied; b != R_NilValue; b = CDR(b), n++) {
+	match_cache[k].tags[n] = TAG(b);
+	match_cache[k].used[n] = (unsigned char) ARGUSED(b);
+    }
+}
+
 /* We need to leave 'supplied' unchanged in case we call UseMethod */
 /* MULTIPLE_MATCHES was added by RI in Jan 2005 but never activated:
    code in R-2-8-branch */
@@ -187,6 +304,10 @@ attribute_hidden SEXP matchArgs_NR(SEXP formals, SEXP supplied, SEXP call)
     int i, arg_i = 0;
     SEXP f, a, b, dots, actuals;
 
+    actuals = matchArgsCached(formals, supplied, call);
+    if (actuals != NULL)
+	return actuals;
+
     actuals = R_NilValue;
     for (f = formals ; f != R_NilValue ; f = CDR(f), arg_i++) {
 	/* CONS_NR is used since argument lists created here are only
@@ -205,6 +326,12 @@ attribute_hidden SEXP matchArgs_NR(SEXP formals, SEXP supplied, SEXP call)
      */
     int fargused[arg_i ? arg_i : 1]; // avoid undefined behaviour
     memset(fargused, 0, sizeof(fargused));
+    /* for the cache: the position of the supplied argument matched to
+       each formal */
+    int nformals = arg_i;
+    int fsource[arg_i ? arg_i : 1];
+    for (i = 0; i < nformals; i++) fsource[i] = -1;
+    Rboolean cacheable = nformals <= MATCH_CACHE_MAXARGS;
 
     for(b = supplied; b != R_NilValue; b = CDR(b)) SET_ARGUSED(b, 0);
 
@@ -238,6 +365,7 @@ attribute_hidden SEXP matchArgs_NR(SEXP formals, SEXP supplied, SEXP call)
 		      if(CAR(b) != R_MissingArg) SET_MISSING(a, 0);
 		      SET_ARGUSED(b, 2);
 		      fargused[arg_i] = 2;
+		      fsource[arg_i] = i - 1;
 		  }
 	      }
 	    }
@@ -286,6 +414,7 @@ attribute_hidden SEXP matchArgs_NR(SEXP formals, SEXP supplied, SEXP call)
 			if (CAR(b) != R_MissingArg) SET_MISSING(a, 0);
 			SET_ARGUSED(b, 1);
 			fargused[arg_i] = 1;
+			cacheable = FALSE;
 		    }
 		}
 	    }
@@ -306,6 +435,8 @@ attribute_hidden SEXP matchArgs_NR(SEXP formals, SEXP supplied, SEXP call)
     a = actuals;
     b = supplied;
     seendots = FALSE;
+    arg_i = 0;
+    i = 0;
 
     while (f != R_NilValue && b != R_NilValue && !seendots) {
 	if (TAG(f) == R_DotsSymbol) {
@@ -313,11 +444,13 @@ attribute_hidden SEXP matchArgs_NR(SEXP formals, SEXP supplied, SEXP call)
 	    seendots = TRUE;
 	    f = CDR(f);
 	    a = CDR(a);
+	    arg_i++;
 	} else if (CAR(a) != R_MissingArg) {
 	    /* Already matched by tag */
 	    /* skip to next formal */
 	    f = CDR(f);
 	    a = CDR(a);
+	    arg_i++;
 	} else if (ARGUSED(b) || TAG(b) != R_NilValue) {
 	    /* This value used or tagged , skip to next value */
 	    /* The second test above is needed because we */
@@ -325,14 +458,18 @@ attribute_hidden SEXP matchArgs_NR(SEXP formals, SEXP supplied, SEXP call)
 	    /* matches. */
 	    /* The formal being considered remains the same */
 	    b = CDR(b);
+	    i++;
 	} else {
 	    /* We have a positional match */
 	    SETCAR(a, CAR(b));
 	    if(CAR(b) != R_MissingArg) SET_MISSING(a, 0);
 	    SET_ARGUSED(b, 1);
+	    fsource[arg_i] = i;
 	    b = CDR(b);
 	    f = CDR(f);
 	    a = CDR(a);
+	    arg_i++;
+	    i++;
 	}
     }
 
@@ -381,6 +518,15 @@ attribute_hidden SEXP matchArgs_NR(SEXP formals, SEXP supplied, SEXP call)
 		      strchr(CHAR(asChar(deparse1line(unused, 0))), '('));
 	}
     }
+    if (cacheable) {
+	int dots_i = -1;
+	for (f = formals, arg_i = 0; f != R_NilValue; f = CDR(f), arg_i++)
+	    if (TAG(f) == R_DotsSymbol && fargused[arg_i] == 0) {
+		dots_i = arg_i;
+		break;
+	    }
+	matchArgsRecord(formals, supplied, call, nformals, fsource, dots_i);
+    }
     UNPROTECT(1);
     return(actuals);
 }
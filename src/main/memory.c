@@ -226,6 +226,15 @@ const char *sexptype2char(SEXPTYPE type) {
 #define GC_TORTURE
 
 static int gc_pending = 0;
+/* what asks for the next collection: allocation, gc(full = FALSE), or
+   a full collection by gc() or when memory is exhausted */
+#define GC_REQUEST_ALLOC 0
+#define GC_REQUEST_LITE  1
+#define GC_REQUEST_FULL  2
+static int gc_request = GC_REQUEST_ALLOC;
+/* countdown of allocations to the next step of an incremental cycle */
+static int gc_inc_wait = 0;
+#define GC_INC_STEP_DUE (gc_inc_wait > 0 && --gc_inc_wait == 0)
 #ifdef GC_TORTURE
 /* **** if the user specified a wait before starting to force
    **** collections it might make sense to also wait before starting
@@ -233,9 +242,11 @@ static int gc_pending = 0;
 static int gc_force_wait = 0;
 static int gc_force_gap = 0;
 static Rboolean gc_inhibit_release = FALSE;
-#define FORCE_GC (gc_pending || (gc_force_wait > 0 ? (--gc_force_wait > 0 ? 0 : (gc_force_wait = gc_force_gap, 1)) : 0))
+#define GC_TORTURE_ACTIVE (gc_force_gap > 0)
+#define FORCE_GC (gc_pending || GC_INC_STEP_DUE || (gc_force_wait > 0 ? (--gc_force_wait > 0 ? 0 : (gc_force_wait = gc_force_gap, 1)) : 0))
 #else
-# define FORCE_GC gc_pending
+# define FORCE_GC (gc_pending || GC_INC_STEP_DUE)
+# define GC_TORTURE_ACTIVE FALSE
 #endif
 
 #ifdef R_MEMORY_PROFILING
@@ -243,6 +254,17 @@ static void R_ReportAllocation(R_size_t);
 static void R_ReportNewPage(void);
 #endif
 
+/* The sampling allocation profiler takes a sample when the countdown
+   of allocated bytes drops below zero; it stays near INT64_MAX when
+   the profiler is off, so each allocation only costs a subtraction
+   and a test. */
+static int64_t R_MemSampleCountdown = INT64_MAX;
+static void R_SampleAllocation(SEXPTYPE, R_size_t);
+#define MEM_SAMPLE(type, bytes) do {					\
+	if ((R_MemSampleCountdown -= (int64_t) (bytes)) < 0)		\
+	    R_SampleAllocation(type, bytes);				\
+    } while (0)
+
 #define GC_PROT(X) do { \
     int __wait__ = gc_force_wait; \
     int __gap__ = gc_force_gap;			   \
@@ -564,6 +586,32 @@ static int num_old_gens_to_collect = 0;
 static int gen_gc_counts[NUM_OLD_GENERATIONS + 1];
 static int collect_counts[NUM_OLD_GENERATIONS];
 
+/* Collector statistics reported by gc.stats().  Pauses are measured
+   in wall clock time; bin i of the pause histogram counts pauses
+   shorter than gc_pause_breaks[i] seconds, the last bin the rest. */
+#define GC_PAUSE_BINS 10
+static const double gc_pause_breaks[GC_PAUSE_BINS - 1] =
+    { 1e-4, 3e-4, 1e-3, 3e-3, 1e-2, 3e-2, 1e-1, 3e-1, 1 };
+static struct {
+    double collections[NUM_OLD_GENERATIONS + 1];
+    double pause_time[NUM_OLD_GENERATIONS + 1];
+    double max_pause[NUM_OLD_GENERATIONS + 1];
+    double pause_hist[GC_PAUSE_BINS];
+    double promoted, promoted_bytes, promoted_large, promoted_large_bytes;
+    double large_alloc, large_alloc_bytes;
+    double large_release, large_release_bytes;
+    double nsize_grow, nsize_shrink, vsize_grow, vsize_shrink;
+    double nodes_freed, nodes_base; /* allocations are freed + in use - base */
+} gc_stats;
+
+static void gc_record_pause(double pause)
+{
+    int i = 0;
+    while (i < GC_PAUSE_BINS - 1 && pause >= gc_pause_breaks[i])
+	i++;
+    gc_stats.pause_hist[i]++;
+}
+
 
 /* Node Pages.  Non-vector nodes and small vector nodes are allocated
    from fixed size pages.  The pages for each node class are kept in a
@@ -1049,15 +1097,21 @@ static void ReleasePage(PAGE_HEADER *page, int node_class)
     free(page);
 }
 
-static void TryToReleasePages(void)
+/* Release unused pages.  With a deadline (after an incremental cycle)
+   the time is checked every GC_RELEASE_CHECK_PAGES pages, and when it
+   has passed the remaining pages are left to the next collection. */
+#define GC_RELEASE_CHECK_PAGES 64
+
+static void TryToReleasePages(double deadline)
 {
     SEXP s;
-    int i;
+    int i, checked = 0;
+    Rboolean out_of_time = FALSE;
     static int release_count = 0;
 
     if (release_count == 0) {
 	release_count = R_PageReleaseFreq;
-	for (i = 0; i < NUM_SMALL_NODE_CLASSES; i++) {
+	for (i = 0; i < NUM_SMALL_NODE_CLASSES && ! out_of_time; i++) {
 	    PAGE_HEADER *page, *last, *next;
 	    int node_size = NODE_SIZE(i);
 	    int page_count = (R_PAGE_SIZE - sizeof(PAGE_HEADER)) / node_size;
@@ -1094,6 +1148,12 @@ static void TryToReleasePages(void)
 		}
 		else last = page;
 		page = next;
+		if (deadline > 0 && ++checked % GC_RELEASE_CHECK_PAGES == 0 &&
+		    currentTime() > deadline) {
+		    release_count = 0;
+		    out_of_time = TRUE;
+		    break;
+		}
 	    }
 	    DEBUG_RELEASE_PRINT(rel_pages, maxrel_pages, i);
 	    R_GenHeap[i].Free = NEXT_NODE(R_GenHeap[i].New);
@@ -1102,34 +1162,31 @@ static void TryToReleasePages(void)
     else release_count--;
 }
 
-/* compute size in VEC units so result will fit in LENGTH field for FREESXPs */
-static R_INLINE R_size_t getVecSizeInVEC(SEXP s)
+/* size in VEC units of a vector of length len with the type of s */
+static R_INLINE R_size_t vecSizeInVEC(SEXP s, R_xlen_t len)
 {
-    if (IS_GROWABLE(s))
-	SET_STDVEC_LENGTH(s, XTRUELENGTH(s));
-
     R_size_t size;
     switch (TYPEOF(s)) {	/* get size in bytes */
     case CHARSXP:
-	size = XLENGTH(s) + 1;
+	size = len + 1;
 	break;
     case RAWSXP:
-	size = XLENGTH(s);
+	size = len;
 	break;
     case LGLSXP:
     case INTSXP:
-	size = XLENGTH(s) * sizeof(int);
+	size = len * sizeof(int);
 	break;
     case REALSXP:
-	size = XLENGTH(s) * sizeof(double);
+	size = len * sizeof(double);
 	break;
     case CPLXSXP:
-	size = XLENGTH(s) * sizeof(Rcomplex);
+	size = len * sizeof(Rcomplex);
 	break;
     case STRSXP:
     case EXPRSXP:
     case VECSXP:
-	size = XLENGTH(s) * sizeof(SEXP);
+	size = len * sizeof(SEXP);
 	break;
     default:
 	register_bad_sexp_type(s, __LINE__);
@@ -1138,6 +1195,200 @@ static R_INLINE R_size_t getVecSizeInVEC(SEXP s)
     return BYTE2VEC(size);
 }
 
+/* Record a node surviving its first collection, by its node class. */
+static void RecordPromotion(SEXP s)
+{
+    int cls = NODE_CLASS(s);
+    gc_stats.promoted++;
+    if (cls < NUM_SMALL_NODE_CLASSES)
+	gc_stats.promoted_bytes += NODE_SIZE(cls);
+    else {
+	/* the node is live, so do not use getVecSizeInVEC */
+	R_xlen_t len = IS_GROWABLE(s) ? XTRUELENGTH(s) : XLENGTH(s);
+	double bytes = sizeof(SEXPREC_ALIGN) +
+	    (double) vecSizeInVEC(s, len) * sizeof(VECREC);
+	gc_stats.promoted_bytes += bytes;
+	gc_stats.promoted_large++;
+	gc_stats.promoted_large_bytes += bytes;
+    }
+}
+
+/* compute size in VEC units so result will fit in LENGTH field for FREESXPs */
+static R_INLINE R_size_t getVecSizeInVEC(SEXP s)
+{
+    if (IS_GROWABLE(s))
+	SET_STDVEC_LENGTH(s, XTRUELENGTH(s));
+
+    return vecSizeInVEC(s, XLENGTH(s));
+}
+
+/* Large Vector Arena.  When the environment variable R_GC_LARGE_ARENA
+   is set to a positive number of megabytes at start-up, vectors at
+   least that large are not obtained from malloc but mapped from the
+   system in page-aligned size classes, four per doubling, so repeated
+   allocations of similar sizes do not fragment the malloc heap.
+   Released blocks are kept on a free list per class for reuse, with
+   all but their first page returned to the system by madvise, and
+   blocks unused for LARGE_ARENA_MAX_IDLE full collections are
+   unmapped.  Whether a large vector is in the arena is decided by its
+   size in VEC units, which is the same when it is allocated and when
+   it is released. */
+
+#ifndef Win32
+# include <sys/mman.h>
+# include <unistd.h>
+# if defined(MADV_DONTNEED) && !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#  define MAP_ANONYMOUS MAP_ANON
+# endif
+# if defined(MADV_DONTNEED) && defined(MAP_ANONYMOUS)
+#  define LARGE_VECTOR_ARENA
+# endif
+#endif
+
+static R_size_t R_LargeArenaMinVEC = 0; /* 0: the arena is not used */
+
+static struct {
+    double in_use, retained, reused, advised, unmapped;
+} arena_stats;
+
+#ifdef LARGE_VECTOR_ARENA
+#define ARENA_CLASSES_PER_DOUBLING 4
+#define ARENA_NUM_CLASSES (ARENA_CLASSES_PER_DOUBLING * 64)
+#define LARGE_ARENA_MAX_IDLE 2
+
+/* header written into the first page of free blocks */
+typedef struct arena_block {
+    struct arena_block *next;
+    size_t size;
+    int idle;
+} arena_block;
+
+static size_t arena_page_size = 4096;
+static arena_block *arena_free_blocks[ARENA_NUM_CLASSES];
+
+/* Find the size class for a block of at least bytes bytes. Classes
+   with n pages, 2^e <= n < 2^(e+1), are multiples of 2^(e-2) pages. */
+static int arena_class(size_t bytes, size_t *psize)
+{
+    size_t np = (bytes + arena_page_size - 1) / arena_page_size;
+    int e = 0;
+    while ((np >> (e + 1)) != 0)
+	e++;
+    if (e < 2) {
+	*psize = np * arena_page_size;
+	return (int) np;
+    }
+    size_t step = (size_t) 1 << (e - 2);
+    size_t k = (np + step - 1) / step;
+    if (k == 2 * ARENA_CLASSES_PER_DOUBLING) {
+	e++;
+	step *= 2;
+	k = ARENA_CLASSES_PER_DOUBLING;
+    }
+    *psize = k * step * arena_page_size;
+    return e * ARENA_CLASSES_PER_DOUBLING + (int) k - ARENA_CLASSES_PER_DOUBLING;
+}
+
+static void *arena_alloc(size_t bytes)
+{
+    size_t size;
+    int c = arena_class(bytes, &size);
+    arena_block *b = arena_free_blocks[c];
+    if (b != NULL) {
+	arena_free_blocks[c] = b->next;
+	arena_stats.retained -= size;
+	arena_stats.reused++;
+    }
+    else {
+	void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+	    return NULL;
+	b = p;
+    }
+    arena_stats.in_use += size;
+    return b;
+}
+
+static void arena_release(void *p, size_t bytes)
+{
+    size_t size;
+    int c = arena_class(bytes, &size);
+    arena_block *b = p;
+    arena_stats.in_use -= size;
+    if (size > arena_page_size &&
+	madvise((char *) p + arena_page_size, size - arena_page_size,
+		MADV_DONTNEED) == 0)
+	arena_stats.advised += size - arena_page_size;
+    b->size = size;
+    b->idle = 0;
+    b->next = arena_free_blocks[c];
+    arena_free_blocks[c] = b;
+    arena_stats.retained += size;
+}
+
+/* Called after full collections: unmap blocks that stayed unused. */
+static void ReleaseIdleArenaBlocks(void)
+{
+    for (int c = 0; c < ARENA_NUM_CLASSES; c++) {
+	arena_block **pb = &arena_free_blocks[c];
+	while (*pb != NULL) {
+	    arena_block *b = *pb;
+	    if (++b->idle > LARGE_ARENA_MAX_IDLE) {
+		size_t size = b->size;
+		*pb = b->next;
+		munmap(b, size);
+		arena_stats.retained -= size;
+		arena_stats.unmapped += size;
+	    }
+	    else pb = &b->next;
+	}
+    }
+}
+#else
+#define ReleaseIdleArenaBlocks() do { } while (0)
+#endif
+
+/* size is in VEC units and does not include the header */
+static R_INLINE void *large_vector_malloc(R_size_t size)
+{
+    size_t bytes = sizeof(SEXPREC_ALIGN) + size * sizeof(VECREC);
+#ifdef LARGE_VECTOR_ARENA
+    if (R_LargeArenaMinVEC > 0 && size >= R_LargeArenaMinVEC)
+	return arena_alloc(bytes);
+#endif
+    return malloc(bytes);
+}
+
+static R_INLINE void large_vector_free(void *p, R_size_t size)
+{
+#ifdef LARGE_VECTOR_ARENA
+    if (R_LargeArenaMinVEC > 0 && size >= R_LargeArenaMinVEC) {
+	arena_release(p, sizeof(SEXPREC_ALIGN) + size * sizeof(VECREC));
+	return;
+    }
+#endif
+    free(p);
+}
+
+static void init_gc_large_arena(void)
+{
+#ifdef LARGE_VECTOR_ARENA
+    char *arg = getenv("R_GC_LARGE_ARENA");
+    if (arg != NULL) {
+	double mb = R_atof(arg);
+	if (mb > 0 && R_FINITE(mb)) {
+	    R_LargeArenaMinVEC = (R_size_t) BYTE2VEC(mb * Mega);
+	    if (R_LargeArenaMinVEC < 1)
+		R_LargeArenaMinVEC = 1;
+	    long ps = sysconf(_SC_PAGESIZE);
+	    if (ps > 0)
+		arena_page_size = (size_t) ps;
+	}
+    }
+#endif
+}
+
 static void custom_node_free(void *ptr);
 
 static void ReleaseLargeFreeVectors(void)
@@ -1162,9 +1413,12 @@ static void ReleaseLargeFreeVectors(void)
 #endif
 		UNSNAP_NODE(s);
 		R_GenHeap[node_class].AllocCount--;
+		gc_stats.large_release++;
+		gc_stats.large_release_bytes +=
+		    sizeof(SEXPREC_ALIGN) + (double) size * sizeof(VECREC);
 		if (node_class == LARGE_NODE_CLASS) {
 		    R_LargeVallocSize -= size;
-		    free(s);
+		    large_vector_free(s, size);
 		} else {
 		    custom_node_free(s);
 		}
@@ -1185,6 +1439,7 @@ static void AdjustHeapSize(R_size_t size_needed)
 	+ size_needed + R_MinVFree;
     double node_occup = ((double) NNeeded) / R_NSize;
     double vect_occup =	((double) VNeeded) / R_VSize;
+    R_size_t old_NSize = R_NSize, old_VSize = R_VSize;
 
     if (node_occup > R_NGrowFrac) {
 	R_size_t change =
@@ -1232,6 +1487,11 @@ static void AdjustHeapSize(R_size_t size_needed)
 	    R_VSize = orig_R_VSize;
     }
 
+    if (R_NSize > old_NSize) gc_stats.nsize_grow++;
+    else if (R_NSize < old_NSize) gc_stats.nsize_shrink++;
+    if (R_VSize > old_VSize) gc_stats.vsize_grow++;
+    else if (R_VSize < old_VSize) gc_stats.vsize_shrink++;
+
     DEBUG_ADJUST_HEAP_PRINT(node_occup, vect_occup);
 }
 
@@ -1244,8 +1504,10 @@ static void AdjustHeapSize(R_size_t size_needed)
   if (an__n__ && NODE_GEN_IS_YOUNGER(an__n__, an__g__)) { \
     if (NODE_IS_MARKED(an__n__)) \
        R_GenHeap[NODE_CLASS(an__n__)].OldCount[NODE_GENERATION(an__n__)]--; \
-    else \
+    else { \
       MARK_NODE(an__n__); \
+      RecordPromotion(an__n__); \
+    } \
     SET_NODE_GENERATION(an__n__, an__g__); \
     UNSNAP_NODE(an__n__); \
     SET_NEXT_NODE(an__n__, forwarded_nodes); \
@@ -1678,84 +1940,13 @@ attribute_hidden SEXP do_regFinaliz(SEXP call, SEXP op, SEXP args, SEXP rho)
     } \
 } while (0)
 
-static int RunGenCollect(R_size_t size_needed)
+/* Mark the roots and add them to the forwarding list */
+static void ForwardRoots(SEXP *pforwarded_nodes)
 {
-    int i, gen, gens_collected;
+    int i;
     RCNTXT *ctxt;
-    SEXP s;
-    SEXP forwarded_nodes;
-
-    bad_sexp_type_seen = 0;
-
-    /* determine number of generations to collect */
-    while (num_old_gens_to_collect < NUM_OLD_GENERATIONS) {
-	if (collect_counts[num_old_gens_to_collect]-- <= 0) {
-	    collect_counts[num_old_gens_to_collect] =
-		collect_counts_max[num_old_gens_to_collect];
-	    num_old_gens_to_collect++;
-	}
-	else break;
-    }
-
-#ifdef PROTECTCHECK
-    num_old_gens_to_collect = NUM_OLD_GENERATIONS;
-#endif
-
- again:
-    gens_collected = num_old_gens_to_collect;
-
-#ifndef EXPEL_OLD_TO_NEW
-    /* eliminate old-to-new references in generations to collect by
-       transferring referenced nodes to referring generation */
-    for (gen = 0; gen < num_old_gens_to_collect; gen++) {
-	for (i = 0; i < NUM_NODE_CLASSES; i++) {
-	    s = NEXT_NODE(R_GenHeap[i].OldToNew[gen]);
-	    while (s != R_GenHeap[i].OldToNew[gen]) {
-		SEXP next = NEXT_NODE(s);
-		DO_CHILDREN(s, AgeNodeAndChildren, gen);
-		UNSNAP_NODE(s);
-		if (NODE_GENERATION(s) != gen)
-		    gc_error("****snapping into wrong generation\n");
-		SNAP_NODE(s, R_GenHeap[i].Old[gen]);
-		s = next;
-	    }
-	}
-    }
-#endif
-
-    DEBUG_CHECK_NODE_COUNTS("at start");
-
-    /* unmark all marked nodes in old generations to be collected and
-       move to New space */
-    for (gen = 0; gen < num_old_gens_to_collect; gen++) {
-	for (i = 0; i < NUM_NODE_CLASSES; i++) {
-	    R_GenHeap[i].OldCount[gen] = 0;
-	    s = NEXT_NODE(R_GenHeap[i].Old[gen]);
-	    while (s != R_GenHeap[i].Old[gen]) {
-		SEXP next = NEXT_NODE(s);
-		if (gen < NUM_OLD_GENERATIONS - 1)
-		    SET_NODE_GENERATION(s, gen + 1);
-		UNMARK_NODE(s);
-		s = next;
-	    }
-	    if (NEXT_NODE(R_GenHeap[i].Old[gen]) != R_GenHeap[i].Old[gen])
-		BULK_MOVE(R_GenHeap[i].Old[gen], R_GenHeap[i].New);
-	}
-    }
-
-    forwarded_nodes = NULL;
-
-#ifndef EXPEL_OLD_TO_NEW
-    /* scan nodes in uncollected old generations with old-to-new pointers */
-    for (gen = num_old_gens_to_collect; gen < NUM_OLD_GENERATIONS; gen++)
-	for (i = 0; i < NUM_NODE_CLASSES; i++)
-	    for (s = NEXT_NODE(R_GenHeap[i].OldToNew[gen]);
-		 s != R_GenHeap[i].OldToNew[gen];
-		 s = NEXT_NODE(s))
-		FORWARD_CHILDREN(s);
-#endif
+    SEXP forwarded_nodes = *pforwarded_nodes;
 
-    /* forward all roots */
     FORWARD_NODE(R_NilValue);	           /* Builtin constants */
     FORWARD_NODE(NA_STRING);
     FORWARD_NODE(R_BlankString);
@@ -1786,7 +1977,7 @@ static int RunGenCollect(R_size_t size_needed)
     FORWARD_NODE(R_print.na_string_noquote);
 
     if (R_SymbolTable != NULL)             /* in case of GC during startup */
-	for (i = 0; i < HSIZE; i++) {      /* Symbol table */
+	for (i = 0; i < R_SymbolTableSize; i++) { /* Symbol table */
 	    FORWARD_NODE(R_SymbolTable[i]);
 	    SEXP s;
 	    for (s = R_SymbolTable[i]; s != R_NilValue; s = CDR(s))
@@ -1836,9 +2027,726 @@ static int RunGenCollect(R_size_t size_needed)
 	    FORWARD_NODE(sp->u.sxpval);
     }
 
+    *pforwarded_nodes = forwarded_nodes;
+}
+
+/* Parallel Marking.  For full collections of large heaps the main
+   processing loop can be shared among several OpenMP threads.  Marker
+   threads claim a node by atomically setting its mark bit and then
+   scan its children, but they never touch the node lists: claimed
+   nodes are appended to a shared array, which serves both as the work
+   queue (entries before 'scan' have been processed) and as the record
+   of nodes that have to be moved to their old generation lists once
+   marking is complete.  That move, and the processing of weak
+   references, finalizers and the CHARSXP cache, is done serially as
+   before.  Threads take and publish work in batches to keep the
+   shared state in one critical section cheap.
+
+   The number of marker threads is taken from the environment
+   variable R_GC_MARK_THREADS at startup; the default of one thread
+   uses the serial code only.  The array is sized by the number of
+   nodes in use; if it cannot be allocated the serial code is used,
+   and if it overflows the remaining marked nodes are recovered by a
+   scan of the New lists. */
+
+#if defined(_OPENMP) && !defined(PROTECTCHECK)
+# define GC_PARALLEL_MARK
+#endif
+
+static int R_GCMarkThreads = 1;
+#define GC_MARK_MAX_THREADS 64
+/* heaps with fewer nodes in use than this are always marked serially */
+#define GC_PARALLEL_MARK_MIN_NODES 500000
+
+#ifdef GC_PARALLEL_MARK
+#include <stdint.h>
+#ifdef HAVE_SCHED_H
+# include <sched.h>
+#endif
+
+#define GC_MARK_BATCH 256
+
+static struct {
+    SEXP *nodes;
+    R_size_t size;
+    volatile R_size_t scan, count;
+    volatile int busy;
+    volatile Rboolean overflow;
+} gc_mark_queue;
+
+typedef struct {
+    int n;
+    SEXP nodes[GC_MARK_BATCH];
+} gc_mark_buffer;
+
+static uint64_t gc_mark_mask = 0;
+
+static R_INLINE Rboolean gc_try_mark(SEXP s)
+{
+    uint64_t *word = (uint64_t *) &(s->sxpinfo);
+    uint64_t old;
+#pragma omp atomic capture
+    { old = *word; *word |= gc_mark_mask; }
+    return (old & gc_mark_mask) == 0;
+}
+
+static void gc_mark_flush(gc_mark_buffer *buf)
+{
+#pragma omp critical(R_gc_mark_queue)
+    {
+	if (gc_mark_queue.count + buf->n <= gc_mark_queue.size) {
+	    memcpy(gc_mark_queue.nodes + gc_mark_queue.count, buf->nodes,
+		   buf->n * sizeof(SEXP));
+	    gc_mark_queue.count += buf->n;
+	}
+	/* the nodes stay marked but unscanned; RecoverMarkedNodes
+	   finishes them after the parallel phase */
+	else gc_mark_queue.overflow = TRUE;
+    }
+    buf->n = 0;
+}
+
+#define PAR_FORWARD_NODE(s, buf) do {					\
+	SEXP pf__n__ = (s);						\
+	if (pf__n__ && ! NODE_IS_MARKED(pf__n__) && gc_try_mark(pf__n__)) { \
+	    if ((buf)->n == GC_MARK_BATCH)				\
+		gc_mark_flush(buf);					\
+	    (buf)->nodes[(buf)->n++] = pf__n__;				\
+	}								\
+    } while (0)
+
+static void ParallelMarkWorker(void)
+{
+    gc_mark_buffer buf;
+    buf.n = 0;
+
+    for (;;) {
+	R_size_t first = 0, last = 0;
+	Rboolean done = FALSE;
+	if (gc_mark_queue.scan < gc_mark_queue.count ||
+	    gc_mark_queue.busy == 0) {
+#pragma omp critical(R_gc_mark_queue)
+	    {
+		if (gc_mark_queue.scan < gc_mark_queue.count) {
+		    first = gc_mark_queue.scan;
+		    last = first + GC_MARK_BATCH;
+		    if (last > gc_mark_queue.count)
+			last = gc_mark_queue.count;
+		    gc_mark_queue.scan = last;
+		    gc_mark_queue.busy++;
+		}
+		else if (gc_mark_queue.busy == 0)
+		    done = TRUE;
+	    }
+	}
+	if (done)
+	    break;
+	if (first == last) {
+	    /* other threads are still producing work */
+#ifdef HAVE_SCHED_H
+	    sched_yield();
+#endif
+	    continue;
+	}
+	for (R_size_t i = first; i < last; i++) {
+	    SEXP s = gc_mark_queue.nodes[i];
+	    DO_CHILDREN(s, PAR_FORWARD_NODE, &buf);
+	}
+	/* publish new work before declaring this batch finished */
+	if (buf.n > 0)
+	    gc_mark_flush(&buf);
+#pragma omp critical(R_gc_mark_queue)
+	gc_mark_queue.busy--;
+    }
+}
+
+/* Move marked nodes left on the New lists after an overflow of the
+   mark queue to their old generation lists and finish marking their
+   children serially. */
+static void RecoverMarkedNodes(void)
+{
+    SEXPREC peg;
+    SEXP marked = &peg, forwarded_nodes = NULL;
+    SET_NEXT_NODE(marked, marked);
+    SET_PREV_NODE(marked, marked);
+
+    for (int i = 0; i < NUM_NODE_CLASSES; i++) {
+	SEXP s = NEXT_NODE(R_GenHeap[i].New);
+	while (s != R_GenHeap[i].New) {
+	    SEXP next = NEXT_NODE(s);
+	    if (NODE_IS_MARKED(s)) {
+		UNSNAP_NODE(s);
+		SNAP_NODE(s, marked);
+	    }
+	    s = next;
+	}
+    }
+    /* forwarding only unsnaps unmarked nodes, so the list of marked
+       nodes is not disturbed */
+    SEXP s = NEXT_NODE(marked);
+    while (s != marked) {
+	SEXP next = NEXT_NODE(s);
+	FORWARD_CHILDREN(s);
+	UNSNAP_NODE(s);
+	PROCESS_ONE_NODE(s);
+	s = next;
+    }
+    PROCESS_NODES();
+}
+
+/* Run the main processing loop on the nodes in the forwarding list
+   with several threads.  If the parallel code cannot be used the
+   forwarding list is left for PROCESS_NODES. */
+static void ParallelProcessNodes(SEXP *pforwarded_nodes)
+{
+    if (gc_mark_mask == 0) {
+	union { struct sxpinfo_struct info; uint64_t word; } u;
+	if (sizeof(struct sxpinfo_struct) != sizeof(uint64_t))
+	    return;
+	u.word = 0;
+	u.info.mark = 1;
+	gc_mark_mask = u.word;
+    }
+
+    R_size_t size = R_NodesInUse + 1;
+    SEXP *nodes = (SEXP *) malloc(size * sizeof(SEXP));
+    if (nodes == NULL)
+	return;
+
+    /* the roots have already been marked and unsnapped; place them on
+       their old generation lists and queue them for scanning */
+    R_size_t nroots = 0;
+    SEXP forwarded_nodes = *pforwarded_nodes;
+    while (forwarded_nodes != NULL && nroots < size) {
+	SEXP s = forwarded_nodes;
+	forwarded_nodes = NEXT_NODE(forwarded_nodes);
+	PROCESS_ONE_NODE(s);
+	nodes[nroots++] = s;
+    }
+    /* can only happen if the node counts are inconsistent */
+    if (forwarded_nodes != NULL)
+	PROCESS_NODES();
+    *pforwarded_nodes = NULL;
+
+    gc_mark_queue.nodes = nodes;
+    gc_mark_queue.size = size;
+    gc_mark_queue.scan = 0;
+    gc_mark_queue.count = nroots;
+    gc_mark_queue.busy = 0;
+    gc_mark_queue.overflow = FALSE;
+
+    int nthreads = R_GCMarkThreads;
+#pragma omp parallel num_threads(nthreads) default(none)
+    ParallelMarkWorker();
+
+    /* move the nodes claimed by the marker threads to the old
+       generation lists */
+    for (R_size_t i = nroots; i < gc_mark_queue.count; i++) {
+	SEXP s = nodes[i];
+	UNSNAP_NODE(s);
+	PROCESS_ONE_NODE(s);
+    }
+    if (gc_mark_queue.overflow)
+	RecoverMarkedNodes();
+
+    gc_mark_queue.nodes = NULL;
+    free(nodes);
+}
+#endif
+
+static void init_gc_mark_threads(void)
+{
+    char *arg = getenv("R_GC_MARK_THREADS");
+    if (arg != NULL) {
+	int n = atoi(arg);
+	if (n > GC_MARK_MAX_THREADS)
+	    n = GC_MARK_MAX_THREADS;
+	if (n >= 1)
+	    R_GCMarkThreads = n;
+    }
+}
+
+/* Incremental Collection.  When a pause budget is set, collections
+   of the oldest generation are not done in one pass.  Instead the
+   younger generations are collected and an incremental cycle is
+   started that is advanced by steps taken while the mutator
+   allocates, each limited by the budget:
+
+     - In the unmark phase the nodes of the old generation lists are
+       unmarked and moved to the New lists.
+     - In the mark phase the roots are marked and nodes are moved from
+       a grey list, where they wait to have their children scanned, to
+       their old generation lists.  When the grey list is empty the
+       roots and the OldToNew lists are scanned again, and the marking
+       is complete when this finds no unmarked nodes.
+
+   The write barrier keeps this correct while the mutator runs:
+   storing a reference to an unmarked node in a marked one puts the
+   marked node on an OldToNew list, and these lists are moved back to
+   the grey list at each step.  The collection following a complete
+   marking finishes the cycle: it rescans the roots and the OldToNew
+   lists, marks what was allocated since the last step and then
+   proceeds as a full collection.  Since the collector only knows
+   that a node was reached, all nodes surviving the cycle are placed
+   in the oldest generation.
+
+   Steps are paced by the volume allocated: the number of allocations
+   to the next step is chosen so that, at the rate of work and of
+   allocation seen in the previous steps, the marking is complete well
+   before the free nodes or vector cells run out.  Should they run out
+   first, a step is taken and the heap limits are raised, up to
+   GC_INC_BORROW_FRAC of the heap size at the start of the cycle,
+   rather than completing the marking in one pause.  A call to gc()
+   finishes the cycle at once, as does any collection while gctorture
+   is active. */
+
+#define GC_INC_IDLE   0
+#define GC_INC_UNMARK 1
+#define GC_INC_MARK   2
+#define GC_INC_DONE   3
+#define GC_INC_STEP_ALLOCS 10000
+#define GC_INC_MIN_STEP_ALLOCS 50
+#define GC_INC_BORROW_FRAC 0.5
+#define GC_INC_MAX_QUOTA 2
+
+static int gc_inc_state = GC_INC_IDLE;
+static double R_GCIncBudget = 0; /* in milliseconds; 0 disables */
+static Rboolean gc_inc_step_armed = FALSE;
+static SEXPREC gc_inc_grey_peg;
+#define GC_INC_GREY (&gc_inc_grey_peg)
+
+static struct {
+    double cycles, steps, step_time, max_step, finish_time, max_finish;
+} gc_inc_stats;
+
+/* Pacing state of the current cycle: the work in nodes unmarked or
+   marked, estimated from the old nodes and those in use at the start,
+   and done so far, with the time taken by the steps; the nodes and
+   vector cells in use at the start and when the last step was
+   scheduled; the heap size at the start and the room borrowed. */
+static struct {
+    double old, nused0, vused0, done, time, nused, vused;
+    R_size_t nsize, vsize, nborrowed, vborrowed;
+} gc_inc_pace;
+
+/* Each old node is unmarked, and at most those and the nodes
+   allocated since the start of the cycle are marked. */
+static double GCIncWorkLeft(void)
+{
+    return 2 * gc_inc_pace.old + (R_NodesInUse - gc_inc_pace.nused0) -
+	gc_inc_pace.done;
+}
+
+static R_size_t GCIncVUsed(void)
+{
+    return R_SmallVallocSize + R_LargeVallocSize;
+}
+
+/* Schedule the next step, or the collection finishing the cycle. */
+static void GCIncArmStep(void)
+{
+    gc_inc_wait = 0;
+    gc_inc_step_armed = FALSE;
+    if (gc_inc_state == GC_INC_IDLE || R_GCIncBudget <= 0)
+	return;
+
+    double nfree = R_NSize > R_NodesInUse ? R_NSize - R_NodesInUse : 0;
+    double vfree = (double) VHEAP_FREE();
+    double allocs;
+    if (gc_inc_pace.time == 0 || gc_inc_state == GC_INC_DONE)
+	/* no rates known yet, or finish soon, as the finishing
+	   collection marks what was allocated since the last step */
+	allocs = GC_INC_MIN_STEP_ALLOCS;
+    else {
+	/* the work done in the budget */
+	double per_step = gc_inc_pace.done / gc_inc_pace.time *
+	    R_GCIncBudget / 1000.0;
+	double left = GCIncWorkLeft();
+	/* one more for the finishing collection, and twice as many to
+	   allow for misestimates */
+	double steps = 2 * ((left > per_step ? left / per_step : 1) + 1);
+	allocs = nfree / steps;
+	double vused = GCIncVUsed() - gc_inc_pace.vused0;
+	double nused = R_NodesInUse - gc_inc_pace.nused0;
+	if (vused > 0 && nused > 0) {
+	    double vcells_per_alloc = vused / nused;
+	    if (vfree / (steps * vcells_per_alloc) < allocs)
+		allocs = vfree / (steps * vcells_per_alloc);
+	}
+	if (allocs > GC_INC_STEP_ALLOCS) allocs = GC_INC_STEP_ALLOCS;
+	if (allocs < GC_INC_MIN_STEP_ALLOCS) allocs = GC_INC_MIN_STEP_ALLOCS;
+    }
+    gc_inc_wait = (int) allocs;
+    gc_inc_pace.nused = R_NodesInUse;
+    gc_inc_pace.vused = GCIncVUsed();
+    gc_inc_step_armed = TRUE;
+}
+
+/* The work the next step has to do, whatever the budget, for the
+   marking to be complete before half of the free nodes or vector
+   cells are used, at the rate of allocation since the last step.  To
+   keep the pauses bounded this is at most GC_INC_MAX_QUOTA budgets
+   of work, and a step runs over its budget by at most as much; the
+   heap limits are raised to cover the rest. */
+static double GCIncQuota(void)
+{
+    double left = GCIncWorkLeft();
+    double nfree = R_NSize > R_NodesInUse ? R_NSize - R_NodesInUse : 0;
+    double vfree = (double) VHEAP_FREE();
+    double dn = R_NodesInUse - gc_inc_pace.nused;
+    double dv = GCIncVUsed() - gc_inc_pace.vused;
+    double frac = 0; /* of the room left at the last step now used */
+    if (dn > 0)
+	frac = dn / (dn + nfree);
+    if (dv > 0 && dv / (dv + vfree) > frac)
+	frac = dv / (dv + vfree);
+    double quota = left > 0 ? 2 * frac * left : 0;
+    /* no rate is known before the first step, which only has the
+       budget */
+    double max_quota = gc_inc_pace.time > 0 ?
+	GC_INC_MAX_QUOTA * gc_inc_pace.done / gc_inc_pace.time *
+	R_GCIncBudget / 1000.0 : 0;
+    return quota < max_quota ? quota : max_quota;
+}
+
+/* Raise the heap limits so that the allocation of size_needed vector
+   cells and those until the next step can proceed while the cycle is
+   marking.  Returns FALSE if this would exceed the maximal heap sizes
+   or the room that may be borrowed in a cycle. */
+static Rboolean GCIncBorrow(R_size_t size_needed)
+{
+    R_size_t nneed = R_NodesInUse + GC_INC_STEP_ALLOCS;
+    R_size_t nextra = nneed > R_NSize ? nneed - R_NSize : 0;
+    R_size_t vneed = GCIncVUsed() + size_needed +
+	(R_size_t) (R_MinFreeFrac * gc_inc_pace.vsize);
+    R_size_t vextra = vneed > R_VSize ? vneed - R_VSize : 0;
+    if (nextra > 0 &&
+	(R_NSize + nextra > R_MaxNSize ||
+	 gc_inc_pace.nborrowed + nextra >
+	 GC_INC_BORROW_FRAC * gc_inc_pace.nsize))
+	return FALSE;
+    if (vextra > 0 &&
+	(R_VSize + vextra > R_MaxVSize ||
+	 gc_inc_pace.vborrowed + vextra >
+	 GC_INC_BORROW_FRAC * gc_inc_pace.vsize))
+	return FALSE;
+    R_NSize += nextra;
+    gc_inc_pace.nborrowed += nextra;
+    R_VSize += vextra;
+    gc_inc_pace.vborrowed += vextra;
+    return TRUE;
+}
+
+static void GCIncStart(void)
+{
+    double old = 0;
+    for (int i = 0; i < NUM_NODE_CLASSES; i++)
+	for (int gen = 0; gen < NUM_OLD_GENERATIONS; gen++) {
+	    old += R_GenHeap[i].OldCount[gen];
+	    R_GenHeap[i].OldCount[gen] = 0;
+	}
+    gc_inc_pace.old = old;
+    gc_inc_pace.nused0 = R_NodesInUse;
+    gc_inc_pace.vused0 = GCIncVUsed();
+    gc_inc_pace.done = gc_inc_pace.time = 0;
+    gc_inc_pace.nsize = R_NSize;
+    gc_inc_pace.vsize = R_VSize;
+    gc_inc_pace.nborrowed = gc_inc_pace.vborrowed = 0;
+    SET_NEXT_NODE(GC_INC_GREY, GC_INC_GREY);
+    SET_PREV_NODE(GC_INC_GREY, GC_INC_GREY);
+    gc_inc_state = GC_INC_UNMARK;
+    GCIncArmStep();
+}
+
+#define GC_INC_CHECK_INTERVAL 1024
+/* A step ends when the deadline has passed and the nodes it has
+   unmarked or marked reach its quota, or at the latest
+   GC_INC_MAX_QUOTA budgets after the deadline.  The time is checked
+   each time the count n of nodes and references visited has grown by
+   GC_INC_CHECK_INTERVAL. */
+static R_INLINE Rboolean GCIncPastDeadline(double deadline, double nodes,
+					   double quota)
+{
+    if (deadline <= 0)
+	return FALSE;
+    double now = currentTime();
+    return now > deadline &&
+	(nodes >= quota ||
+	 now > deadline + GC_INC_MAX_QUOTA * R_GCIncBudget / 1000.0);
+}
+
+#define GC_INC_OUT_OF_TIME(n, check, deadline, nodes, quota)	\
+    ((n) >= (check) &&						\
+     ((check) = (n) + GC_INC_CHECK_INTERVAL,			\
+      GCIncPastDeadline(deadline, nodes, quota)))
+
+/* Unmark the nodes on the old generation and OldToNew lists and move
+   them to the New lists. Returns TRUE when all lists are empty. A
+   deadline of zero means no time limit. */
+static Rboolean GCIncUnmarkStep(double deadline, double quota)
+{
+    R_xlen_t n = 0, check = GC_INC_CHECK_INTERVAL;
+    for (int i = 0; i < NUM_NODE_CLASSES; i++)
+	for (int gen = 0; gen < NUM_OLD_GENERATIONS; gen++) {
+	    SEXP pegs[] = { R_GenHeap[i].Old[gen],
+#ifndef EXPEL_OLD_TO_NEW
+			    R_GenHeap[i].OldToNew[gen]
+#endif
+	    };
+	    for (int k = 0; k < (int) (sizeof(pegs) / sizeof(SEXP)); k++) {
+		SEXP peg = pegs[k];
+		while (NEXT_NODE(peg) != peg) {
+		    /* insert after the New peg, so the node is not
+		       taken as free before the cycle is finished */
+		    SEXP s = NEXT_NODE(peg);
+		    UNMARK_NODE(s);
+		    UNSNAP_NODE(s);
+		    SNAP_NODE(s, NEXT_NODE(R_GenHeap[i].New));
+		    n++;
+		    if (GC_INC_OUT_OF_TIME(n, check, deadline, n, quota)) {
+			gc_inc_pace.done += n;
+			return FALSE;
+		    }
+		}
+	    }
+	}
+    gc_inc_pace.done += n;
+    return TRUE;
+}
+
+/* Marked nodes are counted when they are put on the grey list, so
+   moving them between the grey, old generation and OldToNew lists
+   does not change the counts. */
+#define GC_INC_SNAP_GREY(s) do {					\
+	SEXP gs__n__ = (s);						\
+	SET_NODE_GENERATION(gs__n__, NUM_OLD_GENERATIONS - 1);		\
+	R_GenHeap[NODE_CLASS(gs__n__)].OldCount[NUM_OLD_GENERATIONS - 1]++; \
+	SNAP_NODE(gs__n__, GC_INC_GREY);				\
+    } while (0)
+
+#define GC_INC_GREY_NODE(s) do {				\
+	SEXP gn__n__ = (s);					\
+	if (gn__n__ && ! NODE_IS_MARKED(gn__n__)) {		\
+	    MARK_AND_UNSNAP_NODE(gn__n__);			\
+	    GC_INC_SNAP_GREY(gn__n__);				\
+	}							\
+    } while (0)
+#define FC_GC_INC_GREY_NODE(__n__,__dummy__) GC_INC_GREY_NODE(__n__)
+
+static void GCIncGreyRoots(void)
+{
+    SEXP forwarded_nodes = NULL;
+    ForwardRoots(&forwarded_nodes);
+    while (forwarded_nodes != NULL) {
+	SEXP s = forwarded_nodes;
+	forwarded_nodes = NEXT_NODE(forwarded_nodes);
+	GC_INC_SNAP_GREY(s);
+    }
+}
+
+/* Nodes on the OldToNew lists have been marked but may have been
+   given references to unmarked nodes; scan them again. */
+static void GCIncGreyOldToNew(void)
+{
+#ifndef EXPEL_OLD_TO_NEW
+    for (int i = 0; i < NUM_NODE_CLASSES; i++)
+	for (int gen = 0; gen < NUM_OLD_GENERATIONS; gen++) {
+	    SEXP peg = R_GenHeap[i].OldToNew[gen];
+	    while (NEXT_NODE(peg) != peg) {
+		SEXP s = NEXT_NODE(peg);
+		UNSNAP_NODE(s);
+		SNAP_NODE(s, GC_INC_GREY);
+	    }
+	}
+#endif
+}
+
+/* Scan nodes on the grey list. Returns TRUE when the list is empty. */
+static Rboolean GCIncMarkStep(double deadline, double quota)
+{
+    R_xlen_t n = 0, nodes = 0, check = GC_INC_CHECK_INTERVAL;
+    while (NEXT_NODE(GC_INC_GREY) != GC_INC_GREY) {
+	SEXP s = NEXT_NODE(GC_INC_GREY);
+	UNSNAP_NODE(s);
+	SNAP_NODE(s, R_GenHeap[NODE_CLASS(s)].Old[NODE_GENERATION(s)]);
+	DO_CHILDREN(s, FC_GC_INC_GREY_NODE, 0);
+	/* the time taken depends on the references visited */
+	nodes++;
+	n += 1 + ((TYPEOF(s) == VECSXP || TYPEOF(s) == EXPRSXP ||
+		   TYPEOF(s) == STRSXP) && ! ALTREP(s) ? XLENGTH(s) : 0);
+	if (GC_INC_OUT_OF_TIME(n, check, deadline, nodes, quota)) {
+	    gc_inc_pace.done += nodes;
+	    return FALSE;
+	}
+    }
+    gc_inc_pace.done += nodes;
+    return TRUE;
+}
+
+/* Complete the marking of an incremental cycle. */
+static void GCIncFinishMarking(void)
+{
+    if (gc_inc_state == GC_INC_UNMARK) {
+	GCIncUnmarkStep(0, 0);
+	gc_inc_state = GC_INC_MARK;
+    }
+    GCIncGreyOldToNew();
+    GCIncGreyRoots();
+    GCIncMarkStep(0, 0);
+    gc_inc_state = GC_INC_IDLE;
+    GCIncArmStep();
+}
+
+/* Nodes marked after the incremental marking was completed, for
+   instance through weak references, may still be in generation 0;
+   move them to the oldest generation with the others. */
+static void GCIncPromote(void)
+{
+#if NUM_OLD_GENERATIONS > 1
+    for (int i = 0; i < NUM_NODE_CLASSES; i++) {
+	SEXP peg = R_GenHeap[i].Old[0];
+	for (SEXP s = NEXT_NODE(peg); s != peg; s = NEXT_NODE(s))
+	    SET_NODE_GENERATION(s, NUM_OLD_GENERATIONS - 1);
+	if (NEXT_NODE(peg) != peg)
+	    BULK_MOVE(peg, R_GenHeap[i].Old[NUM_OLD_GENERATIONS - 1]);
+	R_GenHeap[i].OldCount[NUM_OLD_GENERATIONS - 1] +=
+	    R_GenHeap[i].OldCount[0];
+	R_GenHeap[i].OldCount[0] = 0;
+    }
+#endif
+}
+
+/* Count the nodes added to the generation 0 lists after the positions
+   recorded in count and last; these survived their first collection. */
+static void RecordPromotions(R_size_t *count, SEXP *last)
+{
+    for (int i = 0; i < NUM_SMALL_NODE_CLASSES; i++) {
+	R_size_t n = R_GenHeap[i].OldCount[0] - count[i];
+	gc_stats.promoted += n;
+	gc_stats.promoted_bytes += (double) n * NODE_SIZE(i);
+    }
+    for (int i = CUSTOM_NODE_CLASS; i <= LARGE_NODE_CLASS; i++)
+	for (SEXP s = NEXT_NODE(last[i]); s != R_GenHeap[i].Old[0];
+	     s = NEXT_NODE(s))
+	    RecordPromotion(s);
+}
+
+static int RunGenCollect(R_size_t size_needed, Rboolean full_requested)
+{
+    int i, gen, gens_collected;
+    SEXP s;
+    SEXP forwarded_nodes;
+    Rboolean inc_start = FALSE, inc_finish;
+    R_size_t old0_count[NUM_NODE_CLASSES];
+    SEXP old0_last[NUM_NODE_CLASSES];
+
+    bad_sexp_type_seen = 0;
+
+    /* determine number of generations to collect */
+    while (num_old_gens_to_collect < NUM_OLD_GENERATIONS) {
+	if (collect_counts[num_old_gens_to_collect]-- <= 0) {
+	    collect_counts[num_old_gens_to_collect] =
+		collect_counts_max[num_old_gens_to_collect];
+	    num_old_gens_to_collect++;
+	}
+	else break;
+    }
+
+    /* with a pause budget, collect the oldest generation incrementally
+       unless a full collection was asked for */
+    if (R_GCIncBudget > 0 && gc_inc_state == GC_INC_IDLE &&
+	! full_requested && ! GC_TORTURE_ACTIVE &&
+	num_old_gens_to_collect == NUM_OLD_GENERATIONS) {
+	num_old_gens_to_collect = NUM_OLD_GENERATIONS - 1;
+	inc_start = TRUE;
+    }
+
+#ifdef PROTECTCHECK
+    num_old_gens_to_collect = NUM_OLD_GENERATIONS;
+#endif
+
+ again:
+    gens_collected = num_old_gens_to_collect;
+    inc_finish = (gc_inc_state != GC_INC_IDLE);
+
+    if (inc_finish) {
+	/* an incremental cycle is in progress; completing it collects
+	   all generations */
+	gens_collected = num_old_gens_to_collect = NUM_OLD_GENERATIONS;
+	GCIncFinishMarking();
+	forwarded_nodes = NULL;
+	goto weak_refs;
+    }
+
+#ifndef EXPEL_OLD_TO_NEW
+    /* eliminate old-to-new references in generations to collect by
+       transferring referenced nodes to referring generation */
+    for (gen = 0; gen < num_old_gens_to_collect; gen++) {
+	for (i = 0; i < NUM_NODE_CLASSES; i++) {
+	    s = NEXT_NODE(R_GenHeap[i].OldToNew[gen]);
+	    while (s != R_GenHeap[i].OldToNew[gen]) {
+		SEXP next = NEXT_NODE(s);
+		DO_CHILDREN(s, AgeNodeAndChildren, gen);
+		UNSNAP_NODE(s);
+		if (NODE_GENERATION(s) != gen)
+		    gc_error("****snapping into wrong generation\n");
+		SNAP_NODE(s, R_GenHeap[i].Old[gen]);
+		s = next;
+	    }
+	}
+    }
+#endif
+
+    DEBUG_CHECK_NODE_COUNTS("at start");
+
+    /* unmark all marked nodes in old generations to be collected and
+       move to New space */
+    for (gen = 0; gen < num_old_gens_to_collect; gen++) {
+	for (i = 0; i < NUM_NODE_CLASSES; i++) {
+	    R_GenHeap[i].OldCount[gen] = 0;
+	    s = NEXT_NODE(R_GenHeap[i].Old[gen]);
+	    while (s != R_GenHeap[i].Old[gen]) {
+		SEXP next = NEXT_NODE(s);
+		if (gen < NUM_OLD_GENERATIONS - 1)
+		    SET_NODE_GENERATION(s, gen + 1);
+		UNMARK_NODE(s);
+		s = next;
+	    }
+	    if (NEXT_NODE(R_GenHeap[i].Old[gen]) != R_GenHeap[i].Old[gen])
+		BULK_MOVE(R_GenHeap[i].Old[gen], R_GenHeap[i].New);
+	}
+    }
+
+    forwarded_nodes = NULL;
+
+    for (i = 0; i < NUM_NODE_CLASSES; i++) {
+	old0_count[i] = R_GenHeap[i].OldCount[0];
+	old0_last[i] = PREV_NODE(R_GenHeap[i].Old[0]);
+    }
+
+#ifndef EXPEL_OLD_TO_NEW
+    /* scan nodes in uncollected old generations with old-to-new pointers */
+    for (gen = num_old_gens_to_collect; gen < NUM_OLD_GENERATIONS; gen++)
+	for (i = 0; i < NUM_NODE_CLASSES; i++)
+	    for (s = NEXT_NODE(R_GenHeap[i].OldToNew[gen]);
+		 s != R_GenHeap[i].OldToNew[gen];
+		 s = NEXT_NODE(s))
+		FORWARD_CHILDREN(s);
+#endif
+
+    /* forward all roots */
+    ForwardRoots(&forwarded_nodes);
+
     /* main processing loop */
+#ifdef GC_PARALLEL_MARK
+    if (R_GCMarkThreads > 1 &&
+	num_old_gens_to_collect == NUM_OLD_GENERATIONS &&
+	R_NodesInUse >= GC_PARALLEL_MARK_MIN_NODES)
+	ParallelProcessNodes(&forwarded_nodes);
+#endif
     PROCESS_NODES();
 
+ weak_refs:
     /* identify weakly reachable nodes */
     {
 	Rboolean recheck_weak_refs;
@@ -1904,6 +2812,11 @@ static int RunGenCollect(R_size_t size_needed)
     FORWARD_AND_PROCESS_ONE_NODE(R_StringHash, VECSXP);
     PROCESS_NODES(); /* probably nothing to process, but just in case ... */
 
+    if (inc_finish)
+	GCIncPromote();
+    else
+	RecordPromotions(old0_count, old0_last);
+
 #ifdef PROTECTCHECK
     for(i=0; i< NUM_SMALL_NODE_CLASSES;i++){
 	s = NEXT_NODE(R_GenHeap[i].New);
@@ -1980,7 +2893,17 @@ static int RunGenCollect(R_size_t size_needed)
     }
     R_NodesInUse = R_NSize - R_Collected;
 
-    if (num_old_gens_to_collect < NUM_OLD_GENERATIONS) {
+    if (inc_start) {
+	/* give the mutator room to run while the cycle proceeds */
+	AdjustHeapSize(size_needed);
+	if (NO_FREE_NODES() || VHEAP_FREE() < size_needed) {
+	    inc_start = FALSE;
+	    num_old_gens_to_collect = NUM_OLD_GENERATIONS;
+	    goto again;
+	}
+	num_old_gens_to_collect = 0;
+    }
+    else if (num_old_gens_to_collect < NUM_OLD_GENERATIONS) {
 	if (R_Collected < R_MinFreeFrac * R_NSize ||
 	    VHEAP_FREE() < size_needed + R_MinFreeFrac * R_VSize) {
 	    num_old_gens_to_collect++;
@@ -1996,18 +2919,25 @@ static int RunGenCollect(R_size_t size_needed)
     if (gens_collected == NUM_OLD_GENERATIONS) {
 	/**** do some adjustment for intermediate collections? */
 	AdjustHeapSize(size_needed);
-	TryToReleasePages();
+	/* after an incremental cycle, within the budget */
+	TryToReleasePages(inc_finish ?
+			  currentTime() + R_GCIncBudget / 1000.0 : 0);
+	ReleaseIdleArenaBlocks();
 	DEBUG_CHECK_NODE_COUNTS("after heap adjustment");
     }
     else if (gens_collected > 0) {
-	TryToReleasePages();
+	TryToReleasePages(0);
 	DEBUG_CHECK_NODE_COUNTS("after heap adjustment");
     }
 #ifdef SORT_NODES
-    if (gens_collected == NUM_OLD_GENERATIONS)
+    /* not after an incremental cycle, as it visits the whole heap */
+    if (gens_collected == NUM_OLD_GENERATIONS && ! inc_finish)
 	SortNodes();
 #endif
 
+    if (inc_start && gens_collected < NUM_OLD_GENERATIONS)
+	GCIncStart();
+
     return gens_collected;
 }
 
@@ -2035,7 +2965,7 @@ void R_gc_torture(int gap, int wait, Rboolean inhibit)
 attribute_hidden SEXP do_gctorture(SEXP call, SEXP op, SEXP args, SEXP rho)
 {
     int gap;
-    SEXP old = ScalarLogical(gc_force_wait > 0);
+    SEXP old = ScalarLogical(gc_force_gap > 0);
 
     checkArity(op, args);
 
@@ -2067,6 +2997,32 @@ attribute_hidden SEXP do_gctorture2(SEXP call, SEXP op, SEXP args, SEXP rho)
     return ScalarInteger(old);
 }
 
+attribute_hidden SEXP do_gcincremental(SEXP call, SEXP op, SEXP args, SEXP rho)
+{
+    double old = R_GCIncBudget, budget;
+
+    checkArity(op, args);
+    budget = asReal(CAR(args));
+    if (!ISNAN(budget)) {
+	if (budget < 0 || !R_FINITE(budget))
+	    error(_("invalid '%s' argument"), "budget");
+	R_GCIncBudget = budget;
+	GCIncArmStep();
+    }
+    return ScalarReal(old);
+}
+
+/* initialize the incremental collection pause budget */
+static void init_gc_pause_budget(void)
+{
+    char *arg = getenv("R_GC_PAUSE_BUDGET");
+    if (arg != NULL) {
+	double budget = R_atof(arg);
+	if (budget > 0 && R_FINITE(budget))
+	    R_GCIncBudget = budget;
+    }
+}
+
 /* initialize gctorture settings from environment variables */
 static void init_gctorture(void)
 {
@@ -2134,7 +3090,7 @@ attribute_hidden SEXP do_gc(SEXP call, SEXP op, SEXP args, SEXP rho)
 
     gc_reporting = ogc;
     /*- now return the [used , gc trigger size] for cells and heap */
-    PROTECT(value = allocVector(REALSXP, 14));
+    PROTECT(value = allocVector(REALSXP, 21));
     REAL(value)[0] = onsize - R_Collected;
     REAL(value)[1] = R_VSize - VHEAP_FREE();
     REAL(value)[4] = R_NSize;
@@ -2156,10 +3112,107 @@ attribute_hidden SEXP do_gc(SEXP call, SEXP op, SEXP args, SEXP rho)
     REAL(value)[11] = R_V_maxused;
     REAL(value)[12] = 0.1*ceil(10. * R_N_maxused/Mega*sizeof(SEXPREC));
     REAL(value)[13] = 0.1*ceil(10. * R_V_maxused/Mega*vsfac);
+    /* incremental collection: budget and counters, times in ms */
+    REAL(value)[14] = R_GCIncBudget;
+    REAL(value)[15] = gc_inc_stats.cycles;
+    REAL(value)[16] = gc_inc_stats.steps;
+    REAL(value)[17] = 1000 * gc_inc_stats.step_time;
+    REAL(value)[18] = 1000 * gc_inc_stats.max_step;
+    REAL(value)[19] = 1000 * gc_inc_stats.finish_time;
+    REAL(value)[20] = 1000 * gc_inc_stats.max_finish;
     UNPROTECT(1);
     return value;
 }
 
+static SEXP gc_stats_vector(const double *x, int n, const char **names)
+{
+    SEXP val = PROTECT(allocVector(REALSXP, n));
+    SEXP nms = PROTECT(allocVector(STRSXP, n));
+    for (int i = 0; i < n; i++) {
+	REAL(val)[i] = x[i];
+	SET_STRING_ELT(nms, i, mkChar(names[i]));
+    }
+    setAttrib(val, R_NamesSymbol, nms);
+    UNPROTECT(2);
+    return val;
+}
+
+attribute_hidden SEXP do_gcstats(SEXP call, SEXP op, SEXP args, SEXP rho)
+{
+    checkArity(op, args);
+    int reset = asLogical(CAR(args));
+
+    const char *levels[NUM_OLD_GENERATIONS + 1];
+    char lbuf[NUM_OLD_GENERATIONS + 1][16];
+    for (int i = 0; i <= NUM_OLD_GENERATIONS; i++) {
+	snprintf(lbuf[i], 16, "level %d", i);
+	levels[i] = lbuf[i];
+    }
+    const char *bins[GC_PAUSE_BINS];
+    char bbuf[GC_PAUSE_BINS][16];
+    for (int i = 0; i < GC_PAUSE_BINS - 1; i++) {
+	snprintf(bbuf[i], 16, "<%gms", 1000 * gc_pause_breaks[i]);
+	bins[i] = bbuf[i];
+    }
+    snprintf(bbuf[GC_PAUSE_BINS - 1], 16, ">=%gms",
+	     1000 * gc_pause_breaks[GC_PAUSE_BINS - 2]);
+    bins[GC_PAUSE_BINS - 1] = bbuf[GC_PAUSE_BINS - 1];
+
+    const char *nms[] = { "collections", "pause.time", "max.pause",
+			  "pause.histogram", "promoted", "large.vectors",
+			  "heap.adjustments", "large.arena", "allocations", "" };
+    SEXP ans = PROTECT(mkNamed(VECSXP, nms));
+    SET_VECTOR_ELT(ans, 0, gc_stats_vector(gc_stats.collections,
+					   NUM_OLD_GENERATIONS + 1, levels));
+    SET_VECTOR_ELT(ans, 1, gc_stats_vector(gc_stats.pause_time,
+					   NUM_OLD_GENERATIONS + 1, levels));
+    SET_VECTOR_ELT(ans, 2, gc_stats_vector(gc_stats.max_pause,
+					   NUM_OLD_GENERATIONS + 1, levels));
+    SET_VECTOR_ELT(ans, 3, gc_stats_vector(gc_stats.pause_hist,
+					   GC_PAUSE_BINS, bins));
+    {
+	const char *n[] = { "count", "bytes", "large.count", "large.bytes" };
+	double x[] = { gc_stats.promoted, gc_stats.promoted_bytes,
+		       gc_stats.promoted_large, gc_stats.promoted_large_bytes };
+	SET_VECTOR_ELT(ans, 4, gc_stats_vector(x, 4, n));
+    }
+    {
+	const char *n[] = { "allocated", "allocated.bytes",
+			    "released", "released.bytes" };
+	double x[] = { gc_stats.large_alloc, gc_stats.large_alloc_bytes,
+		       gc_stats.large_release, gc_stats.large_release_bytes };
+	SET_VECTOR_ELT(ans, 5, gc_stats_vector(x, 4, n));
+    }
+    {
+	const char *n[] = { "Ncells.grow", "Ncells.shrink",
+			    "Vcells.grow", "Vcells.shrink" };
+	double x[] = { gc_stats.nsize_grow, gc_stats.nsize_shrink,
+		       gc_stats.vsize_grow, gc_stats.vsize_shrink };
+	SET_VECTOR_ELT(ans, 6, gc_stats_vector(x, 4, n));
+    }
+    {
+	const char *n[] = { "in.use", "retained", "reused",
+			    "advised.bytes", "unmapped.bytes" };
+	double x[] = { arena_stats.in_use, arena_stats.retained,
+		       arena_stats.reused, arena_stats.advised,
+		       arena_stats.unmapped };
+	SET_VECTOR_ELT(ans, 7, gc_stats_vector(x, 5, n));
+    }
+    {
+	const char *n[] = { "nodes" };
+	double x[] = { gc_stats.nodes_freed + (double) R_NodesInUse -
+		       gc_stats.nodes_base };
+	SET_VECTOR_ELT(ans, 8, gc_stats_vector(x, 1, n));
+    }
+    if (reset == TRUE) {
+	memset(&gc_stats, 0, sizeof(gc_stats));
+	gc_stats.nodes_base = (double) R_NodesInUse;
+	arena_stats.reused = arena_stats.advised = arena_stats.unmapped = 0;
+    }
+    UNPROTECT(1);
+    return ans;
+}
+
 NORET static void mem_err_heap(R_size_t size)
 {
     if (R_MaxVSize == R_SIZE_T_MAX)
@@ -2210,6 +3263,9 @@ attribute_hidden void InitMemory(void)
 
     init_gctorture();
     init_gc_grow_settings();
+    init_gc_mark_threads();
+    init_gc_pause_budget();
+    init_gc_large_arena();
 
     arg = getenv("_R_GC_FAIL_ON_ERROR_");
     if (arg != NULL && StringTrue(arg))
@@ -2453,6 +3509,7 @@ SEXP allocSExp(SEXPTYPE t)
     CDR(s) = R_NilValue;
     TAG(s) = R_NilValue;
     ATTRIB(s) = R_NilValue;
+    MEM_SAMPLE(t, sizeof(SEXPREC));
     return s;
 }
 
@@ -2503,6 +3560,7 @@ SEXP cons(SEXP car, SEXP cdr)
     CDR(s) = CHK(cdr); if (cdr) INCREMENT_REFCNT(cdr);
     TAG(s) = R_NilValue;
     ATTRIB(s) = R_NilValue;
+    MEM_SAMPLE(LISTSXP, sizeof(SEXPREC));
     return s;
 }
 
@@ -2535,6 +3593,7 @@ attribute_hidden SEXP CONS_NR(SEXP car, SEXP cdr)
     CDR(s) = CHK(cdr);
     TAG(s) = R_NilValue;
     ATTRIB(s) = R_NilValue;
+    MEM_SAMPLE(LISTSXP, sizeof(SEXPREC));
     return s;
 }
 
@@ -2595,6 +3654,7 @@ SEXP NewEnvironment(SEXP namelist, SEXP valuelist, SEXP rho)
 	v = CDR(v);
 	n = CDR(n);
     }
+    MEM_SAMPLE(ENVSXP, sizeof(SEXPREC));
     return (newrho);
 }
 
@@ -2633,6 +3693,7 @@ attribute_hidden SEXP mkPROMISE(SEXP expr, SEXP rho)
     PRVALUE0(s) = R_UnboundValue;
     PRSEEN(s) = 0;
     ATTRIB(s) = R_NilValue;
+    MEM_SAMPLE(PROMSXP, sizeof(SEXPREC));
     return s;
 }
 
@@ -2730,6 +3791,8 @@ SEXP allocVector3(SEXPTYPE type, R_xlen_t length, R_allocator_t *allocator)
 	    SET_STDVEC_LENGTH(s, (R_len_t) length); // is 1
 	    SET_STDVEC_TRUELENGTH(s, 0);
 	    INIT_REFCNT(s);
+	    MEM_SAMPLE(type, sizeof(SEXPREC_ALIGN) +
+		       alloc_size * sizeof(VECREC));
 	    return(s);
 	}
     }
@@ -2887,7 +3950,7 @@ SEXP allocVector3(SEXPTYPE type, R_xlen_t length, R_allocator_t *allocator)
 		   indexable by size_t. - TK */
 		mem = allocator ?
 		    custom_node_alloc(allocator, hdrsize + size * sizeof(VECREC)) :
-		    malloc(hdrsize + size * sizeof(VECREC));
+		    large_vector_malloc(size);
 		if (mem == NULL) {
 		    /* If we are near the address space limit, we
 		       might be short of address space.  So return
@@ -2895,7 +3958,7 @@ SEXP allocVector3(SEXPTYPE type, R_xlen_t length, R_allocator_t *allocator)
 		    R_gc_no_finalizers(alloc_size);
 		    mem = allocator ?
 			custom_node_alloc(allocator, hdrsize + size * sizeof(VECREC)) :
-			malloc(hdrsize + size * sizeof(VECREC));
+			large_vector_malloc(size);
 		}
 		if (mem != NULL) {
 		    s = mem;
@@ -2928,6 +3991,8 @@ SEXP allocVector3(SEXPTYPE type, R_xlen_t length, R_allocator_t *allocator)
 	    INIT_REFCNT(s);
 	    SET_NODE_CLASS(s, node_class);
 	    if (!allocator) R_LargeVallocSize += size;
+	    gc_stats.large_alloc++;
+	    gc_stats.large_alloc_bytes += hdrsize + (double) size * sizeof(VECREC);
 	    R_GenHeap[node_class].AllocCount++;
 	    R_NodesInUse++;
 	    SNAP_NODE(s, R_GenHeap[node_class].New);
@@ -2981,6 +4046,7 @@ SEXP allocVector3(SEXPTYPE type, R_xlen_t length, R_allocator_t *allocator)
     else if (type == RAWSXP)
 	VALGRIND_MAKE_MEM_UNDEFINED(RAW(s), actual_size);
 #endif
+    MEM_SAMPLE(type, sizeof(SEXPREC_ALIGN) + size * sizeof(VECREC));
     return s;
 }
 
@@ -3084,6 +4150,7 @@ SEXP allocFormalsList6(SEXP sym1, SEXP sym2, SEXP sym3, SEXP sym4,
 void R_gc(void)
 {
     num_old_gens_to_collect = NUM_OLD_GENERATIONS;
+    gc_request = GC_REQUEST_FULL;
     R_gc_internal(0);
 #ifndef IMMEDIATE_FINALIZERS
     R_RunPendingFinalizers();
@@ -3092,6 +4159,7 @@ void R_gc(void)
 
 void R_gc_lite(void)
 {
+    gc_request = GC_REQUEST_LITE;
     R_gc_internal(0);
 #ifndef IMMEDIATE_FINALIZERS
     R_RunPendingFinalizers();
@@ -3101,6 +4169,7 @@ void R_gc_lite(void)
 static void R_gc_no_finalizers(R_size_t size_needed)
 {
     num_old_gens_to_collect = NUM_OLD_GENERATIONS;
+    gc_request = GC_REQUEST_FULL;
     R_gc_internal(size_needed);
 }
 
@@ -3182,9 +4251,55 @@ attribute_hidden void R_check_thread(const char *s) {}
 # endif
 #endif
 
+/* Advance an incremental cycle by one step limited by the budget. */
+static void GCIncStep(void)
+{
+    double done = gc_inc_pace.done;
+    double quota = GCIncQuota();
+    double start = currentTime();
+    double deadline = start + R_GCIncBudget / 1000.0;
+
+    BEGIN_SUSPEND_INTERRUPTS {
+	R_in_gc = TRUE;
+	gc_start_timing();
+	if (gc_inc_state == GC_INC_UNMARK &&
+	    GCIncUnmarkStep(deadline, quota)) {
+	    gc_inc_state = GC_INC_MARK;
+	    GCIncGreyRoots();
+	}
+	if (gc_inc_state == GC_INC_MARK) {
+	    GCIncGreyOldToNew();
+	    while (GCIncMarkStep(deadline, quota - (gc_inc_pace.done - done))) {
+		/* the grey list is empty: the marking is complete unless
+		   the roots or OldToNew lists lead to unmarked nodes */
+		GCIncGreyOldToNew();
+		GCIncGreyRoots();
+		if (NEXT_NODE(GC_INC_GREY) == GC_INC_GREY) {
+		    gc_inc_state = GC_INC_DONE;
+		    break;
+		}
+	    }
+	}
+	gc_end_timing();
+	R_in_gc = FALSE;
+    } END_SUSPEND_INTERRUPTS;
+
+    double pause = currentTime() - start;
+    gc_inc_pace.time += pause;
+    gc_inc_stats.steps++;
+    gc_inc_stats.step_time += pause;
+    if (pause > gc_inc_stats.max_step)
+	gc_inc_stats.max_step = pause;
+    gc_record_pause(pause);
+
+    GCIncArmStep();
+}
+
 static void R_gc_internal(R_size_t size_needed)
 {
     R_CHECK_THREAD;
+    int request = gc_request;
+    gc_request = GC_REQUEST_ALLOC;
     if (!R_GCEnabled || R_in_gc) {
       if (R_in_gc)
         gc_error("*** recursive gc invocation\n");
@@ -3205,6 +4320,23 @@ static void R_gc_internal(R_size_t size_needed)
       gc_pending = TRUE;
       return;
     }
+
+    /* During the marking of an incremental cycle, collections due to
+       allocation are replaced by steps: when the countdown set by
+       GCIncArmStep runs out, or when memory runs out if the heap room
+       needed until the next step can be borrowed.  Once the marking is
+       complete the next such collection finishes the cycle. */
+    if (request == GC_REQUEST_ALLOC && ! GC_TORTURE_ACTIVE &&
+	R_GCIncBudget > 0 && (gc_inc_state == GC_INC_UNMARK || gc_inc_state == GC_INC_MARK)) {
+	Rboolean step_due = gc_inc_step_armed && gc_inc_wait == 0;
+	Rboolean room = ! gc_pending && ! NO_FREE_NODES() &&
+	    VHEAP_FREE() >= size_needed;
+	if ((step_due && room) || GCIncBorrow(size_needed)) {
+	    gc_pending = FALSE;
+	    GCIncStep();
+	    return;
+	}
+    }
     gc_pending = FALSE;
 
     R_size_t onsize = R_NSize /* can change during collection */;
@@ -3227,14 +4359,34 @@ static void R_gc_internal(R_size_t size_needed)
     R_N_maxused = R_MAX(R_N_maxused, R_NodesInUse);
     R_V_maxused = R_MAX(R_V_maxused, R_VSize - VHEAP_FREE());
 
+    Rboolean inc_finish = (gc_inc_state != GC_INC_IDLE);
+    R_size_t in_use = R_NodesInUse;
+    double start_time = currentTime();
+
     BEGIN_SUSPEND_INTERRUPTS {
 	R_in_gc = TRUE;
 	gc_start_timing();
-	gens_collected = RunGenCollect(size_needed);
+	gens_collected = RunGenCollect(size_needed,
+				       request == GC_REQUEST_FULL);
 	gc_end_timing();
 	R_in_gc = FALSE;
     } END_SUSPEND_INTERRUPTS;
 
+    double pause = currentTime() - start_time;
+    if (R_NodesInUse < in_use)
+	gc_stats.nodes_freed += (double) (in_use - R_NodesInUse);
+    gc_stats.collections[gens_collected]++;
+    gc_stats.pause_time[gens_collected] += pause;
+    if (pause > gc_stats.max_pause[gens_collected])
+	gc_stats.max_pause[gens_collected] = pause;
+    gc_record_pause(pause);
+    if (inc_finish) {
+	gc_inc_stats.cycles++;
+	gc_inc_stats.finish_time += pause;
+	if (pause > gc_inc_stats.max_finish)
+	    gc_inc_stats.max_finish = pause;
+    }
+
     if (R_check_constants > 2 ||
 	    (R_check_constants > 1 && gens_collected == NUM_OLD_GENERATIONS))
 	R_checkConstants(TRUE);
@@ -4802,19 +5954,193 @@ attribute_hidden void (SET_CACHED)(SEXP x) { SET_CACHED(CHK(x)); }
 /*attribute_hidden*/ int  (IS_CACHED)(SEXP x) { return IS_CACHED(CHK(x)); }
 
 /*******************************************/
-/* Non-sampling memory use profiler
-   reports all large vector heap
-   allocations and all calls to GetNewPage */
+/* Sampling allocation profiler
+   attributes allocated bytes and objects
+   to call stacks and types */
 /*******************************************/
 
-#ifndef R_MEMORY_PROFILING
+/* With Rprofmem(sample.bytes = n) an allocation is sampled on average
+   once every n bytes allocated: R_MemSampleCountdown is decremented by
+   the size of each allocation, and when it drops below zero a sample
+   is taken and the countdown reset to an exponentially distributed
+   value with mean n.  An allocation of s bytes is thus sampled with
+   probability p = 1 - exp(-s/n); weighting each sample by 1/p makes
+   the totals unbiased estimates of the bytes and objects allocated.
+   The draws use a private generator so that the R random number
+   stream is not disturbed.
+
+   Samples are aggregated by call stack and type in a hash table in
+   malloc'ed memory, as no R objects can be allocated while an
+   allocation is in progress.  When profiling ends the table is
+   written out in the collapsed stack format of Rprof(native = TRUE),
+   weighted by bytes, and returned. */
 
-NORET SEXP do_Rprofmem(SEXP args)
+typedef struct memprof_entry {
+    struct memprof_entry *next;
+    unsigned int hash;
+    SEXPTYPE type;
+    double bytes, objects;
+    char stack[];		/* outermost first, ';' separated */
+} memprof_entry;
+
+#define MEMPROF_NBUCKETS 1024	/* a power of 2 */
+#define MEMPROF_MAXDEPTH 256
+#define MEMPROF_BUFSIZ 10500	/* as PROFBUFSIZ in eval.c */
+
+static memprof_entry **R_MemProf_Table = NULL;
+static FILE *R_MemProf_Outfile = NULL;
+static double R_MemProf_Mean;
+static uint64_t R_MemProf_State;
+
+static double memprof_unif(void)
 {
-    error(_("memory profiling is not available on this system"));
+    /* xorshift64*, returning a value in (0, 1) */
+    R_MemProf_State ^= R_MemProf_State >> 12;
+    R_MemProf_State ^= R_MemProf_State << 25;
+    R_MemProf_State ^= R_MemProf_State >> 27;
+    uint64_t r = R_MemProf_State * 0x2545F4914F6CDD1DULL;
+    return ((double) (r >> 11) + 0.5) / 9007199254740992.0;
 }
 
-#else
+static void memprof_countdown(void)
+{
+    double next = -log(memprof_unif()) * R_MemProf_Mean;
+    R_MemSampleCountdown = next < 9.0e18 ? (int64_t) next : INT64_MAX;
+}
+
+static void R_SampleAllocation(SEXPTYPE type, R_size_t bytes)
+{
+    if (R_MemProf_Table == NULL) {
+	R_MemSampleCountdown = INT64_MAX;
+	return;
+    }
+    memprof_countdown();
+
+    /* the innermost frames, as many as fit in the buffer */
+    const char *names[MEMPROF_MAXDEPTH];
+    int depth = 0;
+    size_t len = 0;
+    for (RCNTXT *cptr = R_GlobalContext;
+	 cptr != NULL && depth < MEMPROF_MAXDEPTH;
+	 cptr = cptr->nextcontext)
+	if ((cptr->callflag & (CTXT_FUNCTION | CTXT_BUILTIN))
+	    && TYPEOF(cptr->call) == LANGSXP) {
+	    SEXP fun = CAR(cptr->call);
+	    const char *name = TYPEOF(fun) == SYMSXP ?
+		CHAR(PRINTNAME(fun)) : "<Anonymous>";
+	    len += strlen(name) + 1;
+	    if (len >= MEMPROF_BUFSIZ)
+		break;
+	    names[depth++] = name;
+	}
+
+    unsigned int hash = 2166136261U ^ (unsigned int) type;
+    char buf[MEMPROF_BUFSIZ];
+    char *p = buf;
+    for (int i = depth - 1; i >= 0; i--) {
+	for (const char *q = names[i]; *q; q++) {
+	    /* ';' separates frames */
+	    *p = *q == ';' ? ':' : *q;
+	    hash = (hash ^ (unsigned char) *p++) * 16777619U;
+	}
+	if (i) *p++ = ';';
+    }
+    *p = '\0';
+
+    memprof_entry **bucket = R_MemProf_Table + (hash & (MEMPROF_NBUCKETS - 1));
+    memprof_entry *e;
+    for (e = *bucket; e != NULL; e = e->next)
+	if (e->hash == hash && e->type == type && streql(e->stack, buf))
+	    break;
+    if (e == NULL) {
+	e = malloc(sizeof(memprof_entry) + (p - buf) + 1);
+	if (e == NULL)
+	    return;
+	e->hash = hash;
+	e->type = type;
+	e->bytes = e->objects = 0;
+	strcpy(e->stack, buf);
+	e->next = *bucket;
+	*bucket = e;
+    }
+    double prob = -expm1(-(double) bytes / R_MemProf_Mean);
+    e->bytes += bytes / prob;
+    e->objects += 1 / prob;
+}
+
+static void R_InitMemSampling(SEXP filename, int append, double mean)
+{
+    R_MemProf_Outfile = RC_fopen(filename, append ? "a" : "w", TRUE);
+    if (R_MemProf_Outfile == NULL)
+	error(_("Rprofmem: cannot open output file '%s'"),
+	      translateChar(filename));
+    R_MemProf_Table = calloc(MEMPROF_NBUCKETS, sizeof(memprof_entry *));
+    if (R_MemProf_Table == NULL) {
+	fclose(R_MemProf_Outfile);
+	R_MemProf_Outfile = NULL;
+	error(_("Rprofmem: cannot allocate the sample table"));
+    }
+    R_MemProf_Mean = mean;
+    R_MemProf_State = (uint64_t) (currentTime() * 1e6) | 1;
+    memprof_countdown();
+}
+
+/* Write out and free the sample table; returns the samples as a list */
+static SEXP R_EndMemSampling(void)
+{
+    memprof_entry **table = R_MemProf_Table;
+    R_MemProf_Table = NULL;
+    R_MemSampleCountdown = INT64_MAX;
+
+    R_xlen_t n = 0;
+    for (int i = 0; i < MEMPROF_NBUCKETS; i++)
+	for (memprof_entry *e = table[i]; e != NULL; e = e->next)
+	    n++;
+    const char *nms[] = { "stack", "type", "bytes", "objects", "" };
+    SEXP ans = PROTECT(mkNamed(VECSXP, nms));
+    SEXP stack = allocVector(STRSXP, n);
+    SET_VECTOR_ELT(ans, 0, stack);
+    SEXP type = allocVector(STRSXP, n);
+    SET_VECTOR_ELT(ans, 1, type);
+    SEXP bytes = allocVector(REALSXP, n);
+    SET_VECTOR_ELT(ans, 2, bytes);
+    SEXP objects = allocVector(REALSXP, n);
+    SET_VECTOR_ELT(ans, 3, objects);
+
+    R_xlen_t k = 0;
+    for (int i = 0; i < MEMPROF_NBUCKETS; i++) {
+	memprof_entry *e = table[i];
+	while (e != NULL) {
+	    const char *tname = type2char(e->type);
+	    if (e->stack[0])
+		fprintf(R_MemProf_Outfile, "%s;<%s> %.0f\n", e->stack,
+			tname, e->bytes);
+	    else
+		fprintf(R_MemProf_Outfile, "<%s> %.0f\n", tname, e->bytes);
+	    SET_STRING_ELT(stack, k, mkChar(e->stack));
+	    SET_STRING_ELT(type, k, mkChar(tname));
+	    REAL(bytes)[k] = e->bytes;
+	    REAL(objects)[k] = e->objects;
+	    k++;
+	    memprof_entry *next = e->next;
+	    free(e);
+	    e = next;
+	}
+    }
+    free(table);
+    fclose(R_MemProf_Outfile);
+    R_MemProf_Outfile = NULL;
+    UNPROTECT(1);
+    return ans;
+}
+
+/*******************************************/
+/* Non-sampling memory use profiler
+   reports all large vector heap
+   allocations and all calls to GetNewPage */
+/*******************************************/
+
+#ifdef R_MEMORY_PROFILING
 static int R_IsMemReporting;  /* Rboolean more appropriate? */
 static FILE *R_MemReportingOutfile;
 static R_size_t R_MemReportingThreshold;
@@ -4880,33 +6206,51 @@ static void R_InitMemReporting(SEXP filename, int append,
     R_IsMemReporting = 1;
     return;
 }
+#endif /* R_MEMORY_PROFILING */
 
 SEXP do_Rprofmem(SEXP args)
 {
-    SEXP filename;
-    R_size_t threshold = 0;
+    SEXP filename, ans = R_NilValue;
     int append_mode;
 
     if (!isString(CAR(args)) || (LENGTH(CAR(args))) != 1)
 	error(_("invalid '%s' argument"), "filename");
     append_mode = asLogical(CADR(args));
     filename = STRING_ELT(CAR(args), 0);
-    double tdbl = REAL(CADDR(args))[0];
-    if (tdbl > 0) {
-	if (tdbl >= (double) R_SIZE_T_MAX)
-	    threshold = R_SIZE_T_MAX;
-	else
-	    threshold = (R_size_t) tdbl;
+    double sample_bytes = asReal(CADDDR(args));
+    if (ISNAN(sample_bytes) || sample_bytes < 0)
+	error(_("invalid '%s' argument"), "sample.bytes");
+
+    /* starting or stopping either profiler stops both */
+    if (R_MemProf_Table != NULL)
+	ans = R_EndMemSampling();
+    PROTECT(ans);
+#ifdef R_MEMORY_PROFILING
+    R_EndMemReporting();
+#endif
+    if (strlen(CHAR(filename)) && sample_bytes > 0)
+	R_InitMemSampling(filename, append_mode, sample_bytes);
+    else {
+#ifdef R_MEMORY_PROFILING
+	R_size_t threshold = 0;
+	double tdbl = REAL(CADDR(args))[0];
+	if (tdbl > 0) {
+	    if (tdbl >= (double) R_SIZE_T_MAX)
+		threshold = R_SIZE_T_MAX;
+	    else
+		threshold = (R_size_t) tdbl;
+	}
+	if (strlen(CHAR(filename)))
+	    R_InitMemReporting(filename, append_mode, threshold);
+#else
+	if (strlen(CHAR(filename)))
+	    error(_("memory profiling is not available on this system"));
+#endif
     }
-    if (strlen(CHAR(filename)))
-	R_InitMemReporting(filename, append_mode, threshold);
-    else
-	R_EndMemReporting();
-    return R_NilValue;
+    UNPROTECT(1);
+    return ans;
 }
 
-#endif /* R_MEMORY_PROFILING */
-
 /* RBufferUtils, moved from deparse.c */
 
 #include "RBufferUtils.h"
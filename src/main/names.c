@@ -701,6 +701,9 @@ FUNTAB R_FunTab[] =
 {"gcinfo",	do_gcinfo,	0,	11,	1,	{PP_FUNCALL, PREC_FN,	0}},
 {"gctorture",	do_gctorture,	0,	111,	1,	{PP_FUNCALL, PREC_FN,	0}},
 {"gctorture2",	do_gctorture2,	0,	11,	3,	{PP_FUNCALL, PREC_FN,	0}},
+{"gc.incremental",do_gcincremental,0,	11,	1,	{PP_FUNCALL, PREC_FN,	0}},
+{"gc.stats",	do_gcstats,	0,	11,	1,	{PP_FUNCALL, PREC_FN,	0}},
+{"stringCacheStats",do_stringcachestats,0,11,	1,	{PP_FUNCALL, PREC_FN,	0}},
 {"memory.profile",do_memoryprofile, 0,	11,	0,	{PP_FUNCALL, PREC_FN,	0}},
 {"mem.maxVSize",do_maxVSize,	0,	11,	1,	{PP_FUNCALL, PREC_FN,	0}},
 {"mem.maxNSize",do_maxNSize,	0,	11,	1,	{PP_FUNCALL, PREC_FN,	0}},
@@ -736,6 +739,7 @@ FUNTAB R_FunTab[] =
 {"qsort",	do_qsort,	0,	11,	2,	{PP_FUNCALL, PREC_FN,	0}},
 {"radixsort",	do_radixsort,	0,	11,	-1,	{PP_FUNCALL, PREC_FN,	0}},
 {"order",	do_order,	0,	11,	-1,	{PP_FUNCALL, PREC_FN,	0}},
+{"porder",	do_porder,	0,	11,	4,	{PP_FUNCALL, PREC_FN,	0}},
 {"rank",	do_rank,	0,	11,	3,	{PP_FUNCALL, PREC_FN,	0}},
 {"scan",	do_scan,	0,	11,	19,	{PP_FUNCALL, PREC_FN,	0}},
 {"t.default",	do_transpose,	0,	11,	1,	{PP_FUNCALL, PREC_FN,	0}},
@@ -777,6 +781,9 @@ FUNTAB R_FunTab[] =
 {"Cstack_info", do_Cstack_info,	0,	11,	0,	{PP_FUNCALL, PREC_FN,	0}},
 {"mmap_file",	do_mmap_file,	0,	11,	-1,	{PP_FUNCALL, PREC_FN,	0}},
 {"munmap_file",	do_munmap_file,	0,	111,	1,	{PP_FUNCALL, PREC_FN,	0}},
+{"mmap_columns",	do_mmap_columns,0,	11,	2,	{PP_FUNCALL, PREC_FN,	0}},
+{"compressVector",do_compressVector,0,	11,	1,	{PP_FUNCALL, PREC_FN,	0}},
+{"hashIndex",	do_hashIndex,	0,	11,	1,	{PP_FUNCALL, PREC_FN,	0}},
 {"wrap_meta",	do_wrap_meta,	0,	11,	3,	{PP_FUNCALL, PREC_FN,	0}},
 {"tryWrap",	do_tryWrap,	0,	11,	1,	{PP_FUNCALL, PREC_FN,	0}},
 {"altrep_class",do_altrep_class, 0,	11,	1,	{PP_FUNCALL, PREC_FN,	0}},
@@ -832,6 +839,7 @@ FUNTAB R_FunTab[] =
 {"inherits",	do_inherits,	0,	11,	3,	{PP_FUNCALL, PREC_FN,	0}},
 {"UseMethod",	do_usemethod,	0,     200,	-1,	{PP_FUNCALL, PREC_FN,	0}},
 {"NextMethod",	do_nextmethod,	0,     210,	-1,	{PP_FUNCALL, PREC_FN,	0}},
+{"S3dispatchCacheStats",do_dispatchcachestats,0,11,	1,	{PP_FUNCALL, PREC_FN,	0}},
 {"standardGeneric",do_standardGeneric,0, 201,	-1,	{PP_FUNCALL, PREC_FN,	0}},
 
 /* date-time manipulations */
@@ -859,6 +867,8 @@ FUNTAB R_FunTab[] =
 {"getconst", do_getconst,       0,      11,     2,      {PP_FUNCALL, PREC_FN, 0}},
 {"enableJIT",    do_enablejit,  0,      11,     1,      {PP_FUNCALL, PREC_FN, 0}},
 {"compilePKGS", do_compilepkgs, 0,      11,     1,      {PP_FUNCALL, PREC_FN, 0}},
+{"lookupCacheStats", do_lookupcachestats, 0, 11, 1,  {PP_FUNCALL, PREC_FN, 0}},
+{"jitProfile",  do_jitprofile,  0,      11,     1,      {PP_FUNCALL, PREC_FN, 0}},
 
 {"setNumMathThreads", do_setnumthreads,	      0, 11, 1, {PP_FUNCALL, PREC_FN, 0}},
 {"setMaxNumMathThreads", do_setmaxnumthreads, 0, 11, 1, {PP_FUNCALL, PREC_FN, 0}},
@@ -1201,6 +1211,59 @@ static SEXP mkSymMarker(SEXP pname)
     return ans;
 }
 
+/* The symbol table is a table of chains of symbols.  It starts with
+   HSIZE chains and grows when it holds more than two symbols per chain
+   on average, as programs using environments as large maps can create
+   millions of symbols, which are never removed.  The sizes are primes
+   about doubling each time. */
+static const int SymbolTableSizes[] = {
+    HSIZE, 98317, 196613, 393241, 786433, 1572869, 3145739, 6291469,
+    12582917, 25165843, 50331653, 100663319, 201326611, 402653189,
+    805306457, 1610612741, 0
+};
+static int R_SymbolCount = 0;
+
+/* Move the chains to a larger table.  This does not allocate from the
+   R heap, so no garbage collection can happen while chains are moved,
+   and if a larger table cannot be allocated the old one is kept. */
+static void growSymbolTable(void)
+{
+    int newsize = 0;
+    for (int k = 0; SymbolTableSizes[k]; k++)
+	if (SymbolTableSizes[k] > R_SymbolTableSize) {
+	    newsize = SymbolTableSizes[k];
+	    break;
+	}
+    if (newsize == 0)
+	return;
+    SEXP *newtable = (SEXP *) malloc(newsize * sizeof(SEXP));
+    if (newtable == NULL)
+	return;
+    for (int i = 0; i < newsize; i++) newtable[i] = R_NilValue;
+    for (int i = 0; i < R_SymbolTableSize; i++) {
+	SEXP s = R_SymbolTable[i];
+	while (s != R_NilValue) {
+	    SEXP next = CDR(s), pname = PRINTNAME(CAR(s));
+	    int hashcode = HASHASH(pname) ? HASHVALUE(pname) :
+		R_Newhashpjw(CHAR(pname));
+	    int j = hashcode % newsize;
+	    SETCDR(s, newtable[j]);
+	    newtable[j] = s;
+	    s = next;
+	}
+    }
+    free(R_SymbolTable);
+    R_SymbolTable = newtable;
+    R_SymbolTableSize = newsize;
+}
+
+static R_INLINE void addToSymbolTable(SEXP sym, int i)
+{
+    R_SymbolTable[i] = CONS(sym, R_SymbolTable[i]);
+    if (++R_SymbolCount > 2 * R_SymbolTableSize)
+	growSymbolTable();
+}
+
 /* initialize the symbol table */
 void attribute_hidden InitNames(void)
 {
@@ -1259,7 +1322,7 @@ SEXP install(const char *name)
     int i, hashcode;
 
     hashcode = R_Newhashpjw(name);
-    i = hashcode % HSIZE;
+    i = hashcode % R_SymbolTableSize;
     /* Check to see if the symbol is already present;  if it is, return it. */
     for (sym = R_SymbolTable[i]; sym != R_NilValue; sym = CDR(sym))
 	if (strcmp(name, CHAR(PRINTNAME(CAR(sym)))) == 0) return (CAR(sym));
@@ -1272,7 +1335,7 @@ SEXP install(const char *name)
     SET_HASHVALUE(PRINTNAME(sym), hashcode);
     SET_HASHASH(PRINTNAME(sym), 1);
 
-    R_SymbolTable[i] = CONS(sym, R_SymbolTable[i]);
+    addToSymbolTable(sym, i);
     return (sym);
 }
 
@@ -1292,7 +1355,7 @@ SEXP installNoTrChar(SEXP charSXP)
     } else {
 	hashcode = HASHVALUE(charSXP);
     }
-    i = hashcode % HSIZE;
+    i = hashcode % R_SymbolTableSize;
     /* Check to see if the symbol is already present;  if it is, return it. */
     for (sym = R_SymbolTable[i]; sym != R_NilValue; sym = CDR(sym))
 	if (strcmp(CHAR(charSXP), CHAR(PRINTNAME(CAR(sym)))) == 0) return (CAR(sym));
@@ -1316,7 +1379,7 @@ SEXP installNoTrChar(SEXP charSXP)
 	UNPROTECT(1);
     }
 
-    R_SymbolTable[i] = CONS(sym, R_SymbolTable[i]);
+    addToSymbolTable(sym, i);
     return (sym);
 }
 
@@ -167,54 +167,196 @@ void R_warn_S3_for_S4(SEXP method) {
 }
 #endif
 
-static SEXP findFunInEnvRange(SEXP symbol, SEXP rho, SEXP target)
+/* Look for a function bound to symbol in the frame of rho.  If ploc
+   is not NULL the frame is searched for the dispatch cache below:
+   *ploc is set to the binding found, or to R_UnboundValue for good if
+   the search cannot be cached, which includes skipping a binding to
+   something other than a function. */
+static SEXP findFunInFrame(SEXP symbol, SEXP rho, SEXP *ploc)
 {
     SEXP vl;
-    while(rho != R_EmptyEnv) {
-	vl = R_findVarInFrame(rho, symbol);
-	if (vl != R_UnboundValue) {
-	    if (TYPEOF(vl) == PROMSXP) {
-		PROTECT(vl);
-		vl = eval(vl, rho);
-		UNPROTECT(1);
-	    }
-	    if ((TYPEOF(vl) == CLOSXP ||
-		 TYPEOF(vl) == BUILTINSXP ||
-		 TYPEOF(vl) == SPECIALSXP))
-		return (vl);
-	}
-	if(rho == target)
+    if (ploc != NULL) {
+	SEXP loc = R_findVarLocInFrameForCache(rho, symbol);
+	if (loc == R_NilValue)
 	    return (R_UnboundValue);
-	else
-	    rho = ENCLOS(rho);
+	if (*ploc != R_UnboundValue)
+	    *ploc = loc;
+    }
+    vl = R_findVarInFrame(rho, symbol);
+    if (vl != R_UnboundValue) {
+	if (TYPEOF(vl) == PROMSXP) {
+	    PROTECT(vl);
+	    vl = eval(vl, rho);
+	    UNPROTECT(1);
+	}
+	if ((TYPEOF(vl) == CLOSXP ||
+	     TYPEOF(vl) == BUILTINSXP ||
+	     TYPEOF(vl) == SPECIALSXP))
+	    return (vl);
+	if (ploc != NULL)
+	    *ploc = R_UnboundValue;
     }
     return (R_UnboundValue);
 }
 
-static SEXP findFunWithBaseEnvAfterGlobalEnv(SEXP symbol, SEXP rho)
+/* Search for a method from the top level environment of the call: in
+   the frame of top if intop is true, in the S3 methods table of the
+   environment where the generic is defined and then from the
+   enclosure of top, with base after the global environment. */
+static SEXP lookupMethodFromTop(SEXP method, SEXP rho, SEXP top,
+				SEXP defrho, Rboolean intop, SEXP *ploc)
 {
-    SEXP vl;
-    while(rho != R_EmptyEnv) {
-	vl = R_findVarInFrame(rho, symbol);
-	if (vl != R_UnboundValue) {
-	    if (TYPEOF(vl) == PROMSXP) {
-		PROTECT(vl);
-		vl = eval(vl, rho);
-		UNPROTECT(1);
-	    }
-	    if ((TYPEOF(vl) == CLOSXP ||
-		 TYPEOF(vl) == BUILTINSXP ||
-		 TYPEOF(vl) == SPECIALSXP))
-		return (vl);
+    SEXP val, frame;
+    static SEXP s_S3MethodsTable = NULL;
+
+    if (intop) {
+	val = findFunInFrame(method, top, ploc);
+	if (val != R_UnboundValue)
+	    return val;
+    }
+
+    /* We assume here that no one registered a non-function, and that
+       the table itself is not replaced */
+    if (!s_S3MethodsTable)
+	s_S3MethodsTable = install(".__S3MethodsTable__.");
+    SEXP table = R_findVarInFrame(defrho, s_S3MethodsTable);
+    if (TYPEOF(table) == PROMSXP) {
+	PROTECT(table);
+	table = eval(table, R_BaseEnv);
+	UNPROTECT(1); /* table */
+    }
+    if (TYPEOF(table) == ENVSXP) {
+	PROTECT(table);
+	if (ploc != NULL) {
+	    SEXP loc = R_findVarLocInFrameForCache(table, method);
+	    if (loc != R_NilValue && *ploc != R_UnboundValue)
+		*ploc = loc;
 	}
-	if(rho == R_GlobalEnv)
-	    rho = R_BaseEnv;
-	else
-	    rho = ENCLOS(rho);
+	val = R_findVarInFrame(table, method);
+	UNPROTECT(1); /* table */
+	if (TYPEOF(val) == PROMSXP) {
+	    PROTECT(val);
+	    val = eval(val, rho);
+	    UNPROTECT(1); /* val */
+	}
+	if(val != R_UnboundValue)
+	    return val;
+    }
+
+    for (frame = top == R_GlobalEnv ? R_BaseEnv : ENCLOS(top);
+	 frame != R_EmptyEnv;
+	 frame = frame == R_GlobalEnv ? R_BaseEnv : ENCLOS(frame)) {
+	val = findFunInFrame(method, frame, ploc);
+	if (val != R_UnboundValue)
+	    return val;
     }
     return (R_UnboundValue);
 }
 
+/* Method lookup cache.  The search from the top level environment of
+   the call is the expensive part of a method lookup, as most methods
+   are found in a namespace or in the S3 methods table of a namespace
+   after failing to find methods for other classes all along the
+   search path.  Its result, including not finding a method, is kept
+   for each method name, top level environment and environment of the
+   generic together with the binding found and the value of
+   R_BindingEpoch.  The frames searched are flagged so that new
+   bindings in them, which include registering a method in a methods
+   table, increment the epoch (see envir.c); other changes to the
+   binding found are detected by comparing its value.  The frames
+   between the calling environment and its top level environment are
+   searched as before.
+
+   The cache is a direct mapped table; entries keep the environments
+   alive, so only locked or global environments are used as keys. */
+
+#define DISPATCH_CACHE_SIZE 1024
+#define DISPATCH_CACHE_INDEX(m, t, d)					\
+    ((int) ((((uintptr_t) (m)) >> 4 ^ ((uintptr_t) (t)) >> 6 ^		\
+	     ((uintptr_t) (d)) >> 8) & (DISPATCH_CACHE_SIZE - 1)))
+#define DISPATCH_CACHE_SLOTS 5 /* method, top, defrho, loc, value */
+
+static SEXP DispatchCacheTable = NULL;
+static R_size_t dispatch_cache_epoch[DISPATCH_CACHE_SIZE];
+
+static struct {
+    double hits, misses, stale;
+} dispatch_cache_stats;
+
+static R_INLINE Rboolean dispatchCacheKey(SEXP env)
+{
+    return env == R_GlobalEnv || env == R_BaseNamespace ||
+	R_EnvironmentIsLocked(env);
+}
+
+static SEXP lookupMethodCached(SEXP method, SEXP rho, SEXP top,
+			       SEXP defrho)
+{
+    int i = DISPATCH_CACHE_INDEX(method, top, defrho);
+    R_xlen_t k = (R_xlen_t) i * DISPATCH_CACHE_SLOTS;
+
+    if (DispatchCacheTable != NULL &&
+	VECTOR_ELT(DispatchCacheTable, k) == method &&
+	VECTOR_ELT(DispatchCacheTable, k + 1) == top &&
+	VECTOR_ELT(DispatchCacheTable, k + 2) == defrho) {
+	if (dispatch_cache_epoch[i] == R_BindingEpoch) {
+	    R_varloc_t loc = { VECTOR_ELT(DispatchCacheTable, k + 3) };
+	    SEXP val = VECTOR_ELT(DispatchCacheTable, k + 4);
+	    if (loc.cell == R_NilValue) {
+		dispatch_cache_stats.hits++;
+		return R_UnboundValue;
+	    }
+	    SEXP cur = R_GetVarLocValue(loc);
+	    if (TYPEOF(cur) == PROMSXP && PROMISE_IS_EVALUATED(cur))
+		cur = PRVALUE(cur);
+	    if (cur == val) {
+		dispatch_cache_stats.hits++;
+		return val;
+	    }
+	}
+	dispatch_cache_stats.stale++;
+    }
+    dispatch_cache_stats.misses++;
+
+    SEXP loc = R_NilValue;
+    SEXP val = PROTECT(lookupMethodFromTop(method, rho, top, defrho, TRUE,
+					   &loc));
+    if (loc != R_UnboundValue) {
+	if (DispatchCacheTable == NULL)
+	    R_PreserveObject(DispatchCacheTable =
+			     allocVector(VECSXP, DISPATCH_CACHE_SIZE *
+					 DISPATCH_CACHE_SLOTS));
+	SET_VECTOR_ELT(DispatchCacheTable, k, method);
+	SET_VECTOR_ELT(DispatchCacheTable, k + 1, top);
+	SET_VECTOR_ELT(DispatchCacheTable, k + 2, defrho);
+	SET_VECTOR_ELT(DispatchCacheTable, k + 3, loc);
+	SET_VECTOR_ELT(DispatchCacheTable, k + 4, val);
+	dispatch_cache_epoch[i] = R_BindingEpoch;
+    }
+    UNPROTECT(1); /* val */
+    return val;
+}
+
+attribute_hidden SEXP do_dispatchcachestats(SEXP call, SEXP op, SEXP args,
+					    SEXP rho)
+{
+    checkArity(op, args);
+    int reset = asLogical(CAR(args));
+    if (reset == NA_LOGICAL)
+	error(_("invalid '%s' argument"), "reset");
+
+    const char *nms[] = {"hits", "misses", "invalidations", ""};
+    SEXP ans = PROTECT(mkNamed(REALSXP, nms));
+    REAL(ans)[0] = dispatch_cache_stats.hits;
+    REAL(ans)[1] = dispatch_cache_stats.misses;
+    REAL(ans)[2] = dispatch_cache_stats.stale;
+    if (reset)
+	dispatch_cache_stats.hits = dispatch_cache_stats.misses =
+	    dispatch_cache_stats.stale = 0;
+    UNPROTECT(1); /* ans */
+    return ans;
+}
+
 /*  usemethod  -  calling functions need to evaluate the object
  *  (== 2nd argument).	They also need to ensure that the
  *  argument list is set up in the correct manner.
@@ -233,9 +375,7 @@ static SEXP findFunWithBaseEnvAfterGlobalEnv(SEXP symbol, SEXP rho)
 attribute_hidden
 SEXP R_LookupMethod(SEXP method, SEXP rho, SEXP callrho, SEXP defrho)
 {
-    SEXP val, top = R_NilValue;	/* -Wall */
-    static SEXP s_S3MethodsTable = NULL;
-    PROTECT_INDEX validx;
+    SEXP val, frame, top = R_NilValue;	/* -Wall */
 
     if (TYPEOF(callrho) != ENVSXP) {
 	if (TYPEOF(callrho) == NILSXP)
@@ -254,42 +394,24 @@ SEXP R_LookupMethod(SEXP method, SEXP rho, SEXP callrho, SEXP defrho)
 
     /* This evaluates promises */
     PROTECT(top = topenv(R_NilValue, callrho));
-    val = findFunInEnvRange(method, callrho, top);
-    if(val != R_UnboundValue) {
-	UNPROTECT(1); /* top */
-	return val;
-    }
 
-    PROTECT_WITH_INDEX(val, &validx);
-    /* We assume here that no one registered a non-function */
-    if (!s_S3MethodsTable)
-	s_S3MethodsTable = install(".__S3MethodsTable__.");
-    SEXP table = R_findVarInFrame(defrho, s_S3MethodsTable);
-    if (TYPEOF(table) == PROMSXP) {
-	PROTECT(table);
-	table = eval(table, R_BaseEnv);
-	UNPROTECT(1); /* table */
-    }
-    if (TYPEOF(table) == ENVSXP) {
-	PROTECT(table);
-	REPROTECT(val = R_findVarInFrame(table, method), validx);
-	UNPROTECT(1); /* table */
-	if (TYPEOF(val) == PROMSXP) 
-	    REPROTECT(val = eval(val, rho), validx);
+    /* The frames below top are usually those of closures, which are
+       searched every time */
+    for (frame = callrho; frame != top && frame != R_EmptyEnv;
+	 frame = ENCLOS(frame)) {
+	val = findFunInFrame(method, frame, NULL);
 	if(val != R_UnboundValue) {
-	    UNPROTECT(2); /* top, val */
+	    UNPROTECT(1); /* top */
 	    return val;
 	}
-    } 
+    }
 
-    if (top == R_GlobalEnv)
-	top = R_BaseEnv;
+    if (frame == top && dispatchCacheKey(top) && dispatchCacheKey(defrho))
+	val = lookupMethodCached(method, rho, top, defrho);
     else
-	top = ENCLOS(top);
-    REPROTECT(val = findFunWithBaseEnvAfterGlobalEnv(method, top),
-	      validx);
-
-    UNPROTECT(2); /* top, val */
+	val = lookupMethodFromTop(method, rho, top, defrho, frame == top,
+				  NULL);
+    UNPROTECT(1); /* top */
     return val;
 }
 
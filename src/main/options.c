@@ -79,6 +79,10 @@
  *	"nwarnings"
 
  *	"matprod"
+ *	"arith.threads"		./arithmetic.c
+ *	"summary.threads"	./summary.c
+ *	"hash.threads"		./unique.c
+ *	"sort.threads"		./radixsort.c
  *      "PCRE_study"
  *      "PCRE_use_JIT"
 
@@ -272,6 +276,33 @@ int attribute_hidden R_SetOptionWarn(int w)
 /* Note that options are stored as a dotted pair list */
 /* This is barely historical, but is also useful. */
 
+/* arith.threads, summary.threads, hash.threads and sort.threads give
+   the number of threads of an OpenMP loop, one running it sequentially.
+   Their initial values can be set by environment variables. */
+static SEXP InitThreadsOption(SEXP v, const char *name, const char *envvar,
+			      int *var)
+{
+    char *p = getenv(envvar);
+    if (p && atoi(p) >= 1)
+	*var = atoi(p);
+    SET_TAG(v, install(name));
+    SETCAR(v, ScalarInteger(*var));
+    return CDR(v);
+}
+
+static SEXP SetThreadsOption(SEXP tag, SEXP value, int *var)
+{
+    int k = asInteger(value);
+    if (k == NA_INTEGER || k < 1 || LENGTH(value) != 1)
+	error(_("invalid value for '%s'"), CHAR(PRINTNAME(tag)));
+#ifndef _OPENMP
+    if (k > 1)
+	warning(_("OpenMP is not supported in this build of R"));
+#endif
+    *var = k;
+    return SetOption(tag, ScalarInteger(k));
+}
+
 attribute_hidden void InitOptions(void)
 {
     SEXP val, v;
@@ -279,9 +310,9 @@ attribute_hidden void InitOptions(void)
 
     /* options set here should be included into mandatory[] in do_options */
 #ifdef HAVE_RL_COMPLETION_MATCHES
-    PROTECT(v = val = allocList(30));
+    PROTECT(v = val = allocList(34));
 #else
-    PROTECT(v = val = allocList(29));
+    PROTECT(v = val = allocList(33));
 #endif
 
     SET_TAG(v, install("prompt"));
@@ -369,6 +400,15 @@ attribute_hidden void InitOptions(void)
     SETCAR(v, mkString(p));
     v = CDR(v);
 
+    v = InitThreadsOption(v, "arith.threads", "R_ARITH_THREADS",
+			  &R_ArithThreads);
+    v = InitThreadsOption(v, "summary.threads", "R_SUMMARY_THREADS",
+			  &R_SummaryThreads);
+    v = InitThreadsOption(v, "hash.threads", "R_HASH_THREADS",
+			  &R_HashThreads);
+    v = InitThreadsOption(v, "sort.threads", "R_SORT_THREADS",
+			  &R_SortThreads);
+
     SET_TAG(v, install("PCRE_study"));
     if (R_PCRE_study == -1)
 	SETCAR(v, ScalarLogical(TRUE));
@@ -557,7 +597,8 @@ attribute_hidden SEXP do_options(SEXP call, SEXP op, SEXP args, SEXP rho)
 		  "check.bounds", "keep.source", "keep.source.pkgs",
 		  "keep.parse.data", "keep.parse.data.pkgs", "warning.length",
 		  "nwarnings", "OutDec", "browserNLdisabled", "CBoundsCheck",
-		  "matprod", "PCRE_study", "PCRE_use_JIT",
+		  "matprod", "arith.threads", "summary.threads",
+		  "hash.threads", "sort.threads", "PCRE_study", "PCRE_use_JIT",
 		  "PCRE_limit_recursion", "rl_word_breaks",
 		  "max.contour.segments", "warnPartialMatchDollar",
 		  "warnPartialMatchArgs", "warnPartialMatchAttr",
@@ -823,6 +864,18 @@ attribute_hidden SEXP do_options(SEXP call, SEXP op, SEXP args, SEXP rho)
 		    error(_("invalid value for '%s'"), CHAR(namei));
 		SET_VECTOR_ELT(value, i, SetOption(tag, duplicate(argi)));
 	    }
+	    else if (streql(CHAR(namei), "arith.threads"))
+		SET_VECTOR_ELT(value, i,
+			       SetThreadsOption(tag, argi, &R_ArithThreads));
+	    else if (streql(CHAR(namei), "summary.threads"))
+		SET_VECTOR_ELT(value, i,
+			       SetThreadsOption(tag, argi, &R_SummaryThreads));
+	    else if (streql(CHAR(namei), "hash.threads"))
+		SET_VECTOR_ELT(value, i,
+			       SetThreadsOption(tag, argi, &R_HashThreads));
+	    else if (streql(CHAR(namei), "sort.threads"))
+		SET_VECTOR_ELT(value, i,
+			       SetThreadsOption(tag, argi, &R_SortThreads));
 	    else if (streql(CHAR(namei), "PCRE_study")) {
 		if (TYPEOF(argi) == LGLSXP) {
 		    int k = asLogical(argi) > 0;
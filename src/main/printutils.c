@@ -230,10 +230,13 @@ const char *EncodeReal0(double x, int w, int d, int e, const char *dec)
     return out;
 }
 
-static const char
-*EncodeRealDrop0(double x, int w, int d, int e, const char *dec)
+/* Reentrant part of EncodeRealDrop0: formats into buff, which must
+   have room for NB chars, and returns the result, which is buff or
+   buff2 (of 2*NB chars) when dec is not ".". */
+static char
+*encodeRealDrop0(double x, int w, int d, int e, const char *dec,
+		 char *buff, char *buff2)
 {
-    static char buff[NB], buff2[2*NB];
     char fmt[20], *out = buff;
 
     /* IEEE allows signed zeros (yuck!) */
@@ -287,6 +290,13 @@ static const char
     return out;
 }
 
+static const char
+*EncodeRealDrop0(double x, int w, int d, int e, const char *dec)
+{
+    static char buff[NB], buff2[2*NB];
+    return encodeRealDrop0(x, w, d, e, dec, buff, buff2);
+}
+
 attribute_hidden SEXP StringFromReal(double x, int *warn)
 {
     int w, d, e;
@@ -295,6 +305,64 @@ attribute_hidden SEXP StringFromReal(double x, int *warn)
     else return mkChar(EncodeRealDrop0(x, w, d, e, OutDec));
 }
 
+/* The string StringFromReal gives for x, with decimal mark dec, written
+   to buf of length size.  Returns the length of the string, or -1 if x
+   is NA or the string does not fit.  As it only reads R_print, this
+   can be used to format many numbers in parallel, provided
+   R_print.digits <= DBL_DIG.
+
+   Whole numbers of at most R_print.digits digits, common in data, are
+   formatted directly: they need no rounding, and their widths in fixed
+   and scientific format, compared as in formatReal, depend only on
+   their numbers of digits and trailing zeros. */
+attribute_hidden int R_StringBufFromReal(double x, const char *dec,
+					 char *buf, int size)
+{
+    if (ISNA(x))
+	return -1;
+    double ax = fabs(x);
+    if (ax < 1e15 && ax == floor(ax)) {
+	char digits[16];
+	int nd = 0, nz = 0, len = 0;
+	for (int64_t u = (int64_t) ax; u > 0; u /= 10)
+	    digits[nd++] = (char) ('0' + u % 10); /* least significant first */
+	if (nd == 0)
+	    digits[nd++] = '0';
+	else
+	    while (digits[nz] == '0') nz++;
+	if (nd <= R_print.digits && size > 2 * nd + 8 + (int) strlen(dec)) {
+	    int neg = x < 0, nsig = nd - nz;
+	    int wF = neg + nd, wE = neg + (nsig > 1) + nsig - 1 + 4 + 1;
+	    if (neg) buf[len++] = '-';
+	    if (wF <= wE + R_print.scipen)
+		for (int i = nd - 1; i >= 0; i--)
+		    buf[len++] = digits[i];
+	    else {
+		buf[len++] = digits[nd - 1];
+		if (nsig > 1) {
+		    for (const char *r = dec; *r; r++)
+			buf[len++] = *r;
+		    for (int i = nd - 2; i >= nz; i--)
+			buf[len++] = digits[i];
+		}
+		len += snprintf(buf + len, size - len, "e+%02d", nd - 1);
+	    }
+	    buf[len] = '\0';
+	    return len;
+	}
+    }
+
+    int w, d, e;
+    char buff[NB], buff2[2*NB];
+    formatReal(&x, 1, &w, &d, &e, 0);
+    const char *out = encodeRealDrop0(x, w, d, e, dec, buff, buff2);
+    size_t len = strlen(out);
+    if (len >= (size_t) size)
+	return -1;
+    memcpy(buf, out, len + 1);
+    return (int) len;
+}
+
 
 attribute_hidden
 const char *EncodeReal2(double x, int w, int d, int e)
@@ -627,14 +627,14 @@ static void setNumericRounding(int dround)
     dmask2 = 0xffffffffffffffff << dround * 8;
 }
 
-static union {
-    double d;
-    unsigned long long ull;
-} u;
-
+/* u is local so that keys can be computed in parallel */
 static
 unsigned long long dtwiddle(void *p, int i, int order)
 {
+    union {
+	double d;
+	unsigned long long ull;
+    } u;
     u.d = order * ((double *)p)[i]; // take care of 'order' at the beginning
     if (R_FINITE(u.d)) {
 	u.ull = (u.d != 0.0) ? u.ull + ((u.ull & dmask1) << 1) : 0;
@@ -651,8 +651,7 @@ unsigned long long dtwiddle(void *p, int i, int order)
 
 static Rboolean dnan(void *p, int i)
 {
-    u.d = ((double *) p)[i];
-    return (ISNAN(u.d));
+    return (ISNAN(((double *) p)[i]));
 }
 
 static unsigned long long (*twiddle) (void *, int, int);
@@ -1543,6 +1542,255 @@ static void dsort(double *x, int *o, int n)
     }
 }
 
+// Releases ustr, restoring the truelengths of its strings and of
+// those saved by savetl().
+static void ustr_free(void)
+{
+    for(int i = 0; i < ustr_n; i++)
+        SET_TRLEN(ustr[i], 0);
+    maxlen = 1;  // reset global. Minimum needed to count "" and NA
+    ustr_n = 0;
+    savetl_end();
+    free(ustr);
+    ustr = NULL;
+    ustr_alloc = 0;
+}
+
+// nalast = NA: drops the 0s marking NAs from the ordering ans.
+static SEXP drop_zeros(SEXP ans, int n)
+{
+    int *o = INTEGER(ans), zeros = 0;
+    for (int i = 0; i < n; i++) {
+        if (o[i] == 0)
+            zeros++;
+    }
+    if (zeros > 0) {
+        PROTECT(ans);
+        SEXP ans2 = allocVector(INTSXP, n - zeros);
+        int *o2 = INTEGER(ans2);
+        for (int i = 0, i2 = 0; i < n; i++) {
+            if (o[i] > 0)
+                o2[i2++] = o[i];
+        }
+        UNPROTECT(1);
+        return ans2;
+    }
+    return ans;
+}
+
+/* Parallel ordering.
+
+   With options(sort.threads) above one, long vectors are ordered
+   without grouping information (retGrp = FALSE) by a least significant
+   digit radix sort: keys from the last to the first, and bytes from
+   the least to the most significant.  Each pass counts the byte values
+   of contiguous chunks of the keys in parallel and then moves the
+   chunks in parallel, each to its own offsets within the buckets.
+   The passes are stable, so the result is the stable ordering that the
+   code above computes.  The keys are those used above: icheck() of
+   integers and logicals, dtwiddle() of doubles and icheck() of the
+   ranks that csort_pre() gives strings.
+
+   The code above is used for several keys with nalast = NA, and for an
+   already sorted integer or double key, which it recognizes in a
+   single scan. */
+
+#define RADIX_PARALLEL_MIN 1000000
+
+#ifdef _OPENMP
+# define R_DO_PRAGMA(x) _Pragma(#x)
+#else
+# define R_DO_PRAGMA(x)
+#endif
+#define OMP_PARALLEL_FOR_CHUNKS(nth)					\
+    R_DO_PRAGMA(omp parallel for num_threads(nth) schedule(static, 1))
+#define CHUNK_START(t) ((int) ((int64_t) n * (t) / nth))
+
+// The number of threads to order x and the keys in args with, or 1
+// to use the sequential code.
+static int radix_threads(SEXP x, SEXP args, int narg, Rboolean retGrp,
+			 int n)
+{
+#ifdef _OPENMP
+    int nth = R_SortThreads;
+    if (nth <= 1 || retGrp || !sortStr || n < RADIX_PARALLEL_MIN ||
+	(nalast == 0 && narg > 1))
+	return 1;
+    for (SEXP ap = CONS(x, args); ap != R_NilValue; ap = CDR(ap))
+	switch (TYPEOF(CAR(ap))) {
+	case INTSXP: case LGLSXP: case REALSXP: case STRSXP:
+	    break;
+	default:
+	    return 1;
+	}
+    if (narg == 1) {
+	// stackgrps is FALSE, so this pushes no groups
+	switch (TYPEOF(x)) {
+	case INTSXP:
+	case LGLSXP:
+	    if (isorted(DATAPTR(x), n)) return 1;
+	    break;
+	case REALSXP:
+	    twiddle = &dtwiddle;
+	    is_nan  = &dnan;
+	    if (dsorted(DATAPTR(x), n)) return 1;
+	    break;
+	}
+    }
+    return nth;
+#else
+    return 1;
+#endif
+}
+
+// Sorts o by the keys k in one pass per byte; otmp and ktmp are
+// working memory of the same sizes, counts has 256 per thread.
+#define LSD_PASSES(ktype, nbytes) do {					\
+	ktype *kk = k, *kt = ktmp;					\
+	int *oo = o, *ot = otmp;					\
+	for (int b = 0; b < nbytes; b++) {				\
+	    int shift = 8 * b;						\
+	    OMP_PARALLEL_FOR_CHUNKS(nth)				\
+	    for (int t = 0; t < nth; t++) {				\
+		unsigned int *c = counts + 256 * t;			\
+		memset(c, 0, 256 * sizeof(unsigned int));		\
+		for (int i = CHUNK_START(t); i < CHUNK_START(t + 1); i++) \
+		    c[(kk[i] >> shift) & 0xff]++;			\
+	    }								\
+	    /* chunks in order within buckets, so the pass is stable */	\
+	    unsigned int pos = 0;					\
+	    Rboolean skip = FALSE;					\
+	    for (int v = 0; v < 256; v++) {				\
+		unsigned int start = pos;				\
+		for (int t = 0; t < nth; t++) {				\
+		    unsigned int cnt = counts[256 * t + v];		\
+		    counts[256 * t + v] = pos;				\
+		    pos += cnt;						\
+		}							\
+		if (pos - start == (unsigned int) n) skip = TRUE;	\
+	    }								\
+	    if (skip) continue; /* all keys have this byte */		\
+	    OMP_PARALLEL_FOR_CHUNKS(nth)				\
+	    for (int t = 0; t < nth; t++) {				\
+		unsigned int *c = counts + 256 * t;			\
+		for (int i = CHUNK_START(t); i < CHUNK_START(t + 1); i++) { \
+		    unsigned int j = c[(kk[i] >> shift) & 0xff]++;	\
+		    kt[j] = kk[i];					\
+		    ot[j] = oo[i];					\
+		}							\
+	    }								\
+	    ktype *ktmp2 = kk; kk = kt; kt = ktmp2;			\
+	    int *otmp2 = oo; oo = ot; ot = otmp2;			\
+	}								\
+	if (oo != o)							\
+	    memcpy(o, oo, n * sizeof(int));				\
+    } while (0)
+
+// Stably sorts the ordering o by the key x.
+static void lsd_sort(SEXP x, int *o, int *otmp, void *k, void *ktmp,
+		     unsigned int *counts, int n, int nth)
+{
+    void *xd = DATAPTR(x);
+    switch (TYPEOF(x)) {
+    case INTSXP:
+    case LGLSXP:
+    {
+	unsigned int *kk = k;
+	OMP_PARALLEL_FOR_CHUNKS(nth)
+	for (int t = 0; t < nth; t++)
+	    for (int i = CHUNK_START(t); i < CHUNK_START(t + 1); i++)
+		kk[i] = (unsigned int) icheck(((int *) xd)[o[i] - 1])
+		    ^ 0x80000000U;
+	LSD_PASSES(unsigned int, 4);
+	break;
+    }
+    case STRSXP:
+    {
+	unsigned int *kk = k;
+	csort_pre(xd, n);
+	OMP_PARALLEL_FOR_CHUNKS(nth)
+	for (int t = 0; t < nth; t++)
+	    for (int i = CHUNK_START(t); i < CHUNK_START(t + 1); i++) {
+		SEXP s = ((SEXP *) xd)[o[i] - 1];
+		kk[i] = (unsigned int) icheck(s == NA_STRING ? NA_INTEGER :
+					      -TRLEN(s)) ^ 0x80000000U;
+	    }
+	LSD_PASSES(unsigned int, 4);
+	break;
+    }
+    case REALSXP:
+    {
+	unsigned long long *kk = k;
+	OMP_PARALLEL_FOR_CHUNKS(nth)
+	for (int t = 0; t < nth; t++)
+	    for (int i = CHUNK_START(t); i < CHUNK_START(t + 1); i++)
+		kk[i] = dtwiddle(xd, o[i] - 1, order);
+	LSD_PASSES(unsigned long long, 8);
+	break;
+    }
+    }
+}
+
+// Puts the ordering of x and the keys in args into o.
+static void radix_order_parallel(SEXP x, SEXP args, SEXP decreasing,
+				 int *o, int n, int narg, int nth)
+{
+    SEXP *keys = (SEXP *) R_alloc(narg, sizeof(SEXP));
+    size_t width = 4;
+    Rboolean hasStr = FALSE;
+    keys[0] = x;
+    for (int j = 1; j < narg; j++, args = CDR(args))
+	keys[j] = CAR(args);
+    for (int j = 0; j < narg; j++) {
+	if (TYPEOF(keys[j]) == REALSXP) width = 8;
+	if (TYPEOF(keys[j]) == STRSXP) hasStr = TRUE;
+    }
+
+    void *k = malloc(n * width), *ktmp = malloc(n * width);
+    int *otmp = (int *) malloc(n * sizeof(int));
+    unsigned int *counts =
+	(unsigned int *) malloc(nth * 256 * sizeof(unsigned int));
+    if (!k || !ktmp || !otmp || !counts) {
+	free(k); free(ktmp); free(otmp); free(counts);
+	error("Couldn't allocate working memory in do_radixsort, requested %d * %d bytes.",
+	      n, (int) (2 * width + sizeof(int)));
+    }
+
+    for (int i = 0; i < n; i++)
+	o[i] = i + 1;
+    if (hasStr)
+	savetl_init();
+    for (int j = narg - 1; j >= 0; j--) {
+	order = LOGICAL(decreasing)[j] ? -1 : 1;
+	lsd_sort(keys[j], o, otmp, k, ktmp, counts, n, nth);
+    }
+    if (hasStr) {
+	ustr_free();
+	free(cradix_counts);   cradix_counts=NULL; cradix_counts_alloc=0;
+	free(cradix_xtmp);     cradix_xtmp=NULL;   cradix_xtmp_alloc=0;
+    }
+    free(k); free(ktmp); free(otmp); free(counts);
+
+    if (nalast == 0) { // a single key: mark its NAs
+	void *xd = DATAPTR(x);
+	for (int i = 0; i < n; i++) {
+	    int j = o[i] - 1;
+	    switch (TYPEOF(x)) {
+	    case INTSXP:
+	    case LGLSXP:
+		if (((int *) xd)[j] == NA_INTEGER) o[i] = 0;
+		break;
+	    case REALSXP:
+		if (ISNAN(((double *) xd)[j])) o[i] = 0;
+		break;
+	    case STRSXP:
+		if (((SEXP *) xd)[j] == NA_STRING) o[i] = 0;
+		break;
+	    }
+	}
+    }
+}
+
 attribute_hidden SEXP do_radixsort(SEXP call, SEXP op, SEXP args, SEXP rho)
 {
     int n = -1, narg = 0, ngrp, tmp, *osub, thisgrpn;
@@ -1631,7 +1879,16 @@ attribute_hidden SEXP do_radixsort(SEXP call, SEXP op, SEXP args, SEXP rho)
     if (TYPEOF(x) == STRSXP) {
         checkEncodings(x);
     }
-    
+
+    int nth = radix_threads(x, args, narg, retGrp, n);
+    if (nth > 1) {
+	radix_order_parallel(x, args, decreasing, o, n, narg, nth);
+	if (nalast == 0)
+	    ans = drop_zeros(ans, n);
+	UNPROTECT(1);
+	return ans;
+    }
+
     savetl_init();   // from now on use Error not error.
 
     switch (TYPEOF(x)) {
@@ -1880,14 +2137,7 @@ attribute_hidden SEXP do_radixsort(SEXP call, SEXP op, SEXP args, SEXP rho)
     if (!sortStr && ustr_n != 0)
         Error("Internal error: at the end of do_radixsort sortStr == FALSE but ustr_n !=0 [%d]",
               ustr_n);
-    for(int i = 0; i < ustr_n; i++)
-        SET_TRLEN(ustr[i], 0);
-    maxlen = 1;  // reset global. Minimum needed to count "" and NA
-    ustr_n = 0;
-    savetl_end();
-    free(ustr);
-    ustr = NULL;
-    ustr_alloc = 0;
+    ustr_free();
 
     if (retGrp) {
         int maxgrpn = NA_INTEGER;
@@ -1911,22 +2161,8 @@ attribute_hidden SEXP do_radixsort(SEXP call, SEXP op, SEXP args, SEXP rho)
     }
 
     Rboolean dropZeros = !retGrp && !isSorted && nalast == 0;
-    if (dropZeros) {
-        int zeros = 0;
-        for (int i = 0; i < n; i++) {
-            if (o[i] == 0)
-                zeros++;
-        }
-        if (zeros > 0) {
-            PROTECT(ans = allocVector(INTSXP, n - zeros));
-            int *o2 = INTEGER(ans);
-            for (int i = 0, i2 = 0; i < n; i++) {
-                if (o[i] > 0)
-                    o2[i2++] = o[i];
-            }
-            UNPROTECT(1);
-        }
-    }
+    if (dropZeros)
+        ans = drop_zeros(ans, n);
     
     gsfree();
     free(radix_xsub);          radix_xsub=NULL;    radix_xsuballoc=0;
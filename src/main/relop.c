@@ -424,8 +424,8 @@ attribute_hidden SEXP do_relop_dflt(SEXP call, SEXP op, SEXP x, SEXP y)
 #define ISNA_INT(x) x == NA_INTEGER
 
 #define NR_HELPER(OP, type1, ACCESSOR1, ISNA1, type2, ACCESSOR2, ISNA2) do { \
-	type1 x1, *px1 = ACCESSOR1(s1);					\
-	type2 x2, *px2 = ACCESSOR2(s2);					\
+	type1 x1; const type1 *px1 = ACCESSOR1(s1);			\
+	type2 x2; const type2 *px2 = ACCESSOR2(s2);			\
 	int *pa = LOGICAL(ans);						\
         MOD_ITERATE2(n, n1, n2, i, i1, i2, {                            \
 	    x1 = px1[i1];						\
@@ -474,14 +474,14 @@ static SEXP numeric_relop(RELOP_TYPE code, SEXP s1, SEXP s2)
 
     if (isInteger(s1) || isLogical(s1)) {
         if (isInteger(s2) || isLogical(s2)) {
-            NUMERIC_RELOP(int, INTEGER, ISNA_INT, int, INTEGER, ISNA_INT);
+            NUMERIC_RELOP(int, INTEGER_RO, ISNA_INT, int, INTEGER_RO, ISNA_INT);
         } else {
-            NUMERIC_RELOP(int, INTEGER, ISNA_INT, double, REAL, ISNAN);
+            NUMERIC_RELOP(int, INTEGER_RO, ISNA_INT, double, REAL_RO, ISNAN);
         }
     } else if (isInteger(s2) || isLogical(s2)) {
-        NUMERIC_RELOP(double, REAL, ISNAN, int, INTEGER, ISNA_INT);
+        NUMERIC_RELOP(double, REAL_RO, ISNAN, int, INTEGER_RO, ISNA_INT);
     } else {
-        NUMERIC_RELOP(double, REAL, ISNAN, double, REAL, ISNAN);
+        NUMERIC_RELOP(double, REAL_RO, ISNAN, double, REAL_RO, ISNAN);
     }
 
     UNPROTECT(2);
@@ -923,6 +923,7 @@ static void NewMakeLists (SEXP obj, SEXP sym_list, SEXP env_list)
 	if (R_HasFancyBindings(obj))
 	    error(_("cannot save environment with locked/active bindings \
 in version 1 workspaces"));
+	R_OpenFrameToCells(obj); /* written as a table of chains */
 	HashAdd(obj, env_list);
 	/* FALLTHROUGH */
     case LISTSXP:
@@ -1104,6 +1104,7 @@ static void WriteItem (SEXP s, SEXP ref_table, R_outpstream_t stream)
 	    UNPROTECT(1);
 	}
 	else {
+	    R_OpenFrameToCells(s); /* written as a table of chains */
 	    OutInteger(stream, ENVSXP);
 	    OutInteger(stream, R_EnvironmentIsLocked(s) ? 1 : 0);
 	    WriteItem(ENCLOS(s), ref_table, stream);
@@ -468,9 +468,10 @@ static Rboolean fastpass_sortcheck(SEXP x, int wanted) {
     }
 
     /* Increasing, usually fairly short, sequences of integers often
-       arise as levels in as.factor.  A quick check here allows a fast
-       return in sort.int. */
-    if (! done && TYPEOF(x) == INTSXP && wanted > 0 && ! ALTREP(x)) {
+       arise as levels in as.factor, and already sorted data is often
+       sorted again.  A quick check here, which mostly stops at once on
+       unsorted data, allows a fast return in sort.int and order. */
+    if (! done && TYPEOF(x) == INTSXP && ! ALTREP(x)) {
 	R_xlen_t len = XLENGTH(x);
 	if (len > 0) {
 	    int *px = INTEGER(x);
@@ -478,7 +479,25 @@ static Rboolean fastpass_sortcheck(SEXP x, int wanted) {
 	    if (last != NA_INTEGER) {
 		for (R_xlen_t i = 1; i < len; i++) {
 		    int next = px[i];
-		    if (next < last || next == NA_INTEGER)
+		    if ((wanted > 0 ? next < last : next > last) ||
+			next == NA_INTEGER)
+			return FALSE;
+		    else last = next;
+		}
+		return TRUE;
+	    }
+	}
+    }
+    if (! done && TYPEOF(x) == REALSXP && ! ALTREP(x)) {
+	R_xlen_t len = XLENGTH(x);
+	if (len > 0) {
+	    double *px = REAL(x);
+	    double last = px[0];
+	    if (!ISNAN(last)) {
+		for (R_xlen_t i = 1; i < len; i++) {
+		    double next = px[i];
+		    if ((wanted > 0 ? next < last : next > last) ||
+			ISNAN(next))
 			return FALSE;
 		    else last = next;
 		}
@@ -1486,6 +1505,174 @@ attribute_hidden SEXP do_order(SEXP call, SEXP op, SEXP args, SEXP rho)
     } else return allocVector(INTSXP, 0);
 }
 
+/* Partial ordering: .Internal(porder(x, partial, na.last, decreasing))
+
+   Returns a permutation of the indices of x, without those of NAs if
+   na.last is NA, which agrees at the positions in 'partial' with the
+   ordering computed by do_order(), the other indices being on the
+   correct side of each of these as after psort().  As ties are broken
+   by index, the elements are totally ordered and the positions have
+   unique values.
+
+   If the largest position k is small compared with the length of x,
+   the first k elements are found by a single scan of x with a heap
+   and returned in order, followed by the others in increasing order;
+   otherwise partitioning as in Psort0() is used.
+*/
+
+#define PGREATER(i, j) greater(i, j, x, nalast ^ decreasing, decreasing, \
+			       R_NilValue)
+
+static void porder_siftdown(int *h, int n, int i, SEXP x, Rboolean nalast,
+			    Rboolean decreasing)
+{
+    int e = h[i];
+    for (int c = 2 * i + 1; c < n; c = 2 * i + 1) {
+	if (c + 1 < n && PGREATER(h[c + 1], h[c])) c++;
+	if (!PGREATER(h[c], e)) break;
+	h[i] = h[c];
+	i = c;
+    }
+    h[i] = e;
+}
+
+/* Puts the first k of the m indices in ind in order, the others after
+   them in the order they had. */
+static void porder_heap(int *ind, int m, int k, SEXP x, Rboolean nalast,
+			Rboolean decreasing)
+{
+    int *h = (int *) R_alloc(k, sizeof(int));
+    memcpy(h, ind, k * sizeof(int));
+    for (int i = k / 2 - 1; i >= 0; i--)
+	porder_siftdown(h, k, i, x, nalast, decreasing);
+    for (int i = k; i < m; i++)
+	if (PGREATER(h[0], ind[i])) {
+	    h[0] = ind[i];
+	    porder_siftdown(h, k, 0, x, nalast, decreasing);
+	}
+    for (int i = k - 1; i > 0; i--) {
+	int tmp = h[0]; h[0] = h[i]; h[i] = tmp;
+	porder_siftdown(h, i, 0, x, nalast, decreasing);
+    }
+    char *in = (char *) R_alloc(XLENGTH(x), sizeof(char));
+    memset(in, 0, XLENGTH(x));
+    for (int i = 0; i < k; i++) in[h[i]] = 1;
+    for (int i = m - 1, j = m - 1; i >= 0; i--)
+	if (!in[ind[i]]) ind[j--] = ind[i];
+    memcpy(ind, h, k * sizeof(int));
+}
+
+/* Puts ind[k] in place, as psort_body */
+static void porder_select(int *ind, int lo, int hi, int k, SEXP x,
+			  Rboolean nalast, Rboolean decreasing)
+{
+    int L, R, i, j, v, w;
+
+    for (L = lo, R = hi; L < R; ) {
+	v = ind[k];
+	for(i = L, j = R; i <= j;) {
+	    while (PGREATER(v, ind[i])) i++;
+	    while (PGREATER(ind[j], v)) j--;
+	    if (i <= j) { w = ind[i]; ind[i++] = ind[j]; ind[j--] = w; }
+	}
+	if (j < k) L = i;
+	if (k < i) R = j;
+    }
+}
+
+/* as Psort0, with 0-based positions p */
+static void porder_select0(int *ind, int lo, int hi, int *p, int np,
+			   SEXP x, Rboolean nalast, Rboolean decreasing)
+{
+    if(np < 1 || hi - lo < 1) return;
+    int This = 0, mid = lo + (hi - lo) / 2;
+    for(int i = 0; i < np; i++) if(p[i] <= mid) This = i;
+    int z = p[This];
+    porder_select(ind, lo, hi, z, x, nalast, decreasing);
+    porder_select0(ind, lo, z - 1, p, This, x, nalast, decreasing);
+    porder_select0(ind, z + 1, hi, p + This + 1, np - This - 1,
+		   x, nalast, decreasing);
+}
+
+#undef PGREATER
+
+attribute_hidden SEXP do_porder(SEXP call, SEXP op, SEXP args, SEXP rho)
+{
+    checkArity(op, args);
+    SEXP x = CAR(args), partial = CADR(args);
+    int nalast = asLogical(CADDR(args)),
+	decreasing = asLogical(CADDDR(args));
+
+    if (!isVectorAtomic(x))
+	error(_("only atomic vectors can be sorted"));
+    if(TYPEOF(x) == RAWSXP)
+	error(_("raw vectors cannot be sorted"));
+    if (XLENGTH(x) > INT_MAX)
+	error(_("long vectors not supported"));
+    if(decreasing == NA_LOGICAL)
+	error(_("'decreasing' must be TRUE or FALSE"));
+    int n = LENGTH(x), m = 0;
+
+    int *ind = (int *) R_alloc(n, sizeof(int));
+    if (nalast == NA_LOGICAL) {
+	for (int i = 0; i < n; i++) {
+	    Rboolean isna = FALSE;
+	    switch (TYPEOF(x)) {
+	    case LGLSXP:
+	    case INTSXP:
+		isna = INTEGER(x)[i] == NA_INTEGER;
+		break;
+	    case REALSXP:
+		isna = ISNAN(REAL(x)[i]);
+		break;
+	    case CPLXSXP:
+		isna = ISNAN(COMPLEX(x)[i].r) || ISNAN(COMPLEX(x)[i].i);
+		break;
+	    case STRSXP:
+		isna = STRING_ELT(x, i) == NA_STRING;
+		break;
+	    default:
+		UNIMPLEMENTED_TYPE("porder", x);
+	    }
+	    if (!isna) ind[m++] = i;
+	}
+	nalast = TRUE;
+    } else {
+	for (int i = 0; i < n; i++) ind[i] = i;
+	m = n;
+    }
+
+    /* sorted unique 0-based positions */
+    PROTECT(partial = coerceVector(partial, INTSXP));
+    int np = LENGTH(partial);
+    int *p = (int *) R_alloc(np, sizeof(int));
+    for (int i = 0; i < np; i++) {
+	p[i] = INTEGER(partial)[i];
+	if (p[i] == NA_INTEGER)
+	    error(_("NA index"));
+	if (p[i] < 1 || p[i] > m)
+	    error(_("index %d outside bounds"), p[i]);
+    }
+    UNPROTECT(1);
+    R_isort(p, np);
+    int np2 = 0;
+    for (int i = 0; i < np; i++)
+	if (np2 == 0 || p[i] - 1 != p[np2 - 1]) p[np2++] = p[i] - 1;
+    np = np2;
+
+    if (np > 0) {
+	int k = p[np - 1] + 1;
+	if ((double) k * 64 <= m)
+	    porder_heap(ind, m, k, x, nalast, decreasing);
+	else
+	    porder_select0(ind, 0, m - 1, p, np, x, nalast, decreasing);
+    }
+
+    SEXP ans = allocVector(INTSXP, m);
+    for (int i = 0; i < m; i++) INTEGER(ans)[i] = ind[i] + 1;
+    return ans;
+}
+
 /* FUNCTION: rank(x, length, ties.method) */
 attribute_hidden SEXP do_rank(SEXP call, SEXP op, SEXP args, SEXP rho)
 {
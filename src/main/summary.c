@@ -47,10 +47,309 @@
 #define DbgP3(s,a,b)
 #endif
 
+/* Blocked reductions, used instead of the ones below for long vectors
+   when options(summary.threads) is above one.  The vector is cut into
+   blocks of SUMMARY_BLOCK elements which are reduced separately, by up
+   to R_SummaryThreads threads, and the block results are combined in a
+   fixed order, pairwise for sums and products of doubles.  As neither
+   the blocks nor the combination depend on the number of threads, the
+   results do not either, although sums and products can differ in the
+   last bits from those of the sequential versions used with one.  Integer sums,
+   minima and maxima are the same either way.  ALTREP vectors are
+   reduced in the main thread, as their methods may allocate. */
+
+#define SUMMARY_BLOCK 65536
+
+#define USE_SUMMARY_BLOCKS(sx) \
+    (R_SummaryThreads > 1 && XLENGTH(sx) > SUMMARY_BLOCK)
+
+#define SUMMARY_NBLOCKS(n) (((n) + SUMMARY_BLOCK - 1) / SUMMARY_BLOCK)
+#define SUMMARY_BLOCK_LENGTH(n, b) \
+    ((n) - (b) * SUMMARY_BLOCK < SUMMARY_BLOCK ? \
+     (n) - (b) * SUMMARY_BLOCK : SUMMARY_BLOCK)
+
+#ifdef _OPENMP
+# define R_DO_PRAGMA(x) _Pragma(#x)
+# define OMP_PARALLEL_FOR_BLOCKS(sx, clauses)				\
+    int nthreads = ALTREP(sx) ? 1 : R_SummaryThreads;			\
+    R_DO_PRAGMA(omp parallel for num_threads(nthreads) if(nthreads > 1) \
+		schedule(static) clauses)
+#else
+# define OMP_PARALLEL_FOR_BLOCKS(sx, clauses)
+#endif
+
+static LDOUBLE pairwise_sum(LDOUBLE *s, R_xlen_t nb)
+{
+    for (R_xlen_t step = 1; step < nb; step *= 2)
+	for (R_xlen_t b = 0; b + step < nb; b += 2 * step)
+	    s[b] += s[b + step];
+    return s[0];
+}
+
+static LDOUBLE pairwise_prod(LDOUBLE *s, R_xlen_t nb)
+{
+    for (R_xlen_t step = 1; step < nb; step *= 2)
+	for (R_xlen_t b = 0; b + step < nb; b += 2 * step)
+	    s[b] *= s[b + step];
+    return s[0];
+}
+
+/* Block sums of integers are exact, as are their totals as long as
+   these stay below 2^63; isum() switches to risum() well before. */
+#define ISUM_BLOCKS(sx, narm, bsum, bna, updated) do {			\
+	R_xlen_t n = XLENGTH(sx), nb = SUMMARY_NBLOCKS(n);		\
+	OMP_PARALLEL_FOR_BLOCKS(sx, reduction(|:updated))		\
+	for (R_xlen_t b = 0; b < nb; b++) {				\
+	    LONG_INT s = 0;						\
+	    int na = 0;							\
+	    ITERATE_BY_REGION_PARTIAL(sx, x, i, nbatch, int, INTEGER,	\
+				      b * SUMMARY_BLOCK,		\
+				      SUMMARY_BLOCK_LENGTH(n, b), {	\
+		    for (R_xlen_t k = 0; k < nbatch; k++) {		\
+			if (x[k] != NA_INTEGER) {			\
+			    updated = 1;				\
+			    s += x[k];					\
+			} else if (!narm)				\
+			    na = 1;					\
+		    }							\
+		});							\
+	    bsum[b] = s;						\
+	    bna[b] = na;						\
+	}								\
+    } while (0)
+
+#ifdef LONG_INT
+static int isum_blocked(SEXP sx, LONG_INT *value, Rboolean narm)
+{
+    const void *vmax = vmaxget();
+    R_xlen_t nb = SUMMARY_NBLOCKS(XLENGTH(sx));
+    LONG_INT *bsum = (LONG_INT *) R_alloc(nb, sizeof(LONG_INT));
+    int *bna = (int *) R_alloc(nb, sizeof(int)), updated = 0;
+    ISUM_BLOCKS(sx, narm, bsum, bna, updated);
+    LONG_INT s = 0;
+    for (R_xlen_t b = 0; b < nb; b++) {
+	if (bna[b]) {
+	    vmaxset(vmax);
+	    return NA_INTEGER;
+	}
+	s += bsum[b];
+	if (s > 9000000000000000L || s < -9000000000000000L) {
+	    vmaxset(vmax);
+	    return 42; /* switch to irsum() */
+	}
+    }
+    vmaxset(vmax);
+    *value = s;
+    return updated;
+}
+
+static Rboolean risum_blocked(SEXP sx, double *value, Rboolean narm)
+{
+    const void *vmax = vmaxget();
+    R_xlen_t nb = SUMMARY_NBLOCKS(XLENGTH(sx));
+    LONG_INT *bsum = (LONG_INT *) R_alloc(nb, sizeof(LONG_INT));
+    int *bna = (int *) R_alloc(nb, sizeof(int)), updated = 0;
+    ISUM_BLOCKS(sx, narm, bsum, bna, updated);
+    LDOUBLE s = 0.0;
+    for (R_xlen_t b = 0; b < nb; b++) {
+	if (bna[b]) {
+	    vmaxset(vmax);
+	    *value = NA_REAL;
+	    return TRUE;
+	}
+	s += (LDOUBLE) bsum[b];
+    }
+    vmaxset(vmax);
+    if(s > DBL_MAX) *value = R_PosInf;
+    else if (s < -DBL_MAX) *value = R_NegInf;
+    else *value = (double) s;
+    return updated ? TRUE : FALSE;
+}
+#endif
+
+static Rboolean rsum_blocked(SEXP sx, double *value, Rboolean narm)
+{
+    const void *vmax = vmaxget();
+    R_xlen_t n = XLENGTH(sx), nb = SUMMARY_NBLOCKS(n);
+    LDOUBLE *bsum = (LDOUBLE *) R_alloc(nb, sizeof(LDOUBLE));
+    int updated = 0;
+    OMP_PARALLEL_FOR_BLOCKS(sx, reduction(|:updated))
+    for (R_xlen_t b = 0; b < nb; b++) {
+	LDOUBLE s = 0.0;
+	ITERATE_BY_REGION_PARTIAL(sx, x, i, nbatch, double, REAL,
+				  b * SUMMARY_BLOCK,
+				  SUMMARY_BLOCK_LENGTH(n, b), {
+		for (R_xlen_t k = 0; k < nbatch; k++) {
+		    if (!narm || !ISNAN(x[k])) {
+			updated = 1;
+			s += x[k];
+		    }
+		}
+	    });
+	bsum[b] = s;
+    }
+    LDOUBLE s = pairwise_sum(bsum, nb);
+    vmaxset(vmax);
+    if(s > DBL_MAX) *value = R_PosInf;
+    else if (s < -DBL_MAX) *value = R_NegInf;
+    else *value = (double) s;
+    return updated ? TRUE : FALSE;
+}
+
+/* for both iprod() and rprod() */
+static Rboolean prod_blocked(SEXP sx, double *value, Rboolean narm)
+{
+    const void *vmax = vmaxget();
+    R_xlen_t n = XLENGTH(sx), nb = SUMMARY_NBLOCKS(n);
+    LDOUBLE *bprod = (LDOUBLE *) R_alloc(nb, sizeof(LDOUBLE));
+    Rboolean isint = TYPEOF(sx) != REALSXP;
+    int updated = 0, na = 0;
+    OMP_PARALLEL_FOR_BLOCKS(sx, reduction(|:updated, na))
+    for (R_xlen_t b = 0; b < nb; b++) {
+	LDOUBLE s = 1.0;
+	if (isint)
+	    ITERATE_BY_REGION_PARTIAL(sx, x, i, nbatch, int, INTEGER,
+				      b * SUMMARY_BLOCK,
+				      SUMMARY_BLOCK_LENGTH(n, b), {
+		    for (R_xlen_t k = 0; k < nbatch; k++) {
+			if (x[k] != NA_INTEGER) {
+			    updated = 1;
+			    s *= x[k];
+			} else if (!narm) {
+			    updated = 1;
+			    na = 1;
+			}
+		    }
+		});
+	else
+	    ITERATE_BY_REGION_PARTIAL(sx, x, i, nbatch, double, REAL,
+				      b * SUMMARY_BLOCK,
+				      SUMMARY_BLOCK_LENGTH(n, b), {
+		    for (R_xlen_t k = 0; k < nbatch; k++) {
+			if (!narm || !ISNAN(x[k])) {
+			    updated = 1;
+			    s *= x[k];
+			}
+		    }
+		});
+	bprod[b] = s;
+    }
+    LDOUBLE s = pairwise_prod(bprod, nb);
+    vmaxset(vmax);
+    if (na || (isint && ISNAN(s))) *value = NA_REAL;
+    else if(s > DBL_MAX) *value = R_PosInf;
+    else if (s < -DBL_MAX) *value = R_NegInf;
+    else *value = (double) s;
+    return updated ? TRUE : FALSE;
+}
+
+/* The block minima or maxima are combined in order using the rules
+   for single elements, so the results are those of imin() and so on. */
+static Rboolean iminmax_blocked(SEXP sx, int *value, Rboolean narm,
+				Rboolean min)
+{
+    const void *vmax = vmaxget();
+    R_xlen_t n = XLENGTH(sx), nb = SUMMARY_NBLOCKS(n);
+    int *bval = (int *) R_alloc(nb, sizeof(int));
+    int *bupd = (int *) R_alloc(nb, sizeof(int));
+    OMP_PARALLEL_FOR_BLOCKS(sx, )
+    for (R_xlen_t b = 0; b < nb; b++) {
+	int s = 0, upd = 0;
+	ITERATE_BY_REGION_PARTIAL(sx, x, i, nbatch, int, INTEGER,
+				  b * SUMMARY_BLOCK,
+				  SUMMARY_BLOCK_LENGTH(n, b), {
+		for (R_xlen_t k = 0; k < nbatch; k++) {
+		    if (x[k] != NA_INTEGER) {
+			if (!upd || (min ? s > x[k] : s < x[k])) {
+			    s = x[k];
+			    upd = 1;
+			}
+		    }
+		    else if (!narm) {
+			s = NA_INTEGER;
+			upd = 1;
+			break;
+		    }
+		}
+		if (s == NA_INTEGER && upd) break;
+	    });
+	bval[b] = s;
+	bupd[b] = upd;
+    }
+    int s = 0;
+    Rboolean updated = FALSE;
+    for (R_xlen_t b = 0; b < nb; b++) {
+	if (! bupd[b]) continue;
+	if (bval[b] == NA_INTEGER) {
+	    vmaxset(vmax);
+	    *value = NA_INTEGER;
+	    return TRUE;
+	}
+	if (!updated || (min ? s > bval[b] : s < bval[b])) {
+	    s = bval[b];
+	    updated = TRUE;
+	}
+    }
+    vmaxset(vmax);
+    *value = s;
+    return updated;
+}
+
+static Rboolean rminmax_blocked(SEXP sx, double *value, Rboolean narm,
+				Rboolean min)
+{
+    const void *vmax = vmaxget();
+    R_xlen_t n = XLENGTH(sx), nb = SUMMARY_NBLOCKS(n);
+    double *bval = (double *) R_alloc(nb, sizeof(double));
+    int *bupd = (int *) R_alloc(nb, sizeof(int));
+    OMP_PARALLEL_FOR_BLOCKS(sx, )
+    for (R_xlen_t b = 0; b < nb; b++) {
+	double s = 0.0;
+	int upd = 0;
+	ITERATE_BY_REGION_PARTIAL(sx, x, i, nbatch, double, REAL,
+				  b * SUMMARY_BLOCK,
+				  SUMMARY_BLOCK_LENGTH(n, b), {
+		for (R_xlen_t k = 0; k < nbatch; k++) {
+		    if (ISNAN(x[k])) {/* Na(N) */
+			if (!narm) {
+			    if(!ISNA(s)) s = x[k]; /* so any NA trumps all NaNs */
+			    upd = 1;
+			}
+		    }
+		    else if (!upd || (min ? x[k] < s : x[k] > s)) {
+			s = x[k];
+			upd = 1;
+		    }
+		}
+	    });
+	bval[b] = s;
+	bupd[b] = upd;
+    }
+    double s = 0.0;
+    Rboolean updated = FALSE;
+    for (R_xlen_t b = 0; b < nb; b++) {
+	if (! bupd[b]) continue;
+	if (ISNAN(bval[b])) {
+	    if(!ISNA(s)) s = bval[b];
+	    updated = TRUE;
+	}
+	else if (!updated || (min ? bval[b] < s : bval[b] > s)) {
+	    s = bval[b];
+	    updated = TRUE;
+	}
+    }
+    vmaxset(vmax);
+    *value = s;
+    return updated;
+}
+
 #ifdef LONG_INT
 # define isum_INT LONG_INT
 static int isum(SEXP sx, isum_INT *value, Rboolean narm, SEXP call)
 {
+    if (USE_SUMMARY_BLOCKS(sx))
+	return isum_blocked(sx, value, narm);
+
     LONG_INT s = 0;  // at least 64-bit
     int updated = 0;
 #ifdef LONG_VECTOR_SUPPORT
@@ -125,6 +424,9 @@ static Rboolean isum(SEXP sx, isum_INT *value, Rboolean narm, SEXP call)
 // Used instead of isum() for large vectors when overflow would occur:
 static Rboolean risum(SEXP sx, double *value, Rboolean narm)
 {
+    if (USE_SUMMARY_BLOCKS(sx))
+	return risum_blocked(sx, value, narm);
+
     LDOUBLE s = 0.0;
     Rboolean updated = FALSE;
 
@@ -151,6 +453,9 @@ static Rboolean risum(SEXP sx, double *value, Rboolean narm)
 
 static Rboolean rsum(SEXP sx, double *value, Rboolean narm)
 {
+    if (USE_SUMMARY_BLOCKS(sx))
+	return rsum_blocked(sx, value, narm);
+
     LDOUBLE s = 0.0;
     Rboolean updated = FALSE;
 
@@ -191,6 +496,9 @@ static Rboolean csum(SEXP sx, Rcomplex *value, Rboolean narm)
 
 static Rboolean imin(SEXP sx, int *value, Rboolean narm)
 {
+    if (USE_SUMMARY_BLOCKS(sx))
+	return iminmax_blocked(sx, value, narm, TRUE);
+
     Rboolean updated = FALSE;
     int s = 0;
 
@@ -214,6 +522,9 @@ static Rboolean imin(SEXP sx, int *value, Rboolean narm)
 
 static Rboolean rmin(SEXP sx, double *value, Rboolean narm)
 {
+    if (USE_SUMMARY_BLOCKS(sx))
+	return rminmax_blocked(sx, value, narm, TRUE);
+
     double s = 0.0; /* -Wall */
     Rboolean updated = FALSE;
 
@@ -263,6 +574,9 @@ static Rboolean smin(SEXP x, SEXP *value, Rboolean narm)
 
 static Rboolean imax(SEXP sx, int *value, Rboolean narm)
 {
+    if (USE_SUMMARY_BLOCKS(sx))
+	return iminmax_blocked(sx, value, narm, FALSE);
+
     int s = 0 /* -Wall */;
     Rboolean updated = FALSE;
 
@@ -285,6 +599,9 @@ static Rboolean imax(SEXP sx, int *value, Rboolean narm)
 
 static Rboolean rmax(SEXP sx, double *value, Rboolean narm)
 {
+    if (USE_SUMMARY_BLOCKS(sx))
+	return rminmax_blocked(sx, value, narm, FALSE);
+
     double s = 0.0 /* -Wall */;
     Rboolean updated = FALSE;
 
@@ -333,6 +650,9 @@ static Rboolean smax(SEXP x, SEXP *value, Rboolean narm)
 
 static Rboolean iprod(SEXP sx, double *value, Rboolean narm)
 {
+    if (USE_SUMMARY_BLOCKS(sx))
+	return prod_blocked(sx, value, narm);
+
     LDOUBLE s = 1.0;
     Rboolean updated = FALSE;
 
@@ -366,6 +686,9 @@ static Rboolean iprod(SEXP sx, double *value, Rboolean narm)
 
 static Rboolean rprod(SEXP sx, double *value, Rboolean narm)
 {
+    if (USE_SUMMARY_BLOCKS(sx))
+	return prod_blocked(sx, value, narm);
+
     LDOUBLE s = 1.0;
     Rboolean updated = FALSE;
 
@@ -454,12 +777,13 @@ static R_INLINE SEXP logical_mean(SEXP x)
 {
     R_xlen_t n = XLENGTH(x);
     LDOUBLE s = 0.0;
-    for (R_xlen_t i = 0; i < n; i++) {
-	int xi = LOGICAL_ELT(x, i);
-	if(xi == NA_LOGICAL)
-	    return ScalarReal(R_NaReal);
-	s += xi;
-    }
+    ITERATE_BY_REGION(x, px, i, nbatch, int, LOGICAL, {
+	    for (R_xlen_t k = 0; k < nbatch; k++) {
+		if(px[k] == NA_LOGICAL)
+		    return ScalarReal(R_NaReal);
+		s += px[k];
+	    }
+	});
     return ScalarReal((double) (s/n));
 }
 
@@ -467,12 +791,13 @@ static R_INLINE SEXP integer_mean(SEXP x)
 {
     R_xlen_t n = XLENGTH(x);
     LDOUBLE s = 0.0;
-    for (R_xlen_t i = 0; i < n; i++) {
-	int xi = INTEGER_ELT(x, i);
-	if(xi == NA_INTEGER)
-	    return ScalarReal(R_NaReal);
-	s += xi;
-    }
+    ITERATE_BY_REGION(x, px, i, nbatch, int, INTEGER, {
+	    for (R_xlen_t k = 0; k < nbatch; k++) {
+		if(px[k] == NA_INTEGER)
+		    return ScalarReal(R_NaReal);
+		s += px[k];
+	    }
+	});
     return ScalarReal((double) (s/n));
 }
 
@@ -1060,38 +1385,46 @@ attribute_hidden SEXP do_first_min(SEXP call, SEXP op, SEXP args, SEXP rho)
 
     case INTSXP:
     {
-	int s, *r = INTEGER(sx);
+	int s;
 	if(PRIMVAL(op) == 0) { /* which.min */
 	    s = INT_MAX;
-	    for (i = 0; i < n; i++)
-		if (r[i] != NA_INTEGER && (r[i] < s || indx == -1)) {
-		    s = r[i]; indx = i;
-		}
+	    ITERATE_BY_REGION(sx, r, j, nbatch, int, INTEGER, {
+		    for (R_xlen_t k = 0; k < nbatch; k++)
+			if (r[k] != NA_INTEGER && (r[k] < s || indx == -1)) {
+			    s = r[k]; indx = j + k;
+			}
+		});
 	} else { /* which.max */
 	    s = INT_MIN;
-	    for (i = 0; i < n; i++)
-		if (r[i] != NA_INTEGER && (r[i] > s || indx == -1)) {
-		    s = r[i]; indx = i;
-		}
+	    ITERATE_BY_REGION(sx, r, j, nbatch, int, INTEGER, {
+		    for (R_xlen_t k = 0; k < nbatch; k++)
+			if (r[k] != NA_INTEGER && (r[k] > s || indx == -1)) {
+			    s = r[k]; indx = j + k;
+			}
+		});
 	}
     }
     break;
 
     case REALSXP:
     {
-	double s, *r = REAL(sx);
+	double s;
 	if(PRIMVAL(op) == 0) { /* which.min */
 	    s = R_PosInf;
-	    for (i = 0; i < n; i++)
-		if ( !ISNAN(r[i]) && (r[i] < s || indx == -1) ) {
-		    s = r[i]; indx = i;
-		}
+	    ITERATE_BY_REGION(sx, r, j, nbatch, double, REAL, {
+		    for (R_xlen_t k = 0; k < nbatch; k++)
+			if (!ISNAN(r[k]) && (r[k] < s || indx == -1)) {
+			    s = r[k]; indx = j + k;
+			}
+		});
 	} else { /* which.max */
 	    s = R_NegInf;
-	    for (i = 0; i < n; i++)
-		if ( !ISNAN(r[i]) && (r[i] > s || indx == -1) ) {
-		    s = r[i]; indx = i;
-		}
+	    ITERATE_BY_REGION(sx, r, j, nbatch, double, REAL, {
+		    for (R_xlen_t k = 0; k < nbatch; k++)
+			if (!ISNAN(r[k]) && (r[k] > s || indx == -1)) {
+			    s = r[k]; indx = j + k;
+			}
+		});
 	}
     }
     } // switch()
@@ -666,6 +666,280 @@ SEXP duplicated(SEXP x, Rboolean from_last)
     return ans;
 }
 
+/* Parallel hashing of long vectors.
+
+   With options(hash.threads) above one, duplicated(), unique(),
+   anyDuplicated() and match() of long integer, double and character
+   vectors partition the elements on the top bits of a 64-bit hash of
+   their values.  Equal values fall in the same partition, so the
+   partitions are hashed independently by the threads, each visiting
+   its elements in their original order: the first (or last)
+   occurrences found are those the sequential code finds.
+
+   Values are hashed as 64-bit keys: integers as they are, doubles with
+   signed zeros, NAs and NaNs unified as in rhash(), and strings by
+   address.  The latter requires cached strings whose non-ASCII
+   elements all have the same declared encoding, so that two strings
+   are equal if and only if they are the same CHARSXP (cf. sequal()). */
+
+#define PHASH_MIN 1000000  /* smaller vectors use the sequential code */
+#define PHASH_PART 65536   /* target partition size */
+
+#ifdef _OPENMP
+# define R_DO_PRAGMA(x) _Pragma(#x)
+#else
+# define R_DO_PRAGMA(x)
+#endif
+#define OMP_PARALLEL_FOR_THREADS(nth)					\
+    R_DO_PRAGMA(omp parallel for num_threads(nth) schedule(static, 1))
+
+typedef struct {
+    SEXPTYPE type;
+    const void *px;
+    R_xlen_t n;
+    int nparts, shift;	/* partition of hash h is h >> shift */
+    int *start;		/* partition p is ord[start[p]:start[p+1]] */
+    int *ord;		/* indices in partition order, increasing within */
+} PHashData;
+
+static R_INLINE uint64_t phash_key(const void *px, SEXPTYPE type, R_xlen_t i)
+{
+    switch (type) {
+    case INTSXP:
+	return (unsigned int) ((const int *) px)[i];
+    case REALSXP:
+    {
+	union { double d; uint64_t u; } v;
+	double xi = ((const double *) px)[i];
+	v.d = (xi == 0.0) ? 0.0 : xi;
+	if (R_IsNA(v.d)) v.d = NA_REAL;
+	else if (ISNAN(v.d)) v.d = R_NaN;
+	return v.u;
+    }
+    default:
+	return (uint64_t) (uintptr_t) ((const SEXP *) px)[i];
+    }
+}
+
+/* the finalizer of MurmurHash3 */
+static R_INLINE uint64_t phash_mix(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+/* Can the strings of x be compared by address?  *enc is the encoding
+   of the non-ASCII strings seen so far, or -1. */
+static Rboolean phash_strings_ok(SEXP x, int *enc)
+{
+    const SEXP *px = STRING_PTR_RO(x);
+    R_xlen_t n = XLENGTH(x);
+    for (R_xlen_t i = 0; i < n; i++) {
+	SEXP s = px[i];
+	if (IS_BYTES(s) || !IS_CACHED(s)) return FALSE;
+	if (s == NA_STRING || IS_ASCII(s)) continue;
+	int e = IS_UTF8(s) ? 1 : (IS_LATIN1(s) ? 2 : 0);
+	if (*enc < 0) *enc = e;
+	else if (*enc != e) return FALSE;
+    }
+    return TRUE;
+}
+
+/* The number of threads to hash x (and table, if not NULL) with, or 1
+   to use the sequential code. */
+static int phash_threads(SEXP x, SEXP table)
+{
+#ifdef _OPENMP
+    int nth = R_HashThreads;
+    if (nth <= 1) return 1;
+    SEXPTYPE type = TYPEOF(x);
+    if (type != INTSXP && type != REALSXP && type != STRSXP) return 1;
+    if (table) {
+	if (TYPEOF(table) != type || XLENGTH(table) >= INT_MAX ||
+	    (XLENGTH(x) < PHASH_MIN && XLENGTH(table) < PHASH_MIN))
+	    return 1;
+    } else if (XLENGTH(x) >= INT_MAX || XLENGTH(x) < PHASH_MIN)
+	return 1;
+    if (type == STRSXP) {
+	int enc = -1;
+	if (!phash_strings_ok(x, &enc) ||
+	    (table && !phash_strings_ok(table, &enc)))
+	    return 1;
+    }
+    return nth;
+#else
+    return 1;
+#endif
+}
+
+static size_t phash_size(int n)
+{
+    size_t m = 2;
+    while (m < 2 * (size_t) n) m *= 2;
+    return m;
+}
+
+/* Partition the elements of x, using R_alloc. */
+static void phash_partition(SEXP x, PHashData *d, int nth)
+{
+    R_xlen_t n = XLENGTH(x);
+    int bits = 1;
+    while (bits < 20 && (n >> bits) > PHASH_PART) bits++;
+    d->type = TYPEOF(x);
+    d->px = DATAPTR_RO(x);
+    d->n = n;
+    d->nparts = 1 << bits;
+    d->shift = 64 - bits;
+    d->start = (int *) R_alloc(d->nparts + 1, sizeof(int));
+    d->ord = (int *) R_alloc(n, sizeof(int));
+
+    int P = d->nparts, shift = d->shift;
+    SEXPTYPE type = d->type;
+    const void *px = d->px;
+    int *cnt = (int *) R_alloc((size_t) nth * P, sizeof(int));
+    memset(cnt, 0, (size_t) nth * P * sizeof(int));
+    OMP_PARALLEL_FOR_THREADS(nth)
+    for (int t = 0; t < nth; t++) {
+	int *c = cnt + (size_t) t * P;
+	R_xlen_t lo = n * t / nth, hi = n * (t + 1) / nth;
+	for (R_xlen_t i = lo; i < hi; i++)
+	    c[phash_mix(phash_key(px, type, i)) >> shift]++;
+    }
+    /* chunks in order within partitions, so indices are increasing */
+    int pos = 0;
+    for (int p = 0; p < P; p++) {
+	d->start[p] = pos;
+	for (int t = 0; t < nth; t++) {
+	    int c = cnt[(size_t) t * P + p];
+	    cnt[(size_t) t * P + p] = pos;
+	    pos += c;
+	}
+    }
+    d->start[P] = pos;
+    int *ord = d->ord;
+    OMP_PARALLEL_FOR_THREADS(nth)
+    for (int t = 0; t < nth; t++) {
+	int *c = cnt + (size_t) t * P;
+	R_xlen_t lo = n * t / nth, hi = n * (t + 1) / nth;
+	for (R_xlen_t i = lo; i < hi; i++)
+	    ord[c[phash_mix(phash_key(px, type, i)) >> shift]++] = (int) i;
+    }
+}
+
+/* duplicated(x, fromLast) into dup, or if dup is NULL, anyDuplicated():
+   the (1-based) index of the first duplicate, or 0. */
+static R_xlen_t phash_duplicated(SEXP x, Rboolean from_last, int *dup,
+				 int nth)
+{
+    const void *vmax = vmaxget();
+    PHashData d;
+    phash_partition(x, &d, nth);
+
+    int P = d.nparts, maxpart = 0;
+    for (int p = 0; p < P; p++)
+	if (d.start[p + 1] - d.start[p] > maxpart)
+	    maxpart = d.start[p + 1] - d.start[p];
+    size_t M = phash_size(maxpart);
+    int *tabs = (int *) R_alloc(nth * M, sizeof(int));
+    R_xlen_t *first = (R_xlen_t *) R_alloc(P, sizeof(R_xlen_t));
+    SEXPTYPE type = d.type;
+    const void *px = d.px;
+
+    OMP_PARALLEL_FOR_THREADS(nth)
+    for (int t = 0; t < nth; t++) {
+	int *tab = tabs + t * M;
+	for (int p = t; p < P; p += nth) {
+	    int s = d.start[p], e = d.start[p + 1];
+	    size_t mask = phash_size(e - s) - 1;
+	    memset(tab, 0, (mask + 1) * sizeof(int));
+	    first[p] = 0;
+	    for (int j = 0; j < e - s; j++) {
+		int i = d.ord[from_last ? e - 1 - j : s + j], isdup = 0;
+		uint64_t k = phash_key(px, type, i);
+		size_t h = phash_mix(k) & mask;
+		while (tab[h]) {
+		    if (phash_key(px, type, tab[h] - 1) == k) {
+			isdup = 1;
+			break;
+		    }
+		    h = (h + 1) & mask;
+		}
+		if (!isdup) tab[h] = i + 1;
+		if (dup) dup[i] = isdup;
+		else if (isdup) {
+		    first[p] = (R_xlen_t) i + 1;
+		    break;
+		}
+	    }
+	}
+    }
+
+    R_xlen_t ans = 0;
+    if (!dup)
+	for (int p = 0; p < P; p++)
+	    if (first[p] &&
+		(!ans || (from_last ? first[p] > ans : first[p] < ans)))
+		ans = first[p];
+    vmaxset(vmax);
+    return ans;
+}
+
+/* match(x, table, nomatch) into ans: each partition of table gets a
+   hash table of its first occurrences, then x is looked up in chunks. */
+static void phash_match(SEXP table, SEXP x, int nomatch, int *ans, int nth)
+{
+    const void *vmax = vmaxget();
+    PHashData d;
+    phash_partition(table, &d, nth);
+
+    int P = d.nparts;
+    size_t *off = (size_t *) R_alloc(P + 1, sizeof(size_t));
+    off[0] = 0;
+    for (int p = 0; p < P; p++)
+	off[p + 1] = off[p] + phash_size(d.start[p + 1] - d.start[p]);
+    int *tabs = (int *) R_alloc(off[P], sizeof(int));
+    SEXPTYPE type = d.type;
+    const void *pt = d.px, *px = DATAPTR_RO(x);
+    int shift = d.shift;
+
+    OMP_PARALLEL_FOR_THREADS(nth)
+    for (int t = 0; t < nth; t++)
+	for (int p = t; p < P; p += nth) {
+	    int *tab = tabs + off[p];
+	    size_t mask = off[p + 1] - off[p] - 1;
+	    memset(tab, 0, (mask + 1) * sizeof(int));
+	    for (int j = d.start[p]; j < d.start[p + 1]; j++) {
+		int i = d.ord[j];
+		uint64_t k = phash_key(pt, type, i);
+		size_t h = phash_mix(k) & mask;
+		while (tab[h] && phash_key(pt, type, tab[h] - 1) != k)
+		    h = (h + 1) & mask;
+		if (!tab[h]) tab[h] = i + 1;
+	    }
+	}
+
+    R_xlen_t n = XLENGTH(x);
+    OMP_PARALLEL_FOR_THREADS(nth)
+    for (int t = 0; t < nth; t++) {
+	R_xlen_t lo = n * t / nth, hi = n * (t + 1) / nth;
+	for (R_xlen_t i = lo; i < hi; i++) {
+	    uint64_t k = phash_key(px, type, i), h = phash_mix(k);
+	    int p = (int) (h >> shift);
+	    const int *tab = tabs + off[p];
+	    size_t mask = off[p + 1] - off[p] - 1;
+	    h &= mask;
+	    while (tab[h] && phash_key(pt, type, tab[h] - 1) != k)
+		h = (h + 1) & mask;
+	    ans[i] = tab[h] ? tab[h] : nomatch;
+	}
+    }
+    vmaxset(vmax);
+}
+
 attribute_hidden R_xlen_t sorted_real_count_NANs(SEXP x) {
     R_xlen_t n = XLENGTH(x);
     if(n == 0)
@@ -838,6 +1112,13 @@ static SEXP Duplicated(SEXP x, Rboolean from_last, int nmax)
     if(DUP_KNOWN_SORTED(x)) {
     	return sorted_Duplicated(x, from_last, nmax);
     }
+    int nth = nmax == NA_INTEGER ? phash_threads(x, NULL) : 1;
+    if (nth > 1) {
+	PROTECT(ans = allocVector(LGLSXP, n));
+	phash_duplicated(x, from_last, LOGICAL0(ans), nth);
+	UNPROTECT(1);
+	return ans;
+    }
     DUPLICATED_INIT;
 
     PROTECT(data.HashTable);
@@ -987,6 +1268,9 @@ R_xlen_t any_duplicated(SEXP x, Rboolean from_last)
     if(DUP_KNOWN_SORTED(x)) {
     	return sorted_any_duplicated(x, from_last);
     }
+    int nth = phash_threads(x, NULL);
+    if (nth > 1)
+	return phash_duplicated(x, from_last, NULL, nth);
 
     DUPLICATED_INIT;
     PROTECT(data.HashTable);
@@ -1091,6 +1375,8 @@ R_xlen_t any_duplicated3(SEXP x, SEXP incomp, Rboolean from_last)
 #undef DUPLICATED_INIT
 
 
+static R_xlen_t HashIndexDuplicated(SEXP, SEXP, int *);
+
 /* .Internal(   duplicated(x, incomparables, fromLast, nmax))  [op=0]
    .Internal(       unique(x, incomparables, fromLast, nmax))  [op=1]
    .Internal(anyDuplicated(x, incomparables, fromLast      ))  [op=2]
@@ -1139,6 +1425,16 @@ attribute_hidden SEXP do_duplicated(SEXP call, SEXP op, SEXP args, SEXP env)
 	} else
 	    dup = duplicated3(x, incomp, fL, nmax);
     }
+    else if(!fL && R_HashIndexOf(x) != R_NilValue) {
+	/* the hash index of x finds the first occurrences */
+	SEXP index = R_HashIndexOf(x);
+	x = R_HashIndexData(x);
+	if(PRIMVAL(op) == 2)
+	    return ScalarInteger((int) HashIndexDuplicated(x, index, NULL));
+	PROTECT(dup = allocVector(LGLSXP, n));
+	HashIndexDuplicated(x, index, LOGICAL0(dup));
+	UNPROTECT(1); /* dup */
+    }
     else {
 	if(PRIMVAL(op) == 2) {
 	    R_xlen_t ind  = any_duplicated(x, fL);
@@ -1208,6 +1504,17 @@ attribute_hidden SEXP do_duplicated(SEXP call, SEXP op, SEXP args, SEXP env)
     default:
 	UNIMPLEMENTED_TYPE("duplicated", x);
     }
+
+    /* the unique values of a sorted vector are sorted the same way */
+    int sorted = TYPEOF(x) == INTSXP ? INTEGER_IS_SORTED(x) :
+	TYPEOF(x) == REALSXP ? REAL_IS_SORTED(x) : UNKNOWN_SORTEDNESS;
+    if (KNOWN_SORTED(sorted)) {
+	/* so their NAs, at most an NA and a NaN, are at one end */
+	R_xlen_t e = KNOWN_NA_1ST(sorted) ? 0 : k - 1;
+	Rboolean noNA = TYPEOF(x) == INTSXP ?
+	    INTEGER_ELT(ans, e) != NA_INTEGER : !ISNAN(REAL_ELT(ans, e));
+	ans = R_tryWrapSorted(ans, sorted, noNA);
+    }
     UNPROTECT(2);
     return ans;
 }
@@ -1282,6 +1589,109 @@ static SEXP HashLookup(SEXP table, SEXP x, HashData *d)
     return ans;
 }
 
+/* Hash indices, attached to vectors by hashIndex() (see altclasses.c).
+   An index is a list of the hash table built by DoHashing() and an
+   integer vector of K and whether strings were hashed as UTF-8. */
+
+#define HASHINDEX_TABLE(index) VECTOR_ELT(index, 0)
+#define HASHINDEX_K(index) INTEGER0(VECTOR_ELT(index, 1))[0]
+#define HASHINDEX_UTF8(index) INTEGER0(VECTOR_ELT(index, 1))[1]
+
+/* Returns R_NilValue if x cannot be indexed. */
+attribute_hidden SEXP R_MakeHashIndex(SEXP x)
+{
+    Rboolean useUTF8 = FALSE, needsTrans = FALSE;
+
+    if (IS_LONG_VEC(x)) /* HashLookup() uses integer tables */
+	return R_NilValue;
+    if (TYPEOF(x) == STRSXP) {
+	R_xlen_t i, n = XLENGTH(x);
+	for (i = 0; i < n; i++) {
+	    SEXP s = STRING_ELT(x, i);
+	    if (IS_BYTES(s) || !IS_CACHED(s))
+		return R_NilValue;
+	    if (ENC_KNOWN(s))
+		useUTF8 = TRUE;
+	    if (s != NA_STRING && !IS_ASCII(s) && !IS_UTF8(s))
+		needsTrans = TRUE;
+	}
+	/* match5() would translate the table before each lookup */
+	if (useUTF8 && needsTrans)
+	    return R_NilValue;
+    }
+
+    HashData data = { 0 };
+    HashTableSetup(x, &data, NA_INTEGER);
+    PROTECT(data.HashTable);
+    data.useUTF8 = useUTF8;
+    DoHashing(x, &data);
+    SEXP index = PROTECT(allocVector(VECSXP, 2));
+    SET_VECTOR_ELT(index, 0, data.HashTable);
+    SEXP info = allocVector(INTSXP, 2);
+    SET_VECTOR_ELT(index, 1, info);
+    INTEGER0(info)[0] = data.K;
+    INTEGER0(info)[1] = useUTF8;
+    UNPROTECT(2); /* data.HashTable, index */
+    return index;
+}
+
+/* Set up d for lookups in the hash index of table. */
+static void HashIndexSetup(SEXP table, SEXP index, HashData *d)
+{
+    switch (TYPEOF(table)) {
+    case INTSXP:
+	d->hash = ihash;
+	d->equal = iequal;
+	break;
+    case REALSXP:
+	d->hash = rhash;
+	d->equal = requal;
+	break;
+    case STRSXP:
+	d->hash = shash;
+	d->equal = sequal;
+	break;
+    default:
+	UNIMPLEMENTED_TYPE("HashIndexSetup", table);
+    }
+    d->K = HASHINDEX_K(index);
+    d->M = (hlen) 1 << d->K;
+    d->nmax = XLENGTH(table);
+#ifdef LONG_VECTOR_SUPPORT
+    d->isLong = FALSE;
+#endif
+    d->HashTable = HASHINDEX_TABLE(index);
+    d->useUTF8 = HASHINDEX_UTF8(index);
+    d->useCache = TRUE;
+}
+
+/* duplicated() and anyDuplicated() for a vector with a hash index: an
+   element is a duplicate if the index finds an earlier one.  If dup is
+   NULL, returns the (1-based) index of the first duplicate, or 0. */
+static R_xlen_t HashIndexDuplicated(SEXP x, SEXP index, int *dup)
+{
+    HashData data = { 0 };
+    HashIndexSetup(x, index, &data);
+    data.nomatch = 0;
+    R_xlen_t n = XLENGTH(x);
+
+#define INDEX_DUP_LOOP(LOOKUP) do {				\
+	for (R_xlen_t i = 0; i < n; i++) {			\
+	    int isdup = LOOKUP(x, x, i, &data) != i + 1;	\
+	    if (dup) dup[i] = isdup;				\
+	    else if (isdup) return i + 1;			\
+	}							\
+    } while (0)
+
+    switch (TYPEOF(x)) {
+    case INTSXP: INDEX_DUP_LOOP(iLookup); break;
+    case REALSXP: INDEX_DUP_LOOP(rLookup); break;
+    default: INDEX_DUP_LOOP(sLookup);
+    }
+#undef INDEX_DUP_LOOP
+    return 0;
+}
+
 static SEXP match_transform(SEXP s, SEXP env)
 {
     if(OBJECT(s)) {
@@ -1332,6 +1742,121 @@ static SEXP asUTF8(SEXP x)
 	return x;
 }
     
+/* Coerce to a common type; type == NILSXP is ok here.
+ * Note that match5() coerces factors and "POSIXlt", only to character.
+ * Hence, coerce to character or to `higher' type
+ * (given that we have "Vector" or NULL) */
+static SEXPTYPE match_type(SEXP x, SEXP table)
+{
+    if(TYPEOF(x) >= STRSXP || TYPEOF(table) >= STRSXP) return STRSXP;
+    else return TYPEOF(x) < TYPEOF(table) ? TYPEOF(table) : TYPEOF(x);
+}
+
+/* A table known to be sorted, as the result of sort() or a compact
+   sequence, is searched by bisection rather than hashed when there are
+   few values to look up: neither the table nor a hash table of its size
+   is then needed.  Its NAs and NaNs are at one end. */
+
+#define SORTED_MATCH_FACTOR 2
+
+static Rboolean sorted_match_ok(SEXP x, SEXP table)
+{
+    SEXPTYPE type = match_type(x, table);
+    R_xlen_t n = XLENGTH(table);
+    int sorted;
+
+    if (TYPEOF(table) != type || n > INT_MAX) return FALSE;
+    switch (type) {
+    case INTSXP: sorted = INTEGER_IS_SORTED(table); break;
+    case REALSXP: sorted = REAL_IS_SORTED(table); break;
+    default: return FALSE;
+    }
+    if (!KNOWN_SORTED(sorted)) return FALSE;
+    /* about log2(n) comparisons a value, against hashing the n
+       elements of the table */
+    int lg = 1;
+    for (R_xlen_t m = n; m > 1; m >>= 1) lg++;
+    return (double) XLENGTH(x) * lg <= SORTED_MATCH_FACTOR * (double) n;
+}
+
+/* [lo, hi) are the elements of the table which are not NA, and nalo
+   its first NA, or -1 */
+#define SORTED_MATCH_RANGE(IS_NA) do {					\
+	R_xlen_t l = 0, h = n;						\
+	while (l < h) {							\
+	    R_xlen_t mid = l + (h - l) / 2;				\
+	    if ((IS_NA(TVAL(mid)) != 0) == na1st) l = mid + 1;	\
+	    else h = mid;						\
+	}								\
+	if (na1st) { lo = l; hi = n; nalo = l > 0 ? 0 : -1; }		\
+	else { lo = 0; hi = l; nalo = l < n ? l : -1; }			\
+    } while (0)
+
+/* the first i in [lo, hi) with table[i] == v, else -1 */
+#define SORTED_MATCH_BISECT(v, i) do {					\
+	R_xlen_t l = lo, h = hi;					\
+	while (l < h) {							\
+	    R_xlen_t mid = l + (h - l) / 2;				\
+	    if (decr ? TVAL(mid) > v : TVAL(mid) < v) l = mid + 1;	\
+	    else h = mid;						\
+	}								\
+	i = (l < hi && TVAL(l) == v) ? l : -1;				\
+    } while (0)
+
+static SEXP sorted_match(SEXP table, SEXP x, int nmatch)
+{
+    R_xlen_t n = XLENGTH(table), nx = XLENGTH(x), lo, hi, nalo, i;
+    SEXP ans = PROTECT(allocVector(INTSXP, nx));
+    int *pa = INTEGER0(ans);
+
+    if (TYPEOF(table) == INTSXP) {
+	int sorted = INTEGER_IS_SORTED(table);
+	Rboolean decr = KNOWN_DECR(sorted), na1st = KNOWN_NA_1ST(sorted);
+	const int *pt = (const int *) DATAPTR_OR_NULL(table);
+#define TVAL(j) (pt ? pt[j] : INTEGER_ELT(table, j))
+#define ISNA_INT(v) ((v) == NA_INTEGER)
+	SORTED_MATCH_RANGE(ISNA_INT);
+	for (R_xlen_t k = 0; k < nx; k++) {
+	    int v = INTEGER_ELT(x, k);
+	    if (v == NA_INTEGER) i = nalo;
+	    else SORTED_MATCH_BISECT(v, i);
+	    pa[k] = i < 0 ? nmatch : (int) i + 1;
+	}
+#undef ISNA_INT
+#undef TVAL
+    } else {
+	int sorted = REAL_IS_SORTED(table);
+	Rboolean decr = KNOWN_DECR(sorted), na1st = KNOWN_NA_1ST(sorted);
+	const double *pt = (const double *) DATAPTR_OR_NULL(table);
+	/* the first NA and the first other NaN, found when needed */
+	R_xlen_t fNA = -1, fNaN = -1;
+	Rboolean nans = FALSE;
+#define TVAL(j) (pt ? pt[j] : REAL_ELT(table, j))
+	SORTED_MATCH_RANGE(ISNAN);
+	for (R_xlen_t k = 0; k < nx; k++) {
+	    double v = REAL_ELT(x, k);
+	    if (ISNAN(v)) {
+		if (!nans && nalo >= 0) {
+		    R_xlen_t e = na1st ? lo : n;
+		    for (R_xlen_t j = nalo; j < e; j++)
+			if (R_IsNA(TVAL(j))) { if (fNA < 0) fNA = j; }
+			else if (fNaN < 0) fNaN = j;
+		}
+		nans = TRUE;
+		i = R_IsNA(v) ? fNA : fNaN;
+	    }
+	    else SORTED_MATCH_BISECT(v, i);
+	    pa[k] = i < 0 ? nmatch : (int) i + 1;
+	}
+#undef TVAL
+    }
+    UNPROTECT(1);
+    return ans;
+}
+
+#undef SORTED_MATCH_BISECT
+#undef SORTED_MATCH_RANGE
+
 // workhorse of R's match() and hence also  " ix %in% itable "
 static /* or attribute_hidden? */
 SEXP match5(SEXP itable, SEXP ix, int nmatch, SEXP incomp, SEXP env)
@@ -1348,23 +1873,37 @@ SEXP match5(SEXP itable, SEXP ix, int nmatch, SEXP incomp, SEXP env)
 	return ans;
     }
 
-    int nprot = 0;
+    int nprot = 0, nth;
     SEXP x     = PROTECT(match_transform(ix,     env)); nprot++;
-    SEXP table = PROTECT(match_transform(itable, env)); nprot++;
+    /* A table with a hash index (see hashIndex()) is used as it is, so
+       long as it need not be transformed or coerced. */
+    SEXP index = R_NilValue, table = NULL;
+    Rboolean sorted = FALSE;
+    if (!incomp && !OBJECT(itable) &&
+	(index = R_HashIndexOf(itable)) != R_NilValue) {
+	table = R_HashIndexData(itable);
+	if (TYPEOF(table) != match_type(x, table)) {
+	    index = R_NilValue;
+	    table = NULL;
+	}
+    }
+    /* So is a table known to be sorted */
+    if (!table && !incomp && !OBJECT(itable) &&
+	(sorted = sorted_match_ok(x, itable)))
+	table = itable;
+    if (!table) table = match_transform(itable, env);
+    PROTECT(table); nprot++;
     /* or should we use PROTECT_WITH_INDEX and REPROTECT below ? */
 
-    SEXPTYPE type;
-    /* Coerce to a common type; type == NILSXP is ok here.
-     * Note that above we coerce factors and "POSIXlt", only to character.
-     * Hence, coerce to character or to `higher' type
-     * (given that we have "Vector" or NULL) */
-    if(TYPEOF(x) >= STRSXP || TYPEOF(table) >= STRSXP) type = STRSXP;
-    else type = TYPEOF(x) < TYPEOF(table) ? TYPEOF(table) : TYPEOF(x);
+    SEXPTYPE type = match_type(x, table);
     PROTECT(x	  = coerceVector(x,	type)); nprot++;
     PROTECT(table = coerceVector(table, type)); nprot++;
 
+    if (sorted) {
+	PROTECT(ans = sorted_match(table, x, nmatch)); nprot++;
+    }
     // special case scalar x -- for speed only :
-    if(XLENGTH(x) == 1 && !incomp) {
+    else if(XLENGTH(x) == 1 && !incomp && index == R_NilValue) {
       int val = nmatch;
       int ntable = LENGTH(table);
       switch (type) {
@@ -1422,16 +1961,19 @@ SEXP match5(SEXP itable, SEXP ix, int nmatch, SEXP incomp, SEXP env)
       }
       PROTECT(ans = ScalarInteger(val)); nprot++;
     }
+    else if (!incomp && index == R_NilValue &&
+	     (nth = phash_threads(x, table)) > 1) {
+	PROTECT(ans = allocVector(INTSXP, XLENGTH(x))); nprot++;
+	phash_match(table, x, nmatch, INTEGER0(ans), nth);
+    }
     else { // regular case
 	HashData data = { 0 };
 	if (incomp) { PROTECT(incomp = coerceVector(incomp, type)); nprot++; }
 	data.nomatch = nmatch;
-	HashTableSetup(table, &data, NA_INTEGER);
-	PROTECT(data.HashTable); nprot++;
+	Rboolean useUTF8 = FALSE;
+	Rboolean useCache = TRUE;
 	if(type == STRSXP) {
 	    Rboolean useBytes = FALSE;
-	    Rboolean useUTF8 = FALSE;
-	    Rboolean useCache = TRUE;
 	    for(R_xlen_t i = 0; i < xlength(x); i++) {
 		SEXP s = STRING_ELT(x, i);
 		if(IS_BYTES(s)) {
@@ -1447,7 +1989,15 @@ SEXP match5(SEXP itable, SEXP ix, int nmatch, SEXP incomp, SEXP env)
 		    break;
 		}
 	    }
-	    if(!useBytes || useCache) {
+	    /* The strings of an indexed table are cached and not in bytes
+	       encoding, so only whether they were hashed as UTF-8 matters;
+	       otherwise the index cannot be used. */
+	    if(index != R_NilValue && (!useBytes || useCache))
+		useUTF8 = useUTF8 || HASHINDEX_UTF8(index);
+	    if(index != R_NilValue &&
+	       (!useCache || useUTF8 != HASHINDEX_UTF8(index)))
+		index = R_NilValue;
+	    if(index == R_NilValue && (!useBytes || useCache)) {
 		for(int i = 0; i < LENGTH(table); i++) {
 		    SEXP s = STRING_ELT(table, i);
 		    if(IS_BYTES(s)) {
@@ -1468,11 +2018,19 @@ SEXP match5(SEXP itable, SEXP ix, int nmatch, SEXP incomp, SEXP env)
 		x = PROTECT(asUTF8(x)); nprot++;
 		table = PROTECT(asUTF8(table)); nprot++;
 	    }
-	    data.useUTF8 = useUTF8;
-	    data.useCache = useCache;
 	}
-	DoHashing(table, &data);
-	if (incomp) UndoHashing(incomp, table, &data);
+	if (index != R_NilValue)
+	    HashIndexSetup(table, index, &data);
+	else {
+	    HashTableSetup(table, &data, NA_INTEGER);
+	    PROTECT(data.HashTable); nprot++;
+	}
+	data.useUTF8 = useUTF8;
+	data.useCache = useCache;
+	if (index == R_NilValue) {
+	    DoHashing(table, &data);
+	    if (incomp) UndoHashing(incomp, table, &data);
+	}
 	ans = HashLookup(table, x, &data);
     }
     UNPROTECT(nprot);
@@ -2796,6 +2796,29 @@ attribute_hidden SEXP do_tabulate(SEXP call, SEXP op, SEXP args, SEXP rho)
 	ans = allocVector(INTSXP, nb);
 	int *y = INTEGER(ans);
 	if (nb) memset(y, 0, nb * sizeof(int));
+#ifdef _OPENMP
+	/* with options(hash.threads), long vectors are counted in chunks
+	   into a table per thread, as long as the tables are small */
+	int nth = R_HashThreads;
+	if (nth > 1 && n >= 1000000 && nb <= n / (4 * nth)) {
+	    PROTECT(ans);
+	    int *yt = (int *) R_alloc((size_t) nth * nb, sizeof(int));
+	    memset(yt, 0, (size_t) nth * nb * sizeof(int));
+#pragma omp parallel for num_threads(nth) schedule(static, 1)
+	    for (int t = 0; t < nth; t++) {
+		int *yy = yt + (size_t) t * nb;
+		R_xlen_t lo = n * t / nth, hi = n * (t + 1) / nth;
+		for (R_xlen_t i = lo; i < hi; i++)
+		    if (x[i] != NA_INTEGER && x[i] > 0 && x[i] <= nb)
+			yy[x[i] - 1]++;
+	    }
+	    for (int t = 0; t < nth; t++)
+		for (int b = 0; b < nb; b++)
+		    y[b] += yt[(size_t) t * nb + b];
+	    UNPROTECT(1);
+	    return ans;
+	}
+#endif
 	for(R_xlen_t i = 0 ; i < n ; i++)
 	    if (x[i] != NA_INTEGER && x[i] > 0 && x[i] <= nb) y[x[i] - 1]++;
     }